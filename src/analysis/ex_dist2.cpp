@@ -46,7 +46,7 @@ int main(int argc, char **argv)
   for (int i=0; i<vt.Frames().size()-1; i++) {
     int f = vt.Frames()[i];
     std::stringstream ss;
-    ss << "v." << f << "d." << f;
+    ss << "d." << f;
     std::string buf;
     std::vector<float> dist;
     
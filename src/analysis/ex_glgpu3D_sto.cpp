@@ -12,7 +12,8 @@ static int nogauge = 0,
            archive = 0,
            gpu = 1,
            nthreads = 0, 
-           tet = 1;
+           tet = 1,
+           ensemble = 0;
 static int T0=0, T=1; // start and length of timesteps
 static int span=1;
 
@@ -23,6 +24,7 @@ static struct option longopts[] = {
   {"archive", no_argument, &archive, 1}, 
   {"gpu", no_argument, &gpu, 1}, 
   {"tet", no_argument, &tet, 1},
+  {"ensemble", no_argument, &ensemble, 1},
   {"input", required_argument, 0, 'i'},
   {"output", required_argument, 0, 'o'},
   {"time", required_argument, 0, 't'}, 
@@ -78,6 +80,7 @@ static void print_help(int argc, char **argv)
   fprintf(stderr, "\n");
   fprintf(stderr, "\t--verbose   verbose output\n"); 
   fprintf(stderr, "\t--benchmark Enable benchmark\n"); 
+  fprintf(stderr, "\t--ensemble  Puncture probabilities of all realizations on CPU\n"); 
   fprintf(stderr, "\t--nogauge   Disable gauge transformation\n"); 
   fprintf(stderr, "\n");
 }
@@ -102,8 +105,23 @@ int main(int argc, char **argv)
   StochasticVortexExtractor ex;
   ex.SetDataset(&ds);
   ex.SetExtentThreshold(1e38);
-  ex.SetGPU(true);
+  if (nthreads > 0) ex.SetNumberOfThreads(nthreads);
 
+  if (ensemble) {
+    ex.SetGaugeTransformation(!nogauge);
+    ex.EstimatePunctureProbabilities(0);
+    const std::vector<float>& p = ex.PunctureProbabilities();
+    double expected = 0;
+    int nfaces = 0;
+    for (int i=0; i<p.size(); i++) {
+      expected += p[i];
+      if (p[i] > 0) nfaces ++;
+    }
+    fprintf(stderr, "#face_punctured_in_any_run=%d, expected_#punctured_faces=%f\n", nfaces, expected);
+    return EXIT_SUCCESS;
+  }
+
+  ex.SetGPU(true);
   ex.ExtractDeterministicVortices();
   ex.ExtractStochasticVortices();
 
@@ -13,6 +13,7 @@
 #include <tbb/concurrent_unordered_map.h>
 #include "io/GLGPU3DDataset.h"
 #include "extractor/Extractor.h"
+#include "common/VortexLineIndex.h"
 
 #if WITH_ROCKSDB
 #include <rocksdb/db.h>
@@ -78,6 +79,7 @@ static int num_buffered_frames = 0;
 
 static vfgpu_cfg_t cfg;
 static std::string infile;
+static std::vector<float> lod_tolerances; // level-of-detail geometry for viewers
 
 #ifdef WITH_ROCKSDB
 static rocksdb::DB* db;
@@ -98,11 +100,7 @@ static void write_vlines(int frame, std::vector<VortexLine>& vlines)
 {
 #if WITH_ROCKSDB
 #if 0
-  for (int i=0; i<vlines.size(); i++) {
-    vlines[i].RemoveInvalidPoints();
-    vlines[i].Simplify(0.1);
-    vlines[i].ToBezier(0.01);
-  }
+  PostProcessVortexLines(vlines, 0.1, 0.01);
 #endif
 
   std::stringstream ss;
@@ -111,18 +109,34 @@ static void write_vlines(int frame, std::vector<VortexLine>& vlines)
   ss << "v." << frame;
   db->Put(rocksdb::WriteOptions(), ss.str(), buf);
 
-#if 0
-  // compute distance
+  // resampled geometry for viewers, so that they do not refit on every frame switch
+  std::vector<VortexLine> rlines(vlines);
+  ResampleVortexLines(rlines, 500, 0.1, 1); // already in a per-frame task
+  ss.str("");
+  ss << "r." << frame;
+  diy::serialize(rlines, buf);
+  db->Put(rocksdb::WriteOptions(), ss.str(), buf);
+
+  // coarser levels of the resampled geometry; level 0 is r.<frame>
+  std::vector<std::vector<VortexLine> > lods;
+  BuildVortexLineLODs(rlines, lod_tolerances, lods, 1);
+  for (int k=1; k<lods.size(); k++) {
+    ss.str("");
+    ss << "l" << k << "." << frame;
+    diy::serialize(lods[k], buf);
+    db->Put(rocksdb::WriteOptions(), ss.str(), buf);
+  }
+
+  // distance matrix
+  VortexLineIndex index;
+  index.Build(vlines, cfg.lengths, cfg.pbc);
   std::vector<float> dist;
-  for (int i=0; i<vlines.size(); i++) 
-    for (int j=0; j<vlines.size(); j++) 
-      if (i==j) dist.push_back(0);
-      else dist.push_back(MinimumDist(vlines[i], vlines[j]));
-  ss.clear();
+  index.DistanceMatrix(dist, 1); // already in a per-frame task
+  
+  ss.str("");
   ss << "d." << frame;
   diy::serialize(dist, buf);
   db->Put(rocksdb::WriteOptions(), ss.str(), buf);
-#endif
 #else 
   std::stringstream ss;
   ss << infile << ".v." << frame;
@@ -261,7 +275,7 @@ struct track {
     VortexTransitionMatrix mat = ex->TraceOverTime();
     mat.SetInterval(interval);
     mat.Modularize();
-    vt.AddMatrix(mat);
+    vt.PushMatrix(mat); // sequences and events are built as soon as the preceding intervals are done
 
     delete ex;
     delete ds;
@@ -323,10 +337,14 @@ int main(int argc, char **argv)
   int pfcount, pecount;
   const int max_frames = 5000; // INT_MAX;
   int frame_count = 0;
-  std::vector<int> frames;
   std::vector<vfgpu_hdr_t> hdrs;
 
   fread(&cfg, sizeof(vfgpu_cfg_t), 1, fp);
+  DefaultVortexLineLODTolerances(cfg.cell_lengths, lod_tolerances);
+
+  vt.SetEventCallback([](const VortexEvent& e) {
+    std::cout << vt.EventToString(e) << std::endl;
+  });
 
   while (!feof(fp)) {
     if (frame_count ++ > max_frames) break;
@@ -344,6 +362,7 @@ int main(int argc, char **argv)
       fread(&pfcount, sizeof(int), 1, fp);
       
       hdrs_all[hdr.frame] = hdr;
+      vt.AppendFrame(hdr.frame);
       std::vector<vfgpu_pf_t> &pfs = pfs_all[hdr.frame];
       pfs.resize(pfcount);
       fread(pfs.data(), sizeof(vfgpu_pf_t), pfcount, fp);
@@ -353,7 +372,6 @@ int main(int argc, char **argv)
       extract_tasks[hdr.frame] = e;
 
       hdrs.push_back(hdr);
-      frames.push_back(hdr.frame);
       // fprintf(stderr, "pushed frame %d\n", hdr.frame);
     } else if (type_msg == VFGPU_MSG_PE) {
       std::pair<int, int> interval;
@@ -386,10 +404,14 @@ int main(int argc, char **argv)
   diy::serialize(hdrs, buf);
   db->Put(rocksdb::WriteOptions(), "hdrs", buf);
 
-  fprintf(stderr, "constructing sequences...\n");
-  vt.SetFrames(frames);
-  vt.ConstructSequence();
-  vt.PrintSequence();
+  diy::serialize(lod_tolerances, buf);
+  db->Put(rocksdb::WriteOptions(), "lods", buf);
+
+  const int gaps = vt.FlushMatrices();
+  if (gaps > 0) fprintf(stderr, "%d intervals have no transition\n", gaps);
+
+  fprintf(stderr, "coloring sequences...\n");
+  vt.SequenceGraphColoring();
   diy::serialize(vt, buf);
   db->Put(rocksdb::WriteOptions(), "trans", buf);
   
@@ -0,0 +1,61 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <string>
+#include <vector>
+#include "io/Condor2Dataset.h"
+
+// samples rho, phi, A and the supercurrent at the points (x y z per line) of 
+// a text file or stdin; points outside the mesh are printed as nan
+int main(int argc, char **argv)
+{
+  if (argc<3) {
+    fprintf(stderr, "USAGE: %s <input_file> <time_step> [points_file|-] [nthreads]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const std::string filename = argv[1];
+  const int timestep = atoi(argv[2]);
+  const int nthreads = argc>4 ? atoi(argv[4]) : std::thread::hardware_concurrency();
+
+  FILE *fp = stdin;
+  if (argc>3 && std::string(argv[3]) != "-") {
+    fp = fopen(argv[3], "r");
+    if (!fp) {
+      fprintf(stderr, "cannot open %s\n", argv[3]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<float> X;
+  float x[3];
+  while (fscanf(fp, "%f %f %f", &x[0], &x[1], &x[2]) == 3) 
+    X.insert(X.end(), x, x+3);
+  if (fp != stdin) fclose(fp);
+  const int n = X.size()/3;
+
+  libMesh::LibMeshInit init(1, argv); // set argc to 1 to supress PETSc warnings. 
+  Condor2Dataset ds(init.comm()); 
+  
+  ds.OpenDataFile(filename);
+  if (!ds.Valid()) {
+    fprintf(stderr, "Invalid input data.\n");
+    return EXIT_FAILURE;
+  }
+  ds.LoadTimeStep(timestep, 0);
+
+  std::vector<unsigned char> valid(n);
+  std::vector<float> rho(n, NAN), phi(n, NAN), A(n*3, NAN), J(n*3, NAN);
+  const int nvalid = ds.Interpolate(n, X.data(), 0, valid.data(), 
+      rho.data(), phi.data(), A.data(), J.data(), nthreads);
+  fprintf(stderr, "#points=%d, #located=%d\n", n, nvalid);
+
+  printf("# x y z rho phi Ax Ay Az Jx Jy Jz\n");
+  for (int i=0; i<n; i++) 
+    printf("%g %g %g %g %g %g %g %g %g %g %g\n", 
+        X[i*3], X[i*3+1], X[i*3+2], rho[i], phi[i], 
+        A[i*3], A[i*3+1], A[i*3+2], J[i*3], J[i*3+1], J[i*3+2]);
+
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include <unistd.h>
+#include <rocksdb/db.h>
+#include "common/VortexLine.h"
+#include "common/VortexTube.h"
+#include "common/VortexTransition.h"
+#include "common/VortexRenderer.h"
+
+typedef struct {
+  unsigned char meshtype;
+  bool tracking;
+  float dt;
+  int d[3];
+  unsigned int count; // d[0]*d[1]*d[2];
+  bool pbc[3];
+  float origins[3];
+  float lengths[3];
+  float cell_lengths[3];
+  float zaniso;
+} vfgpu_cfg_t;
+
+static rocksdb::DB* db;
+static VortexTransition vt;
+
+static bool load_frame(int i, std::vector<VortexLine>& vlines)
+{
+  const int timestep = vt.Frame(i);
+  std::stringstream ss;
+  std::string buf;
+
+  // the resampled geometry is used if the extractor cached it
+  ss << "r." << timestep;
+  db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+  if (!buf.empty())
+    diy::unserialize(buf, vlines);
+  else {
+    ss.str("");
+    ss << "v." << timestep;
+    db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+    if (buf.empty()) return false;
+    diy::unserialize(buf, vlines);
+    ResampleVortexLines(vlines, 500, 0.1, 1);
+  }
+
+  for (int j=0; j<vlines.size(); j++) {
+    vlines[j].gid = vt.lvid2gvid(i, vlines[j].id);
+    if (vlines[j].gid >= 0)
+      vt.SequenceColor(vlines[j].gid, vlines[j].r, vlines[j].g, vlines[j].b);
+    else
+      vlines[j].r = vlines[j].g = vlines[j].b = 128;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  std::string prefix = "frame-";
+  int width = 1920, height = 1080, ss = 2;
+  int nthreads = std::thread::hardware_concurrency();
+  int first = 0, last = -1;
+  bool tubes = true;
+  float radius = 0.3, line_width = 2, azimuth = 0, elevation = 0;
+
+  int c;
+  while ((c = getopt(argc, argv, "o:w:h:s:m:r:l:a:e:f:t:j:")) != -1) {
+    switch (c) {
+    case 'o': prefix = optarg; break;
+    case 'w': width = atoi(optarg); break;
+    case 'h': height = atoi(optarg); break;
+    case 's': ss = atoi(optarg); break;
+    case 'm': tubes = strcmp(optarg, "lines") != 0; break;
+    case 'r': radius = atof(optarg); break;
+    case 'l': line_width = atof(optarg); break;
+    case 'a': azimuth = atof(optarg); break;
+    case 'e': elevation = atof(optarg); break;
+    case 'f': first = atoi(optarg); break;
+    case 't': last = atoi(optarg); break;
+    case 'j': nthreads = atoi(optarg); break;
+    default: break;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "USAGE: %s [options] <dbname>\n", argv[0]);
+    fprintf(stderr, "  -o <prefix>      output images <prefix><frame>.ppm (default frame-)\n");
+    fprintf(stderr, "  -w, -h <pixels>  image size (default 1920x1080)\n");
+    fprintf(stderr, "  -s <n>           supersampling (default 2)\n");
+    fprintf(stderr, "  -m tubes|lines   geometry (default tubes)\n");
+    fprintf(stderr, "  -r <radius>      tube radius (default 0.3)\n");
+    fprintf(stderr, "  -l <pixels>      line width (default 2)\n");
+    fprintf(stderr, "  -a, -e <degrees> camera azimuth and elevation\n");
+    fprintf(stderr, "  -f, -t <frame>   first and last frames\n");
+    fprintf(stderr, "  -j <threads>     workers (default: all cores)\n");
+    return EXIT_FAILURE;
+  }
+
+  rocksdb::Options options;
+  rocksdb::Status s = rocksdb::DB::OpenForReadOnly(options, argv[optind], &db);
+  if (!s.ok()) {
+    fprintf(stderr, "cannot open %s: %s\n", argv[optind], s.ToString().c_str());
+    return EXIT_FAILURE;
+  }
+  if (!vt.LoadFromDB(db)) {
+    fprintf(stderr, "cannot load the vortex transitions\n");
+    return EXIT_FAILURE;
+  }
+
+  if (last < 0 || last >= vt.NTimesteps()) last = vt.NTimesteps() - 1;
+  first = std::max(first, 0);
+
+  // the camera frames the domain, or the lines of the first frame if the
+  // configuration was not saved
+  float LB[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, UB[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+  std::string buf;
+  s = db->Get(rocksdb::ReadOptions(), "cfg", &buf);
+  if (s.ok()) {
+    vfgpu_cfg_t cfg;
+    diy::unserialize(buf, cfg);
+    for (int k=0; k<3; k++) {
+      LB[k] = cfg.origins[k];
+      UB[k] = cfg.origins[k] + cfg.lengths[k];
+    }
+  } else {
+    std::vector<VortexLine> vlines;
+    load_frame(first, vlines);
+    for (int i=0; i<vlines.size(); i++) {
+      float lb[3], ub[3];
+      vlines[i].BoundingBox(lb, ub);
+      for (int k=0; k<3; k++) {
+        LB[k] = std::min(LB[k], lb[k]);
+        UB[k] = std::max(UB[k], ub[k]);
+      }
+    }
+  }
+
+  // one worker per core, each rendering whole frames
+  nthreads = std::max(1, std::min(nthreads, last - first + 1));
+  std::atomic<int> next(first), nrendered(0);
+  auto worker = [&]() {
+    VortexRenderer renderer(width, height, ss);
+    renderer.SetCamera(LB, UB, azimuth, elevation);
+    std::vector<VortexLine> vlines;
+    VortexTubeMesh mesh;
+    char filename[1024];
+
+    for (int i = next++; i <= last; i = next++) {
+      vlines.clear();
+      if (!load_frame(i, vlines)) {
+        fprintf(stderr, "frame %d not found\n", i);
+        continue;
+      }
+
+      renderer.Clear();
+      if (tubes) {
+        BuildVortexTubes(vlines, 20, radius, mesh, 1);
+        renderer.DrawTubes(mesh);
+      } else
+        renderer.DrawLines(vlines, line_width);
+
+      snprintf(filename, sizeof(filename), "%s%05d.ppm", prefix.c_str(), i);
+      if (!renderer.WritePPM(filename))
+        fprintf(stderr, "cannot write %s\n", filename);
+      else
+        fprintf(stderr, "rendered %s (%d/%d)\n", filename, ++nrendered, last - first + 1);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+
+  delete db;
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <string>
+#include "common/VortexLine.h"
+#include "common/VortexTube.h"
+
+// benchmark of the tube mesh generation, on the lines of a .vlines file or
+// on synthetic helices
+int main(int argc, char **argv)
+{
+  if (argc>4) {
+    fprintf(stderr, "USAGE: %s [vlines_file|-] [npatches] [nthreads]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const int npatches = argc>2 ? atoi(argv[2]) : 20;
+  const int nthreads = argc>3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+
+  std::vector<VortexLine> vlines;
+  if (argc>1 && std::string(argv[1]) != "-") 
+    diy::unserializeFromFile(argv[1], vlines);
+  else {
+    const int nlines = 2000, nverts = 500;
+    vlines.resize(nlines);
+    for (int i=0; i<nlines; i++) {
+      VortexLine &l = vlines[i];
+      l.r = 255; l.g = l.b = 0;
+      for (int j=0; j<nverts; j++) {
+        const float t = j * 0.05f;
+        l.push_back((i%50)*4 + cos(t)); 
+        l.push_back((i/50)*4 + sin(t));
+        l.push_back(t * 0.2f);
+      }
+    }
+  }
+
+  size_t nverts = 0;
+  for (int i=0; i<vlines.size(); i++) 
+    nverts += vlines[i].size()/3;
+  fprintf(stderr, "lines=%d, vertices=%zu, npatches=%d\n", (int)vlines.size(), nverts, npatches);
+
+  const int nruns = 5;
+  const int threads[2] = {1, nthreads};
+  for (int k=0; k<2; k++) {
+    VortexTubeMesh mesh;
+    double best = 1e30;
+    for (int r=0; r<nruns; r++) {
+      auto t0 = std::chrono::high_resolution_clock::now();
+      BuildVortexTubes(vlines, npatches, 0.3f, mesh, threads[k]);
+      auto t1 = std::chrono::high_resolution_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+    }
+    fprintf(stderr, "nthreads=%d, tube_vertices=%d, triangles=%d, time=%.3f ms\n", 
+        threads[k], mesh.NVertices(), mesh.NTriangles(), best*1000);
+  }
+
+  return 0;
+}
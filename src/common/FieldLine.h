@@ -2,10 +2,9 @@
 #define _FIELDLINE_H
 
 #include <vector>
-#include <list>
 #include <string>
 
-class FieldLine : public std::list<float> {
+class FieldLine : public std::vector<float> {
 public:
   FieldLine();
   ~FieldLine(); 
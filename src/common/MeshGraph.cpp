@@ -1,8 +1,11 @@
 #include "MeshGraph.h"
+#include "MeshGraphCSR.h"
 #include <cassert>
 #include <climits>
 #include <cstdio>
 #include <climits>
+#include <algorithm>
+#include <thread>
 
 #if WITH_PROTOBUF
 #include "MeshGraph.pb.h"
@@ -353,3 +356,408 @@ void MeshGraphBuilder_Tet::AddCell(
     cell.faces_chirality.push_back(chirality);
   }
 }
+
+////////////////////////
+// sorted node keys of face and edge occurrences, ordered by key and then by
+// occurrence, so that the first occurrence leads each run
+struct FaceRecord {
+  NodeIdType key[3];
+  size_t o;
+
+  bool SameKey(const FaceRecord& r) const {return key[0] == r.key[0] && key[1] == r.key[1] && key[2] == r.key[2];}
+  bool operator<(const FaceRecord& r) const {
+    if (key[0] != r.key[0]) return key[0] < r.key[0];
+    if (key[1] != r.key[1]) return key[1] < r.key[1];
+    if (key[2] != r.key[2]) return key[2] < r.key[2];
+    return o < r.o;
+  }
+};
+
+struct EdgeRecord {
+  NodeIdType key[2];
+  size_t o;
+
+  bool SameKey(const EdgeRecord& r) const {return key[0] == r.key[0] && key[1] == r.key[1];}
+  bool operator<(const EdgeRecord& r) const {
+    if (key[0] != r.key[0]) return key[0] < r.key[0];
+    if (key[1] != r.key[1]) return key[1] < r.key[1];
+    return o < r.o;
+  }
+};
+
+// chiralities of occurrences relative to the stored edge or face, looked up
+// in the same order as MeshGraphBuilder_Tet::GetEdge and GetFace
+static ChiralityType edge_chirality(EdgeIdType2 g2, EdgeIdType2 e2)
+{
+  for (ChiralityType chirality=-1; chirality<2; chirality+=2)
+    if (AlternateEdge(g2, chirality) == e2) return chirality;
+  return 1;
+}
+
+static ChiralityType face_chirality(FaceIdType3 g3, FaceIdType3 f3)
+{
+  for (ChiralityType chirality=-1; chirality<2; chirality+=2)
+    for (int rotation=0; rotation<3; rotation++)
+      if (AlternateFace(g3, rotation, chirality) == f3) return chirality;
+  return 1;
+}
+
+static int num_threads(int nthreads, size_t n)
+{
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  return std::max(1, (int)std::min((size_t)nthreads, n/4096 + 1)); // small inputs are not worth threads
+}
+
+// f(tid, i0, i1) on nthreads contiguous blocks of [0, n)
+template <typename F>
+static void parallel_blocks(size_t n, int nthreads, const F& f)
+{
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(f, tid, n*tid/nthreads, n*(tid+1)/nthreads));
+  f(0, 0, n/nthreads);
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
+
+// sorts the blocks in parallel and merges them pairwise
+template <typename T>
+static void parallel_sort(std::vector<T>& v, int nthreads)
+{
+  const size_t n = v.size();
+  parallel_blocks(n, nthreads, [&](int, size_t i0, size_t i1) {
+    std::sort(v.begin() + i0, v.begin() + i1);
+  });
+
+  for (int width=1; width<nthreads; width*=2) {
+    std::vector<std::thread> threads;
+    for (int i=0; i+width<nthreads; i+=2*width) {
+      const size_t b0 = n*i/nthreads, b1 = n*(i+width)/nthreads,
+                   b2 = n*std::min(i+2*width, nthreads)/nthreads;
+      threads.push_back(std::thread([&v, b0, b1, b2]() {
+        std::inplace_merge(v.begin() + b0, v.begin() + b1, v.begin() + b2);
+      }));
+    }
+    for (int i=0; i<threads.size(); i++)
+      threads[i].join();
+  }
+}
+
+// exclusive prefix sums of a[0..n) in place; returns the total
+template <typename T>
+static T parallel_scan(T *a, size_t n, int nthreads)
+{
+  std::vector<T> sums(nthreads+1, 0);
+  parallel_blocks(n, nthreads, [&](int tid, size_t i0, size_t i1) {
+    T s = 0;
+    for (size_t i=i0; i<i1; i++) s += a[i];
+    sums[tid+1] = s;
+  });
+  for (int t=0; t<nthreads; t++)
+    sums[t+1] += sums[t];
+  parallel_blocks(n, nthreads, [&](int tid, size_t i0, size_t i1) {
+    T s = sums[tid];
+    for (size_t i=i0; i<i1; i++) {
+      const T x = a[i];
+      a[i] = s;
+      s += x;
+    }
+  });
+  return sums[nthreads];
+}
+
+// counts in offsets[0..n) to offsets[0..n]
+static void counts_to_offsets(uint64_t *offsets, size_t n, int nthreads)
+{
+  offsets[n] = parallel_scan(offsets, n, nthreads);
+}
+
+// f(k0, k1) for each run [k0, k1) of equal keys in the sorted records; runs
+// that cross block boundaries are handled by the block where they start
+template <typename T, typename F>
+static void parallel_runs(const std::vector<T>& records, int nthreads, const F& f)
+{
+  const size_t n = records.size();
+  parallel_blocks(n, nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t k=i0; k<i1; k++) {
+      if (k > 0 && records[k].SameKey(records[k-1])) continue;
+      size_t m = k+1;
+      while (m < n && records[m].SameKey(records[k])) m++;
+      f(k, m);
+    }
+  });
+}
+
+// for each occurrence, the first occurrence with the same key
+template <typename T>
+static void first_occurrences(const std::vector<T>& records, std::vector<size_t>& first, int nthreads)
+{
+  first.resize(records.size());
+  parallel_runs(records, nthreads, [&](size_t k0, size_t k1) {
+    for (size_t m=k0; m<k1; m++)
+      first[records[m].o] = records[k0].o;
+  });
+}
+
+// ids of the first occurrences in the order of occurrence; returns the count
+static size_t number_first_occurrences(const std::vector<size_t>& first, std::vector<size_t>& ids, int nthreads)
+{
+  ids.resize(first.size());
+  parallel_blocks(first.size(), nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t o=i0; o<i1; o++)
+      ids[o] = first[o] == o;
+  });
+  return parallel_scan(ids.data(), ids.size(), nthreads);
+}
+
+MeshGraphBuilder_TetParallel::MeshGraphBuilder_TetParallel(int ncells, MeshGraph& mg, int nthreads) : 
+  MeshGraphBuilder(mg), 
+  _nthreads(nthreads),
+  _ncells(ncells)
+{
+  _cells.reserve(ncells);
+  _cell_nodes.reserve((size_t)ncells*4);
+  _cell_neighbors.reserve((size_t)ncells*4);
+  _faces.reserve((size_t)ncells*12);
+  _face_cells.reserve((size_t)ncells*4);
+  _face_fids.reserve((size_t)ncells*4);
+
+  _cell_nodes_offsets.assign(1, 0);
+  _cell_neighbors_offsets.assign(1, 0);
+  _cell_faces_offsets.assign(1, 0);
+}
+
+void MeshGraphBuilder_TetParallel::AddCell(
+    CellIdType c,
+    const std::vector<NodeIdType> &nodes, 
+    const std::vector<CellIdType> &neighbors, 
+    const std::vector<FaceIdType3> &faces)
+{
+  _cells.push_back(c);
+  _cell_nodes.insert(_cell_nodes.end(), nodes.begin(), nodes.end());
+  _cell_nodes_offsets.push_back(_cell_nodes.size());
+  _cell_neighbors.insert(_cell_neighbors.end(), neighbors.begin(), neighbors.end());
+  _cell_neighbors_offsets.push_back(_cell_neighbors.size());
+
+  for (int i=0; i<faces.size(); i++) {
+    _faces.push_back(get<0>(faces[i]));
+    _faces.push_back(get<1>(faces[i]));
+    _faces.push_back(get<2>(faces[i]));
+    _face_cells.push_back(c);
+    _face_fids.push_back(i);
+  }
+  _cell_faces_offsets.push_back(_face_cells.size());
+}
+
+void MeshGraphBuilder_TetParallel::Build()
+{
+  typedef MeshGraphCSR M;
+  const size_t n = _face_cells.size(); // face occurrences
+  const int nthreads = num_threads(_nthreads, n);
+
+  // faces are numbered by their first occurrences
+  std::vector<FaceRecord> face_records(n);
+  parallel_blocks(n, nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t o=i0; o<i1; o++) {
+      FaceRecord &r = face_records[o];
+      std::copy(&_faces[o*3], &_faces[o*3] + 3, r.key);
+      std::sort(r.key, r.key + 3);
+      r.o = o;
+    }
+  });
+  parallel_sort(face_records, nthreads);
+
+  std::vector<size_t> first, face_ids;
+  first_occurrences(face_records, first, nthreads);
+  const size_t nf = number_first_occurrences(first, face_ids, nthreads);
+
+  std::vector<size_t> face_occ(nf); // the first occurrence of each face
+  parallel_blocks(n, nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t o=i0; o<i1; o++)
+      if (first[o] == o) face_occ[face_ids[o]] = o;
+  });
+
+  // edge occurrences are the three edges of each face, in the order in
+  // which the sequential builder adds them
+  const size_t nq = nf*3;
+  std::vector<EdgeRecord> edge_records(nq);
+  parallel_blocks(nq, nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t q=i0; q<i1; q++) {
+      const NodeIdType *nodes = &_faces[face_occ[q/3]*3];
+      EdgeRecord &r = edge_records[q];
+      r.key[0] = std::min(nodes[q%3], nodes[(q+1)%3]);
+      r.key[1] = std::max(nodes[q%3], nodes[(q+1)%3]);
+      r.o = q;
+    }
+  });
+  parallel_sort(edge_records, nthreads);
+
+  std::vector<size_t> edge_ids;
+  first_occurrences(edge_records, first, nthreads);
+  const size_t ne = number_first_occurrences(first, edge_ids, nthreads);
+  std::vector<size_t>().swap(first);
+
+  // the packed graph is built in place; other mesh graphs are unpacked from it
+  uint64_t counts[M::NUM_ARRAYS];
+  counts[M::EDGE_NODES] = ne*2;
+  counts[M::EDGE_FACES_OFFSETS] = ne+1;
+  counts[M::EDGE_FACES] = counts[M::EDGE_FACES_CHIRALITY] = counts[M::EDGE_FACES_EID] = nq;
+  counts[M::FACE_NODES_OFFSETS] = counts[M::FACE_EDGES_OFFSETS] = counts[M::FACE_CELLS_OFFSETS] = nf+1;
+  counts[M::FACE_NODES] = counts[M::FACE_EDGES] = counts[M::FACE_EDGES_CHIRALITY] = nq;
+  counts[M::FACE_CELLS] = counts[M::FACE_CELLS_CHIRALITY] = counts[M::FACE_CELLS_FID] = n;
+  counts[M::CELL_NODES_OFFSETS] = counts[M::CELL_FACES_OFFSETS] = counts[M::CELL_NEIGHBORS_OFFSETS] = _ncells+1;
+  counts[M::CELL_NODES] = _cell_nodes.size();
+  counts[M::CELL_FACES] = counts[M::CELL_FACES_CHIRALITY] = n;
+  counts[M::CELL_NEIGHBORS] = _cell_neighbors.size();
+
+  M packed, *csr = dynamic_cast<M*>(&_mg);
+  M &mg = csr ? *csr : packed;
+  mg.Allocate(ne, nf, _ncells, counts);
+
+  BuildCells(mg, nthreads);
+
+  // faces, and the faces of the cells
+  uint64_t *face_nodes_offsets = mg.Array<uint64_t>(M::FACE_NODES_OFFSETS),
+           *face_edges_offsets = mg.Array<uint64_t>(M::FACE_EDGES_OFFSETS),
+           *face_cells_offsets = mg.Array<uint64_t>(M::FACE_CELLS_OFFSETS);
+  NodeIdType *face_nodes = mg.Array<NodeIdType>(M::FACE_NODES);
+  CellIdType *face_cells = mg.Array<CellIdType>(M::FACE_CELLS);
+  ChiralityType *face_cells_chirality = mg.Array<ChiralityType>(M::FACE_CELLS_CHIRALITY);
+  unsigned char *face_cells_fid = mg.Array<unsigned char>(M::FACE_CELLS_FID);
+  const uint64_t *cell_faces_offsets = mg.Array<uint64_t>(M::CELL_FACES_OFFSETS);
+  FaceIdType *cell_faces = mg.Array<FaceIdType>(M::CELL_FACES);
+  ChiralityType *cell_faces_chirality = mg.Array<ChiralityType>(M::CELL_FACES_CHIRALITY);
+
+  parallel_blocks(nf+1, nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t f=i0; f<i1; f++) {
+      face_nodes_offsets[f] = face_edges_offsets[f] = f*3;
+      if (f < nf) std::copy(&_faces[face_occ[f]*3], &_faces[face_occ[f]*3] + 3, face_nodes + f*3);
+    }
+  });
+
+  parallel_runs(face_records, nthreads, [&](size_t k0, size_t k1) {
+    face_cells_offsets[face_ids[face_records[k0].o]] = k1 - k0;
+  });
+  counts_to_offsets(face_cells_offsets, nf, nthreads);
+
+  parallel_runs(face_records, nthreads, [&](size_t k0, size_t k1) {
+    const size_t o0 = face_records[k0].o;
+    const FaceIdType f = face_ids[o0];
+    const FaceIdType3 f3 = make_tuple(face_nodes[(size_t)f*3], face_nodes[(size_t)f*3+1], face_nodes[(size_t)f*3+2]);
+
+    for (size_t m=k0; m<k1; m++) {
+      const size_t o = face_records[m].o, i = face_cells_offsets[f] + m - k0;
+      const ChiralityType chirality = o == o0 ? 1 : 
+        face_chirality(make_tuple(_faces[o*3], _faces[o*3+1], _faces[o*3+2]), f3);
+
+      face_cells[i] = _face_cells[o];
+      face_cells_chirality[i] = chirality;
+      face_cells_fid[i] = _face_fids[o];
+
+      const uint64_t j = cell_faces_offsets[_face_cells[o]] + _face_fids[o];
+      cell_faces[j] = f;
+      cell_faces_chirality[j] = chirality;
+    }
+  });
+  std::vector<FaceRecord>().swap(face_records);
+
+  // edges, and the edges of the faces
+  NodeIdType *edge_nodes = mg.Array<NodeIdType>(M::EDGE_NODES);
+  uint64_t *edge_faces_offsets = mg.Array<uint64_t>(M::EDGE_FACES_OFFSETS);
+  FaceIdType *edge_faces = mg.Array<FaceIdType>(M::EDGE_FACES);
+  ChiralityType *edge_faces_chirality = mg.Array<ChiralityType>(M::EDGE_FACES_CHIRALITY);
+  unsigned char *edge_faces_eid = mg.Array<unsigned char>(M::EDGE_FACES_EID);
+  EdgeIdType *face_edges = mg.Array<EdgeIdType>(M::FACE_EDGES);
+  ChiralityType *face_edges_chirality = mg.Array<ChiralityType>(M::FACE_EDGES_CHIRALITY);
+
+  parallel_runs(edge_records, nthreads, [&](size_t k0, size_t k1) {
+    const size_t q0 = edge_records[k0].o;
+    const EdgeIdType e = edge_ids[q0];
+    edge_nodes[(size_t)e*2] = face_nodes[q0];
+    edge_nodes[(size_t)e*2+1] = face_nodes[q0/3*3 + (q0+1)%3];
+    edge_faces_offsets[e] = k1 - k0;
+  });
+  counts_to_offsets(edge_faces_offsets, ne, nthreads);
+
+  parallel_runs(edge_records, nthreads, [&](size_t k0, size_t k1) {
+    const size_t q0 = edge_records[k0].o;
+    const EdgeIdType e = edge_ids[q0];
+    const EdgeIdType2 e2 = make_tuple(edge_nodes[(size_t)e*2], edge_nodes[(size_t)e*2+1]);
+
+    for (size_t m=k0; m<k1; m++) {
+      const size_t q = edge_records[m].o, i = edge_faces_offsets[e] + m - k0;
+      const ChiralityType chirality = q == q0 ? 1 : 
+        edge_chirality(make_tuple(face_nodes[q], face_nodes[q/3*3 + (q+1)%3]), e2);
+
+      edge_faces[i] = q/3;
+      edge_faces_chirality[i] = chirality;
+      edge_faces_eid[i] = q%3;
+
+      face_edges[q] = e;
+      face_edges_chirality[q] = chirality;
+    }
+  });
+
+  if (!csr) Unpack(packed, nthreads);
+
+  std::vector<CellIdType>().swap(_cells);
+  std::vector<uint64_t>().swap(_cell_nodes_offsets);
+  std::vector<uint64_t>().swap(_cell_neighbors_offsets);
+  std::vector<uint64_t>().swap(_cell_faces_offsets);
+  std::vector<NodeIdType>().swap(_cell_nodes);
+  std::vector<CellIdType>().swap(_cell_neighbors);
+  std::vector<NodeIdType>().swap(_faces);
+  std::vector<CellIdType>().swap(_face_cells);
+  std::vector<unsigned char>().swap(_face_fids);
+}
+
+void MeshGraphBuilder_TetParallel::BuildCells(MeshGraphCSR& mg, int nthreads)
+{
+  typedef MeshGraphCSR M;
+  uint64_t *nodes_offsets = mg.Array<uint64_t>(M::CELL_NODES_OFFSETS),
+           *neighbors_offsets = mg.Array<uint64_t>(M::CELL_NEIGHBORS_OFFSETS),
+           *faces_offsets = mg.Array<uint64_t>(M::CELL_FACES_OFFSETS);
+  NodeIdType *nodes = mg.Array<NodeIdType>(M::CELL_NODES);
+  CellIdType *neighbors = mg.Array<CellIdType>(M::CELL_NEIGHBORS);
+
+  // cells are added in any order; those not added have no entries
+  const size_t nk = _cells.size();
+  parallel_blocks(nk, nthreads, [&](int, size_t k0, size_t k1) {
+    for (size_t k=k0; k<k1; k++) {
+      const CellIdType c = _cells[k];
+      nodes_offsets[c] = _cell_nodes_offsets[k+1] - _cell_nodes_offsets[k];
+      neighbors_offsets[c] = _cell_neighbors_offsets[k+1] - _cell_neighbors_offsets[k];
+      faces_offsets[c] = _cell_faces_offsets[k+1] - _cell_faces_offsets[k];
+    }
+  });
+  counts_to_offsets(nodes_offsets, _ncells, nthreads);
+  counts_to_offsets(neighbors_offsets, _ncells, nthreads);
+  counts_to_offsets(faces_offsets, _ncells, nthreads);
+
+  parallel_blocks(nk, nthreads, [&](int, size_t k0, size_t k1) {
+    for (size_t k=k0; k<k1; k++) {
+      const CellIdType c = _cells[k];
+      std::copy(&_cell_nodes[0] + _cell_nodes_offsets[k], &_cell_nodes[0] + _cell_nodes_offsets[k+1], 
+          nodes + nodes_offsets[c]);
+      std::copy(&_cell_neighbors[0] + _cell_neighbors_offsets[k], &_cell_neighbors[0] + _cell_neighbors_offsets[k+1], 
+          neighbors + neighbors_offsets[c]);
+    }
+  });
+}
+
+void MeshGraphBuilder_TetParallel::Unpack(const MeshGraphCSR& mg, int nthreads)
+{
+  _mg.edges.resize(mg.NEdges());
+  _mg.faces.resize(mg.NFaces());
+  _mg.cells.resize(mg.NCells());
+
+  parallel_blocks(mg.NEdges(), nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t i=i0; i<i1; i++) _mg.edges[i] = mg.Edge(i);
+  });
+  parallel_blocks(mg.NFaces(), nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t i=i0; i<i1; i++) _mg.faces[i] = mg.Face(i);
+  });
+  parallel_blocks(mg.NCells(), nthreads, [&](int, size_t i0, size_t i1) {
+    for (size_t i=i0; i<i1; i++) _mg.cells[i] = mg.Cell(i);
+  });
+}
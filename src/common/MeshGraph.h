@@ -3,6 +3,7 @@
 
 #include "def.h"
 #include <vector>
+#include <stdint.h>
 #include <bitset>
 #include <map>
 
@@ -89,6 +90,8 @@ struct CCell {
 
 class MeshGraphBuilder;
 class MeshGraphBuilder_Tet;
+class MeshGraphBuilder_TetParallel;
+class MeshGraphCSR;
 class MeshGraphBuilder_Hex;
 
 class MeshGraphRegular2D;
@@ -98,6 +101,7 @@ class MeshGraph {
 protected:
   friend class MeshGraphBuilder;
   friend class MeshGraphBuilder_Tet;
+  friend class MeshGraphBuilder_TetParallel;
   friend class MeshGraphBuilder_Hex;
   
   std::vector<CEdge> edges;
@@ -105,7 +109,7 @@ protected:
   std::vector<CCell> cells;
 
 public:
-  ~MeshGraph();
+  virtual ~MeshGraph();
   
   void Clear();
 
@@ -159,4 +163,42 @@ private:
   std::map<FaceIdType3, FaceIdType> _face_map;
 };
 
+// Builds the same graph as MeshGraphBuilder_Tet, in parallel (nthreads=0 for
+// all cores).  AddCell() only records the cells; Build() sorts the face
+// occurrences by their sorted node keys and numbers the faces by run-length
+// grouping, in the order the sequential builder would have met them, and
+// then does the same for the edges of the faces.  The relations are written
+// in place if the mesh graph is a MeshGraphCSR, and are unpacked into the
+// vectors otherwise.  Each cell is added once.
+class MeshGraphBuilder_TetParallel : public MeshGraphBuilder {
+public:
+  explicit MeshGraphBuilder_TetParallel(int ncells, MeshGraph& mg, int nthreads=0);
+  ~MeshGraphBuilder_TetParallel() {}
+
+  void AddCell(
+      CellIdType c, 
+      const std::vector<NodeIdType> &nodes, 
+      const std::vector<CellIdType> &neighbors, 
+      const std::vector<FaceIdType3> &faces);
+
+  void Build();
+
+private:
+  void BuildCells(MeshGraphCSR& mg, int nthreads);
+  void Unpack(const MeshGraphCSR& mg, int nthreads);
+
+private:
+  int _nthreads;
+  CellIdType _ncells;
+
+  // cells and their face occurrences in the order of AddCell()
+  std::vector<CellIdType> _cells;
+  std::vector<uint64_t> _cell_nodes_offsets, _cell_neighbors_offsets, _cell_faces_offsets;
+  std::vector<NodeIdType> _cell_nodes;
+  std::vector<CellIdType> _cell_neighbors;
+  std::vector<NodeIdType> _faces; // 3 nodes each
+  std::vector<CellIdType> _face_cells;
+  std::vector<unsigned char> _face_fids;
+};
+
 #endif
@@ -0,0 +1,394 @@
+#include "MeshGraphCSR.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char csr_magic[8] = {'V', 'F', 'M', 'G', 'C', 'S', 'R', 0};
+static const uint32_t csr_version = 1;
+static const size_t csr_alignment = 64;
+
+// owner entity (0: edges, 1: faces, 2: cells), the offsets array of the
+// relation (-1 for offsets arrays, -2 for the edge nodes), and the entry size
+// (0 for ids)
+static const struct {int entity, offsets, size;} csr_arrays[MeshGraphCSR::NUM_ARRAYS] = {
+  {0, -2, 0},
+  {0, -1, 8}, {0, MeshGraphCSR::EDGE_FACES_OFFSETS, 0}, {0, MeshGraphCSR::EDGE_FACES_OFFSETS, 1}, {0, MeshGraphCSR::EDGE_FACES_OFFSETS, 1},
+  {1, -1, 8}, {1, MeshGraphCSR::FACE_NODES_OFFSETS, 0},
+  {1, -1, 8}, {1, MeshGraphCSR::FACE_EDGES_OFFSETS, 0}, {1, MeshGraphCSR::FACE_EDGES_OFFSETS, 1},
+  {1, -1, 8}, {1, MeshGraphCSR::FACE_CELLS_OFFSETS, 0}, {1, MeshGraphCSR::FACE_CELLS_OFFSETS, 1}, {1, MeshGraphCSR::FACE_CELLS_OFFSETS, 1},
+  {2, -1, 8}, {2, MeshGraphCSR::CELL_NODES_OFFSETS, 0},
+  {2, -1, 8}, {2, MeshGraphCSR::CELL_FACES_OFFSETS, 0}, {2, MeshGraphCSR::CELL_FACES_OFFSETS, 1},
+  {2, -1, 8}, {2, MeshGraphCSR::CELL_NEIGHBORS_OFFSETS, 0}
+};
+
+static inline size_t csr_entry_size(int a)
+{
+  return csr_arrays[a].size ? csr_arrays[a].size : sizeof(NodeIdType);
+}
+
+static inline size_t csr_align(size_t n)
+{
+  return (n + csr_alignment - 1) / csr_alignment * csr_alignment;
+}
+
+// whether the offsets arrays do not decrease, so that with their first and 
+// last entries checked, every row is in bounds; touches all offsets pages
+static bool csr_monotonic_offsets(const char *base, const MeshGraphCSR::Header *hdr)
+{
+  for (int a=0; a<MeshGraphCSR::NUM_ARRAYS; a++) {
+    if (csr_arrays[a].offsets != -1) continue;
+    const uint64_t *off = (const uint64_t*)(base + hdr->arrays[a][0]);
+    for (uint64_t i=0; i+1<hdr->arrays[a][1]; i++)
+      if (off[i] > off[i+1]) {
+        fprintf(stderr, "[MeshGraphCSR] decreasing offsets in array %d.\n", a);
+        return false;
+      }
+  }
+  return true;
+}
+
+MeshGraphCSR::MeshGraphCSR() :
+  _map(NULL), _map_size(0), _base(NULL), _size(0), _hdr(NULL)
+{
+  static_assert(sizeof(NodeIdType) == sizeof(EdgeIdType) && sizeof(NodeIdType) == sizeof(FaceIdType) &&
+      sizeof(NodeIdType) == sizeof(CellIdType), "all ids are stored with the same size");
+}
+
+MeshGraphCSR::MeshGraphCSR(const MeshGraph& mg) :
+  _map(NULL), _map_size(0), _base(NULL), _size(0), _hdr(NULL)
+{
+  const uint64_t ne = mg.NEdges(), nf = mg.NFaces(), nc = mg.NCells();
+
+  uint64_t counts[NUM_ARRAYS] = {0};
+  counts[EDGE_NODES] = ne*2;
+  for (EdgeIdType i=0; i<ne; i++)
+    counts[EDGE_FACES] += mg.Edge(i).contained_faces.size();
+  for (FaceIdType i=0; i<nf; i++) {
+    const CFace f = mg.Face(i);
+    counts[FACE_NODES] += f.nodes.size();
+    counts[FACE_EDGES] += f.edges.size();
+    counts[FACE_CELLS] += f.contained_cells.size();
+  }
+  for (CellIdType i=0; i<nc; i++) {
+    const CCell c = mg.Cell(i);
+    counts[CELL_NODES] += c.nodes.size();
+    counts[CELL_FACES] += c.faces.size();
+    counts[CELL_NEIGHBORS] += c.neighbor_cells.size();
+  }
+  for (int a=0; a<NUM_ARRAYS; a++) {
+    const int o = csr_arrays[a].offsets;
+    if (o == -1) counts[a] = (csr_arrays[a].entity == 0 ? ne : csr_arrays[a].entity == 1 ? nf : nc) + 1;
+    else if (o >= 0) counts[a] = counts[o+1]; // as the first payload array of the relation
+  }
+
+  Allocate(ne, nf, nc, counts);
+
+  NodeIdType *edge_nodes = Array<NodeIdType>(EDGE_NODES);
+  uint64_t *edge_faces_offsets = Array<uint64_t>(EDGE_FACES_OFFSETS);
+  FaceIdType *edge_faces = Array<FaceIdType>(EDGE_FACES);
+  ChiralityType *edge_faces_chirality = Array<ChiralityType>(EDGE_FACES_CHIRALITY);
+  unsigned char *edge_faces_eid = Array<unsigned char>(EDGE_FACES_EID);
+  edge_faces_offsets[0] = 0;
+  for (EdgeIdType i=0; i<ne; i++) {
+    const CEdge e = mg.Edge(i);
+    const uint64_t o = edge_faces_offsets[i];
+    edge_nodes[i*2] = e.node0;
+    edge_nodes[i*2+1] = e.node1;
+    for (int j=0; j<e.contained_faces.size(); j++) {
+      edge_faces[o+j] = e.contained_faces[j];
+      edge_faces_chirality[o+j] = e.contained_faces_chirality[j];
+      edge_faces_eid[o+j] = e.contained_faces_eid[j];
+    }
+    edge_faces_offsets[i+1] = o + e.contained_faces.size();
+  }
+
+  uint64_t *face_nodes_offsets = Array<uint64_t>(FACE_NODES_OFFSETS),
+           *face_edges_offsets = Array<uint64_t>(FACE_EDGES_OFFSETS),
+           *face_cells_offsets = Array<uint64_t>(FACE_CELLS_OFFSETS);
+  NodeIdType *face_nodes = Array<NodeIdType>(FACE_NODES);
+  EdgeIdType *face_edges = Array<EdgeIdType>(FACE_EDGES);
+  ChiralityType *face_edges_chirality = Array<ChiralityType>(FACE_EDGES_CHIRALITY);
+  CellIdType *face_cells = Array<CellIdType>(FACE_CELLS);
+  ChiralityType *face_cells_chirality = Array<ChiralityType>(FACE_CELLS_CHIRALITY);
+  unsigned char *face_cells_fid = Array<unsigned char>(FACE_CELLS_FID);
+  face_nodes_offsets[0] = face_edges_offsets[0] = face_cells_offsets[0] = 0;
+  for (FaceIdType i=0; i<nf; i++) {
+    const CFace f = mg.Face(i);
+    uint64_t o = face_nodes_offsets[i];
+    for (int j=0; j<f.nodes.size(); j++)
+      face_nodes[o+j] = f.nodes[j];
+    face_nodes_offsets[i+1] = o + f.nodes.size();
+
+    o = face_edges_offsets[i];
+    for (int j=0; j<f.edges.size(); j++) {
+      face_edges[o+j] = f.edges[j];
+      face_edges_chirality[o+j] = f.edges_chirality[j];
+    }
+    face_edges_offsets[i+1] = o + f.edges.size();
+
+    o = face_cells_offsets[i];
+    for (int j=0; j<f.contained_cells.size(); j++) {
+      face_cells[o+j] = f.contained_cells[j];
+      face_cells_chirality[o+j] = f.contained_cells_chirality[j];
+      face_cells_fid[o+j] = f.contained_cells_fid[j];
+    }
+    face_cells_offsets[i+1] = o + f.contained_cells.size();
+  }
+
+  uint64_t *cell_nodes_offsets = Array<uint64_t>(CELL_NODES_OFFSETS),
+           *cell_faces_offsets = Array<uint64_t>(CELL_FACES_OFFSETS),
+           *cell_neighbors_offsets = Array<uint64_t>(CELL_NEIGHBORS_OFFSETS);
+  NodeIdType *cell_nodes = Array<NodeIdType>(CELL_NODES);
+  FaceIdType *cell_faces = Array<FaceIdType>(CELL_FACES);
+  ChiralityType *cell_faces_chirality = Array<ChiralityType>(CELL_FACES_CHIRALITY);
+  CellIdType *cell_neighbors = Array<CellIdType>(CELL_NEIGHBORS);
+  cell_nodes_offsets[0] = cell_faces_offsets[0] = cell_neighbors_offsets[0] = 0;
+  for (CellIdType i=0; i<nc; i++) {
+    const CCell c = mg.Cell(i);
+    uint64_t o = cell_nodes_offsets[i];
+    for (int j=0; j<c.nodes.size(); j++)
+      cell_nodes[o+j] = c.nodes[j];
+    cell_nodes_offsets[i+1] = o + c.nodes.size();
+
+    o = cell_faces_offsets[i];
+    for (int j=0; j<c.faces.size(); j++) {
+      cell_faces[o+j] = c.faces[j];
+      cell_faces_chirality[o+j] = c.faces_chirality[j];
+    }
+    cell_faces_offsets[i+1] = o + c.faces.size();
+
+    o = cell_neighbors_offsets[i];
+    for (int j=0; j<c.neighbor_cells.size(); j++)
+      cell_neighbors[o+j] = c.neighbor_cells[j];
+    cell_neighbors_offsets[i+1] = o + c.neighbor_cells.size();
+  }
+}
+
+MeshGraphCSR::~MeshGraphCSR()
+{
+  Release();
+}
+
+void MeshGraphCSR::Release()
+{
+  if (_map) munmap(_map, _map_size);
+  _map = NULL;
+  _map_size = 0;
+  _image.clear();
+  _base = NULL;
+  _size = 0;
+  _hdr = NULL;
+}
+
+void MeshGraphCSR::Allocate(uint64_t ne, uint64_t nf, uint64_t nc, const uint64_t counts[NUM_ARRAYS])
+{
+  Release();
+
+  Header hdr;
+  memset(&hdr, 0, sizeof(Header));
+  memcpy(hdr.magic, csr_magic, sizeof(csr_magic));
+  hdr.version = csr_version;
+  hdr.id_size = sizeof(NodeIdType);
+  hdr.nedges = ne;
+  hdr.nfaces = nf;
+  hdr.ncells = nc;
+
+  size_t size = csr_align(sizeof(Header));
+  for (int a=0; a<NUM_ARRAYS; a++) {
+    hdr.arrays[a][0] = size;
+    hdr.arrays[a][1] = counts[a];
+    size = csr_align(size + counts[a]*csr_entry_size(a));
+  }
+
+  _image.assign(size/sizeof(uint64_t), 0);
+  memcpy(_image.data(), &hdr, sizeof(Header));
+  _base = (char*)_image.data();
+  _size = size;
+  _hdr = (const Header*)_base;
+}
+
+bool MeshGraphCSR::Attach(char *base, size_t size, bool verify)
+{
+  const Header *hdr = (const Header*)base;
+  if (size < sizeof(Header) || memcmp(hdr->magic, csr_magic, sizeof(csr_magic)) != 0) {
+    fprintf(stderr, "[MeshGraphCSR] not a mesh graph image.\n");
+    return false;
+  }
+  if (hdr->version != csr_version || hdr->id_size != sizeof(NodeIdType)) {
+    fprintf(stderr, "[MeshGraphCSR] unsupported version %u or id size %u.\n", hdr->version, hdr->id_size);
+    return false;
+  }
+
+  const uint64_t n[3] = {hdr->nedges, hdr->nfaces, hdr->ncells};
+  for (int a=0; a<NUM_ARRAYS; a++) {
+    const uint64_t offset = hdr->arrays[a][0], count = hdr->arrays[a][1];
+    const int o = csr_arrays[a].offsets;
+
+    uint64_t expected;
+    if (o == -2) expected = n[0]*2;
+    else if (o == -1) expected = n[csr_arrays[a].entity] + 1;
+    else expected = ((const uint64_t*)(base + hdr->arrays[o][0]))[n[csr_arrays[a].entity]];
+
+    if (count != expected || offset % csr_alignment != 0 ||
+        offset > size || count > (size - offset) / csr_entry_size(a)) {
+      fprintf(stderr, "[MeshGraphCSR] array %d out of bounds.\n", a);
+      return false;
+    }
+
+    if (o == -1 && ((const uint64_t*)(base + offset))[0] != 0) {
+      fprintf(stderr, "[MeshGraphCSR] offsets of array %d do not start at zero.\n", a);
+      return false;
+    }
+  }
+
+  // images are checked in full when written
+  if (verify && !csr_monotonic_offsets(base, hdr)) return false;
+
+  _base = base;
+  _size = size;
+  _hdr = hdr;
+  return true;
+}
+
+bool MeshGraphCSR::MapFile(const std::string& filename, bool verify)
+{
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+
+  Release();
+  if (!Attach((char*)p, st.st_size, verify)) {
+    munmap(p, st.st_size);
+    return false;
+  }
+  _map = p;
+  _map_size = st.st_size;
+  return true;
+}
+
+bool MeshGraphCSR::WriteToFile(const std::string& filename) const
+{
+  if (!_hdr || !csr_monotonic_offsets(_base, _hdr)) return false;
+
+  // written aside and renamed, so that no one maps a partial file
+  const std::string tmp = filename + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp) return false;
+
+  bool succ = fwrite(_base, 1, _size, fp) == _size;
+  succ = fclose(fp) == 0 && succ;
+  if (succ) succ = rename(tmp.c_str(), filename.c_str()) == 0;
+  if (!succ) remove(tmp.c_str());
+  return succ;
+}
+
+bool MeshGraphCSR::IsCSRFile(const std::string& filename)
+{
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (!fp) return false;
+
+  char magic[sizeof(csr_magic)];
+  const bool succ = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+    memcmp(magic, csr_magic, sizeof(magic)) == 0;
+  fclose(fp);
+  return succ;
+}
+
+template <typename T>
+static inline MeshGraphSpan<T> csr_span(const T *a, const uint64_t *o)
+{
+  return MeshGraphSpan<T>(a + o[0], a + o[1]);
+}
+
+CEdgeView MeshGraphCSR::EdgeView(EdgeIdType i) const
+{
+  const NodeIdType *nodes = Array<NodeIdType>(EDGE_NODES) + (size_t)i*2;
+  const uint64_t *o = Array<uint64_t>(EDGE_FACES_OFFSETS) + i;
+  CEdgeView e = {nodes[0], nodes[1],
+    csr_span(Array<FaceIdType>(EDGE_FACES), o),
+    csr_span(Array<ChiralityType>(EDGE_FACES_CHIRALITY), o),
+    csr_span(Array<unsigned char>(EDGE_FACES_EID), o)};
+  return e;
+}
+
+CFaceView MeshGraphCSR::FaceView(FaceIdType i) const
+{
+  const uint64_t *on = Array<uint64_t>(FACE_NODES_OFFSETS) + i,
+                 *oe = Array<uint64_t>(FACE_EDGES_OFFSETS) + i,
+                 *oc = Array<uint64_t>(FACE_CELLS_OFFSETS) + i;
+  CFaceView f = {
+    csr_span(Array<NodeIdType>(FACE_NODES), on),
+    csr_span(Array<EdgeIdType>(FACE_EDGES), oe),
+    csr_span(Array<ChiralityType>(FACE_EDGES_CHIRALITY), oe),
+    csr_span(Array<CellIdType>(FACE_CELLS), oc),
+    csr_span(Array<ChiralityType>(FACE_CELLS_CHIRALITY), oc),
+    csr_span(Array<unsigned char>(FACE_CELLS_FID), oc)};
+  return f;
+}
+
+CCellView MeshGraphCSR::CellView(CellIdType i) const
+{
+  const uint64_t *on = Array<uint64_t>(CELL_NODES_OFFSETS) + i,
+                 *of = Array<uint64_t>(CELL_FACES_OFFSETS) + i,
+                 *oc = Array<uint64_t>(CELL_NEIGHBORS_OFFSETS) + i;
+  CCellView c = {
+    csr_span(Array<NodeIdType>(CELL_NODES), on),
+    csr_span(Array<FaceIdType>(CELL_FACES), of),
+    csr_span(Array<ChiralityType>(CELL_FACES_CHIRALITY), of),
+    csr_span(Array<CellIdType>(CELL_NEIGHBORS), oc)};
+  return c;
+}
+
+CEdge MeshGraphCSR::Edge(EdgeIdType i, bool nodes_only) const
+{
+  const CEdgeView v = EdgeView(i);
+  CEdge e;
+  e.node0 = v.node0;
+  e.node1 = v.node1;
+  if (nodes_only) return e;
+
+  e.contained_faces.assign(v.contained_faces.begin(), v.contained_faces.end());
+  e.contained_faces_chirality.assign(v.contained_faces_chirality.begin(), v.contained_faces_chirality.end());
+  e.contained_faces_eid.assign(v.contained_faces_eid.begin(), v.contained_faces_eid.end());
+  return e;
+}
+
+CFace MeshGraphCSR::Face(FaceIdType i, bool nodes_only) const
+{
+  const CFaceView v = FaceView(i);
+  CFace f;
+  f.nodes.assign(v.nodes.begin(), v.nodes.end());
+  if (nodes_only) return f;
+
+  f.edges.assign(v.edges.begin(), v.edges.end());
+  f.edges_chirality.assign(v.edges_chirality.begin(), v.edges_chirality.end());
+  f.contained_cells.assign(v.contained_cells.begin(), v.contained_cells.end());
+  f.contained_cells_chirality.assign(v.contained_cells_chirality.begin(), v.contained_cells_chirality.end());
+  f.contained_cells_fid.assign(v.contained_cells_fid.begin(), v.contained_cells_fid.end());
+  return f;
+}
+
+CCell MeshGraphCSR::Cell(CellIdType i, bool nodes_only) const
+{
+  const CCellView v = CellView(i);
+  CCell c;
+  c.nodes.assign(v.nodes.begin(), v.nodes.end());
+  if (nodes_only) return c;
+
+  c.faces.assign(v.faces.begin(), v.faces.end());
+  c.faces_chirality.assign(v.faces_chirality.begin(), v.faces_chirality.end());
+  c.neighbor_cells.assign(v.neighbor_cells.begin(), v.neighbor_cells.end());
+  return c;
+}
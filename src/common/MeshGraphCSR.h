@@ -0,0 +1,120 @@
+#ifndef _MESHGRAPH_CSR_H
+#define _MESHGRAPH_CSR_H
+
+#include "common/MeshGraph.h"
+#include <stdint.h>
+#include <string>
+
+// contiguous entries of a relation, in place of the vectors of CEdge, CFace
+// and CCell
+template <typename T>
+struct MeshGraphSpan {
+  const T *first, *last;
+
+  MeshGraphSpan(const T *first_, const T *last_) : first(first_), last(last_) {}
+
+  size_t size() const {return last - first;}
+  bool empty() const {return first == last;}
+  const T& operator[](size_t i) const {return first[i];}
+  const T* begin() const {return first;}
+  const T* end() const {return last;}
+};
+
+struct CEdgeView {
+  NodeIdType node0, node1;
+  MeshGraphSpan<FaceIdType> contained_faces;
+  MeshGraphSpan<ChiralityType> contained_faces_chirality;
+  MeshGraphSpan<unsigned char> contained_faces_eid;
+};
+
+struct CFaceView {
+  MeshGraphSpan<NodeIdType> nodes;
+  MeshGraphSpan<EdgeIdType> edges;
+  MeshGraphSpan<ChiralityType> edges_chirality;
+  MeshGraphSpan<CellIdType> contained_cells;
+  MeshGraphSpan<ChiralityType> contained_cells_chirality;
+  MeshGraphSpan<unsigned char> contained_cells_fid;
+};
+
+struct CCellView {
+  MeshGraphSpan<NodeIdType> nodes;
+  MeshGraphSpan<FaceIdType> faces;
+  MeshGraphSpan<ChiralityType> faces_chirality;
+  MeshGraphSpan<CellIdType> neighbor_cells;
+};
+
+// Explicit mesh graph in compressed sparse row form: an offsets array for
+// each relation and packed payload arrays, all in one image that is laid out
+// as the binary mesh graph file.  A file is mapped read-only and used in
+// place, so that loading takes no parsing and the processes on a node share
+// the pages.
+class MeshGraphCSR : public MeshGraph {
+public:
+  enum {
+    EDGE_NODES, // two per edge
+    EDGE_FACES_OFFSETS, EDGE_FACES, EDGE_FACES_CHIRALITY, EDGE_FACES_EID,
+    FACE_NODES_OFFSETS, FACE_NODES,
+    FACE_EDGES_OFFSETS, FACE_EDGES, FACE_EDGES_CHIRALITY,
+    FACE_CELLS_OFFSETS, FACE_CELLS, FACE_CELLS_CHIRALITY, FACE_CELLS_FID,
+    CELL_NODES_OFFSETS, CELL_NODES,
+    CELL_FACES_OFFSETS, CELL_FACES, CELL_FACES_CHIRALITY,
+    CELL_NEIGHBORS_OFFSETS, CELL_NEIGHBORS,
+    NUM_ARRAYS
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version, id_size;
+    uint64_t nedges, nfaces, ncells;
+    uint64_t arrays[NUM_ARRAYS][2]; // byte offset from the header, #entries
+  };
+
+public:
+  MeshGraphCSR();
+  explicit MeshGraphCSR(const MeshGraph& mg); // packs any mesh graph
+  ~MeshGraphCSR();
+
+  EdgeIdType NEdges() const {return _hdr ? _hdr->nedges : 0;}
+  FaceIdType NFaces() const {return _hdr ? _hdr->nfaces : 0;}
+  CellIdType NCells() const {return _hdr ? _hdr->ncells : 0;}
+
+  CEdge Edge(EdgeIdType i, bool nodes_only=false) const;
+  CFace Face(FaceIdType i, bool nodes_only=false) const;
+  CCell Cell(CellIdType i, bool nodes_only=false) const;
+
+  // views into the arrays, without copies
+  CEdgeView EdgeView(EdgeIdType i) const;
+  CFaceView FaceView(FaceIdType i) const;
+  CCellView CellView(CellIdType i) const;
+
+  // whole arrays, e.g. Data<NodeIdType>(FACE_NODES)
+  template <typename T> const T* Data(int a) const {return Array<T>(a);}
+  uint64_t Size(int a) const {return _hdr ? _hdr->arrays[a][1] : 0;}
+
+  // Mapping checks the header, the array bounds and the first and last 
+  // offsets, touching only a few pages; verify also checks that all offsets
+  // are monotonic, which WriteToFile() does before writing.
+  bool MapFile(const std::string& filename, bool verify=false);
+  bool WriteToFile(const std::string& filename) const;
+  static bool IsCSRFile(const std::string& filename);
+
+private:
+  friend class MeshGraphBuilder_TetParallel;
+
+  void Allocate(uint64_t nedges, uint64_t nfaces, uint64_t ncells, const uint64_t counts[NUM_ARRAYS]);
+  bool Attach(char *base, size_t size, bool verify=false);
+  void Release();
+
+  template <typename T> T* Array(int a) const {return (T*)(_base + _hdr->arrays[a][0]);}
+
+private:
+  std::vector<uint64_t> _image; // if not mapped
+  void *_map;
+  size_t _map_size;
+
+  char *_base;
+  size_t _size;
+  const Header *_hdr;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "VortexLine.h"
+#include "VortexLineIndex.h"
 #include "common/Utils.hpp"
 #include "fitCurves/fitCurves.hpp"
 #include "fitCurves/psimpl.h"
@@ -6,6 +7,10 @@
 #include <cfloat>
 #include <cassert>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #if WITH_VTK
 #include <vtkSmartPointer.h>
@@ -36,24 +41,65 @@ void VortexLine::Print() const {
         at(i*3), at(i*3+1), at(i*3+2));
 }
 
-void VortexLine::Simplify(float tolorance)
+// replaces the vertices of l with R, a subsequence of them
+static void adopt_subsequence(VortexLine& l, std::vector<float>& R, VortexLineWorkspace *ws)
+{
+  const int n0 = l.size()/3, n1 = R.size()/3;
+  
+  if (l.HasWraps()) { // the simplified line is a subsequence of the original one
+    VortexLineWorkspace ws0;
+    std::vector<signed char> &W = ws ? ws->wraps : ws0.wraps;
+    W.clear();
+    for (int i=0, j=0; i<n0 && j<n1; i++) 
+      if (l[i*3] == R[j*3] && l[i*3+1] == R[j*3+1] && l[i*3+2] == R[j*3+2]) {
+        W.insert(W.end(), l.wraps.begin() + i*3, l.wraps.begin() + i*3 + 3);
+        j ++;
+      }
+    if (W.size() == R.size()) l.wraps.swap(W);
+    else l.wraps.clear();
+  }
+
+  l.swap(R);
+  // fprintf(stderr, "n0=%d, n1=%d\n", n0, n1);
+}
+
+void VortexLine::Simplify(float tolorance, VortexLineWorkspace *ws)
 {
   if (is_bezier) return;
 
-  std::vector<float> R;
+  VortexLineWorkspace ws0;
+  std::vector<float> &R = ws ? ws->line : ws0.line;
+  R.clear();
   psimpl::simplify_reumann_witkam<3>(begin(), end(), tolorance, std::back_inserter(R));
   // psimpl::simplify_douglas_peucker<3>(begin(), end(), tolorance, std::back_inserter(R));
   
-  const int n0 = size()/3, n1 = R.size()/3;
-  swap(R);
-  // fprintf(stderr, "n0=%d, n1=%d\n", n0, n1);
+  adopt_subsequence(*this, R, ws);
+}
+
+void VortexLine::SimplifyDP(float tolerance, VortexLineWorkspace *ws)
+{
+  if (is_bezier) return;
+
+  VortexLineWorkspace ws0;
+  std::vector<float> &R = ws ? ws->line : ws0.line;
+  R.clear();
+  psimpl::simplify_douglas_peucker<3>(begin(), end(), tolerance, std::back_inserter(R));
+
+  adopt_subsequence(*this, R, ws);
 }
 
-void VortexLine::RemoveInvalidPoints() {
+void VortexLine::RemoveInvalidPoints(VortexLineWorkspace *ws) {
   if (is_bezier) return;
 
-  std::vector<float> R;
+  VortexLineWorkspace ws0;
+  std::vector<float> &R = ws ? ws->line : ws0.line;
+  std::vector<signed char> &W = ws ? ws->wraps : ws0.wraps;
+  R.clear();
+  W.clear();
+
+  const bool has_wraps = HasWraps();
   float lastPt[3];
+  int last = -1;
 
   for (int i=0; i<size()/3; i++) {
     float currentPt[3] = {at(i*3), at(i*3+1), at(i*3+2)};
@@ -62,22 +108,29 @@ void VortexLine::RemoveInvalidPoints() {
     for (int j=0; j<3; j++) if (std::isnan(currentPt[j]) || std::isinf(currentPt[j])) valid = false;
     if (!valid) continue;
   
-    if (i>1) {
+    // jumps across periodic boundaries are not outliers
+    const bool crossed = has_wraps && last >= 0 && 
+      (wraps[i*3] != wraps[last*3] || wraps[i*3+1] != wraps[last*3+1] || wraps[i*3+2] != wraps[last*3+2]);
+    if (i>1 && !crossed) {
       float d = dist(currentPt, lastPt);
       if (d>3) valid = false; // FIXME: arbitrary threshold
     }
     if (!valid) continue;
 
     memcpy(lastPt, currentPt, sizeof(float)*3);
+    last = i;
 
     R.push_back(currentPt[0]);
     R.push_back(currentPt[1]);
     R.push_back(currentPt[2]);
+    if (has_wraps) 
+      W.insert(W.end(), wraps.begin() + i*3, wraps.begin() + i*3 + 3);
   }
   swap(R);
+  wraps.swap(W);
 }
 
-void VortexLine::ToBezier(float error_bound)
+void VortexLine::ToBezier(float error_bound, VortexLineWorkspace *ws)
 {
   using namespace FitCurves;
   typedef Point<3> Pt;
@@ -85,28 +138,26 @@ void VortexLine::ToBezier(float error_bound)
 
   if (is_bezier) return;
 
-  int npts = size()/3;
-  Pt *pts = (Pt*)malloc(npts*3*sizeof(Pt));
+  const int npts = size()/3;
+  if (npts < 2) return;
 
-  for (int i=0; i<npts; i++) {
-    pts[i][0] = this->at(i*3);
-    pts[i][1] = this->at(i*3+1);
-    pts[i][2] = this->at(i*3+2);
-  }
+  // the vertices are fitted in place; only the control points and the 
+  // parameterization need scratch space
+  VortexLineWorkspace ws0;
+  std::vector<float> &curve = ws ? ws->curve : ws0.curve, 
+                     &work = ws ? ws->work : ws0.work;
+  curve.resize(npts*4*3);
+  work.resize(npts*2);
 
-  Pt *pts1 = (Pt*)malloc(npts*4*sizeof(Pt));
-  const int npts1 = fit_curves(npts, pts, error_bound, pts1, tot_error);
+  Pt *pts = reinterpret_cast<Pt*>(data()), 
+     *pts1 = reinterpret_cast<Pt*>(curve.data());
+  const int npts1 = fit_curves(npts, pts, error_bound, pts1, tot_error, work.data());
 
-  clear();
-  for (int i=0; i<npts1; i++) {
-    push_back(pts1[i][0]);
-    push_back(pts1[i][1]);
-    push_back(pts1[i][2]);
-  }
-
-  free(pts);
-  free(pts1);
+  assign(curve.begin(), curve.begin() + npts1*3);
+  length_seg.clear();
+  length_acc.clear();
 
+  wraps.clear(); // control points do not map to vertices
   is_bezier = true;
 }
 
@@ -209,120 +260,159 @@ bool VortexLine::Bezier(float t, float X[3]) const // t \in [0, 1]
   return true;
 }
 
-void VortexLine::ToRegular(int N)
+void VortexLine::ToRegular(int N, VortexLineWorkspace *ws)
 {
   length_seg.clear(); 
   length_acc.clear();
 
+  VortexLineWorkspace ws0;
+  std::vector<float> &L = ws ? ws->line : ws0.line;
+  L.resize(N*3);
+
   const float delta = 1.f / (N - 1);
-  std::vector<float> L;
-  for (int i=0; i<N; i++) {
-    float X[3];
-    Bezier(i*delta, X);
-    L.push_back(X[0]); L.push_back(X[1]); L.push_back(X[2]);
-  }
+  for (int i=0; i<N; i++) 
+    Bezier(i*delta, &L[i*3]);
   swap(L);
+  wraps.clear();
+  is_bezier = false;
 }
 
-void VortexLine::ToRegularL(int N)
+void VortexLine::ToRegularL(int N, VortexLineWorkspace *ws)
 {
+  VortexLineWorkspace ws0;
+  std::vector<float> &L = ws ? ws->line : ws0.line;
+  L.resize(N*3);
+
   const float delta = 1.f / (N - 1);
-  std::vector<float> L;
-  for (int i=0; i<N; i++) {
-    float X[3];
-    Linear(i*delta, X);
-    L.push_back(X[0]); L.push_back(X[1]); L.push_back(X[2]);
-  }
+  for (int i=0; i<N; i++) 
+    Linear(i*delta, &L[i*3]);
   swap(L);
+  length_seg.clear(); 
+  length_acc.clear();
+  wraps.clear();
 }
 
-void VortexLine::Flattern(const float O[3], const float L[3])
+void VortexLine::ComputeWraps(const float L[3], const bool pbc[3])
 {
-  int cross[3] = {0};
   const int n = size()/3;
+  int cross[3] = {0};
+  float p0[3];
+  bool has_p0 = false;
 
-  float p0[3], p[3];
-  std::vector<float> line;
-
+  wraps.resize(n*3);
   for (int i=0; i<n; i++) {
-    for (int j=0; j<3; j++) 
-      p[j] = at(i*3+j) + cross[j] * L[j];
-   
-    if (i>0) 
+    const float *p = data() + i*3;
+    const bool valid = !std::isnan(p[0]) && !std::isnan(p[1]) && !std::isnan(p[2]);
+
+    if (valid && has_p0) 
       for (int j=0; j<3; j++) {
-        if (p[j] - p0[j] > L[j]/2) {
-          cross[j] --;
-          p[j] -= L[j];
-        } else if (p[j] - p0[j] < -L[j]/2) {
-          cross[j] ++; 
-          p[j] += L[j];
-        }
+        if (!pbc[j]) continue;
+        if (p[j] - p0[j] > L[j]/2) cross[j] --;
+        else if (p[j] - p0[j] < -L[j]/2) cross[j] ++;
       }
 
     for (int j=0; j<3; j++)
-      line.push_back(p[j]);
+      wraps[i*3+j] = cross[j];
+
+    if (valid) {
+      memcpy(p0, p, sizeof(float)*3);
+      has_p0 = true;
+    }
+  }
+}
+
+void VortexLine::Pieces(std::vector<int>& vert_counts) const
+{
+  const int n = size()/3;
+  const bool has_wraps = HasWraps();
+  int count = 0;
+
+  for (int i=0; i<n; i++) {
+    bool split = false;
+    if (i>0) {
+      if (has_wraps) 
+        split = wraps[i*3] != wraps[i*3-3] || wraps[i*3+1] != wraps[i*3-2] || wraps[i*3+2] != wraps[i*3-1];
+      else if (!is_bezier) { // legacy data without wraps
+        const float *p = data() + i*3;
+        split = dist(p, p-3) > 5; // FIXME: arbitrary threshold
+      }
+    }
 
-    for (int j=0; j<3; j++) 
-      p0[j] = p[j];
+    if (split) {
+      vert_counts.push_back(count);
+      count = 0;
+    }
+    count ++;
   }
 
-  clear();
-  swap(line);
+  if (count > 0) 
+    vert_counts.push_back(count);
+}
+
+void VortexLine::Flattern(const float O[3], const float L[3])
+{
+  if (!HasWraps()) {
+    const bool pbc[3] = {true, true, true};
+    ComputeWraps(L, pbc);
+  }
+
+  // the flattened line no longer crosses boundaries
+  const int n = size()/3;
+  for (int i=0; i<n; i++) 
+    for (int j=0; j<3; j++) {
+      at(i*3+j) += wraps[i*3+j] * L[j];
+      wraps[i*3+j] = 0;
+    }
 }
 
 void VortexLine::Unflattern(const float O[3], const float L[3])
 {
   const int n = size()/3;
-  float p[3];
-  std::vector<float> line;
+  int w0[3] = {0}, w[3] = {0};
+  bool has_w0 = false;
 
+  wraps.resize(n*3);
   for (int i=0; i<n; i++) {
+    float *p = data() + i*3;
+    const bool valid = !std::isnan(p[0]) && !std::isnan(p[1]) && !std::isnan(p[2]);
     for (int j=0; j<3; j++) {
-      p[j] = at(i*3+j);
-      p[j] = fmod1(p[j] - O[j], L[j]) + O[j];
-      line.push_back(p[j]);
+      if (valid) {
+        w[j] = floor((p[j] - O[j]) / L[j]);
+        if (!has_w0) w0[j] = w[j];
+        p[j] = fmod1(p[j] - O[j], L[j]) + O[j];
+      }
+      wraps[i*3+j] = w[j] - w0[j];
     }
+    if (valid) has_w0 = true;
   }
-
-  clear();
-  swap(line);
 }
 
 float MinimumDist(const VortexLine& l0, const VortexLine& l1)
 {
-  float minDist = DBL_MAX;
-  const int n0 = l0.size()/3, n1 = l1.size()/3;
-
-  for (int i=0; i<n0; i++) 
-    for (int j=0; j<n1; j++) {
-      const float d[3] = {l0[i*3] - l1[j*3], l0[i*3+1] - l1[j*3+1], l0[i*3+2] - l1[j*3+2]};
-      const float dist = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
-      minDist = std::min(minDist, dist);
-    }
+  std::vector<VortexLine> lines(2);
+  lines[0] = l0; 
+  lines[1] = l1;
 
-  return minDist;
+  VortexLineIndex index;
+  index.Build(lines);
+  return index.MinimumDist(0, 1);
 }
 
 float CrossingPoint(const VortexLine& l0, const VortexLine& l1, float X[3])
 {
-  float minDist = DBL_MAX;
-  const int n0 = l0.size()/3, n1 = l1.size()/3;
-  int i0, j0;
-
-  for (int i=0; i<n0; i++) 
-    for (int j=0; j<n1; j++) {
-      const float d[3] = {l0[i*3] - l1[j*3], l0[i*3+1] - l1[j*3+1], l0[i*3+2] - l1[j*3+2]};
-      const float dist = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
-      if (minDist > dist) {
-        i0 = i;
-        j0 = j;
-        minDist = dist;
-      }
-    }
+  std::vector<VortexLine> lines(2);
+  lines[0] = l0; 
+  lines[1] = l1;
+
+  VortexLineIndex index;
+  index.Build(lines);
+
+  float X0[3], X1[3];
+  const float minDist = index.MinimumDist(0, 1, X0, X1);
 
-  X[0] = l0[i0*3] + l1[j0*3];
-  X[1] = l0[i0*3+1] + l1[j0*3+1];
-  X[2] = l0[i0*3+2] + l1[j0*3+2];
+  X[0] = 0.5f * (X0[0] + X1[0]);
+  X[1] = 0.5f * (X0[1] + X1[1]);
+  X[2] = 0.5f * (X0[2] + X1[2]);
 
   return minDist;
 }
@@ -416,6 +506,84 @@ float VortexLine::MaxExtent() const
   return std::max(std::max(D[0], D[1]), D[2]);
 }
 
+template <typename F>
+static void for_each_line_parallel(std::vector<VortexLine>& vlines, int nthreads, F f)
+{
+  const int n = vlines.size();
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  nthreads = std::max(1, std::min(nthreads, n));
+
+  // lines differ a lot in length, so they are handed out one at a time
+  std::atomic<int> next(0);
+  auto worker = [&vlines, &next, n, f]() {
+    VortexLineWorkspace ws;
+    for (int i = next++; i < n; i = next++)
+      f(vlines[i], ws);
+  };
+
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
+
+void PostProcessVortexLines(std::vector<VortexLine>& vlines, float simplify_tolerance, float bezier_error_bound, int nthreads)
+{
+  for_each_line_parallel(vlines, nthreads, 
+      [simplify_tolerance, bezier_error_bound](VortexLine& l, VortexLineWorkspace& ws) {
+        l.RemoveInvalidPoints(&ws);
+        if (simplify_tolerance > 0) l.Simplify(simplify_tolerance, &ws);
+        if (bezier_error_bound > 0) l.ToBezier(bezier_error_bound, &ws);
+      });
+}
+
+void ResampleVortexLines(std::vector<VortexLine>& vlines, int N, float simplify_tolerance, int nthreads)
+{
+  for_each_line_parallel(vlines, nthreads, 
+      [N, simplify_tolerance](VortexLine& l, VortexLineWorkspace& ws) {
+        if (l.is_bezier) 
+          l.ToRegular(N, &ws);
+        else {
+          l.RemoveInvalidPoints(&ws);
+          if (simplify_tolerance > 0) l.Simplify(simplify_tolerance, &ws);
+        }
+      });
+}
+
+void BuildVortexLineLODs(const std::vector<VortexLine>& vlines, const std::vector<float>& tolerances, 
+    std::vector<std::vector<VortexLine> >& lods, int nthreads)
+{
+  lods.resize(tolerances.size());
+  for (int k=0; k<tolerances.size(); k++) {
+    lods[k] = vlines;
+    const float tolerance = tolerances[k];
+    if (tolerance > 0) 
+      for_each_line_parallel(lods[k], nthreads, 
+          [tolerance](VortexLine& l, VortexLineWorkspace& ws) {
+            l.SimplifyDP(tolerance, &ws);
+          });
+  }
+}
+
+int SelectVortexLineLOD(const std::vector<float>& tolerances, float max_error)
+{
+  int lod = 0;
+  for (int k=1; k<tolerances.size(); k++) 
+    if (tolerances[k] <= max_error) lod = k;
+  return lod;
+}
+
+void DefaultVortexLineLODTolerances(const float cell_lengths[3], std::vector<float>& tolerances)
+{
+  const float h = std::min(cell_lengths[0], std::min(cell_lengths[1], cell_lengths[2]));
+  const float factors[] = {0, 0.5, 2, 8};
+  tolerances.clear();
+  for (int k=0; k<4; k++) 
+    tolerances.push_back(factors[k] * h);
+}
+
 bool SaveVortexLinesAscii(const std::vector<VortexLine>& vlines, const std::string& filename) 
 {
   FILE *fp = fopen(filename.c_str(), "w");
@@ -448,27 +616,12 @@ bool SaveVortexLinesVTK(const std::vector<VortexLine>& vlines, const std::string
  
   std::vector<int> vertCounts;
   for (int i=0; i<vlines.size(); i++) {
-    int vertCount = 0;
     const int nv = vlines[i].size()/3;
-    // if (nv<2) continue;
-    double p0[3];
     for (int j=0; j<nv; j++) {
       double p[3] = {vlines[i][j*3], vlines[i][j*3+1], vlines[i][j*3+2]};
       points->InsertNextPoint(p);
-
-      double delta[3] = {p[0] - p0[0], p[1] - p0[1], p[2] - p0[2]};
-      double dist = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
-
-      if (j>0 && dist>5) { // FIXME
-        vertCounts.push_back(vertCount);
-        vertCount = 0;
-      }
-      memcpy(p0, p, sizeof(double)*3);
-      vertCount ++;
     }
-
-    if (vertCount > 0) 
-      vertCounts.push_back(vertCount);
+    vlines[i].Pieces(vertCounts);
   }
     
   int nv = 0;
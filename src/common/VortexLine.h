@@ -5,9 +5,21 @@
 #include <list>
 #include <vector>
 #include <sstream>
+#include <climits>
 #include "def.h"
 #include "common/diy-ext.hpp"
 
+/*
+ * \struct  VortexLineWorkspace
+ * \brief   Scratch buffers for line post-processing, reused across lines 
+ *          (one per thread) by the batch routines
+*/
+struct VortexLineWorkspace {
+  std::vector<float> line; // swapped with the storage of the processed line
+  std::vector<float> curve, work; // curve fitting
+  std::vector<signed char> wraps;
+};
+
 /* 
  * \class   VortexLine
  * \author  Hanqi Guo
@@ -19,11 +31,12 @@ struct VortexLine : public std::vector<float>
   ~VortexLine(); 
 
   void Print() const;
-  void RemoveInvalidPoints();
-  void Simplify(float tolorance=0.1);
-  void ToBezier(float error_bound=0.01);
-  void ToRegular(int N);
-  void ToRegularL(int N);
+  void RemoveInvalidPoints(VortexLineWorkspace *ws=NULL);
+  void Simplify(float tolorance=0.1, VortexLineWorkspace *ws=NULL);
+  void SimplifyDP(float tolerance, VortexLineWorkspace *ws=NULL); // Douglas-Peucker; deviates on the order of the tolerance
+  void ToBezier(float error_bound=0.01, VortexLineWorkspace *ws=NULL);
+  void ToRegular(int N, VortexLineWorkspace *ws=NULL); // the result is a polyline
+  void ToRegularL(int N, VortexLineWorkspace *ws=NULL);
  
   bool Linear(float t, float X[3]) const;
   bool Bezier(float t, float X[3]) const;
@@ -33,6 +46,12 @@ struct VortexLine : public std::vector<float>
   void Flattern(const float O[3], const float L[3]);
   void Unflattern(const float O[3], const float L[3]);
 
+  // periodic image offsets of each vertex (in units of the domain lengths), 
+  // relative to the first vertex
+  void ComputeWraps(const float L[3], const bool pbc[3]);
+  bool HasWraps() const {return wraps.size() == size();}
+  void Pieces(std::vector<int>& vert_counts) const; // appends #verts of each piece that does not cross boundaries
+
   void BoundingBox(float LB[3], float UB[3]) const;
   float MaxExtent() const;
 
@@ -49,6 +68,7 @@ struct VortexLine : public std::vector<float>
   bool is_loop;
 
   std::vector<float> cond; // condition numbers
+  std::vector<signed char> wraps; // 3 per vertex; empty if unknown
 
   // used for PL curve
   mutable std::vector<float> length_seg;
@@ -59,7 +79,13 @@ struct VortexLine : public std::vector<float>
 
 namespace diy {
   template <> struct Serialization<VortexLine> {
+    // records written before the wraps were added start with the id, which 
+    // is never INT_MIN; later records start with INT_MIN and a version
     static void save(diy::BinaryBuffer& bb, const VortexLine& m) {
+      const int tag = INT_MIN;
+      const unsigned char version = 1;
+      diy::save(bb, tag);
+      diy::save(bb, version);
       diy::save(bb, m.id);
       diy::save(bb, m.gid);
       diy::save(bb, m.timestep);
@@ -69,10 +95,16 @@ namespace diy {
       diy::save(bb, m.is_loop);
       diy::save(bb, m.cond); // TODO: adding this field will make historical data invalid
       diy::save<std::vector<float> >(bb, m);
+      diy::save(bb, m.wraps);
     }
 
     static void load(diy::BinaryBuffer&bb, VortexLine& m) {
+      unsigned char v = 0;
       diy::load(bb, m.id);
+      if (m.id == INT_MIN) {
+        diy::load(bb, v);
+        diy::load(bb, m.id);
+      }
       diy::load(bb, m.gid);
       diy::load(bb, m.timestep);
       diy::load(bb, m.time);
@@ -81,10 +113,31 @@ namespace diy {
       diy::load(bb, m.is_loop);
       diy::load(bb, m.cond); 
       diy::load<std::vector<float> >(bb, m);
+      if (v >= 1) diy::load(bb, m.wraps);
+      else m.wraps.clear();
     }
   };
 }
 
+// batch post-processing of a frame's lines, in parallel (nthreads=0 for all 
+// cores); non-positive tolerances skip the corresponding step
+void PostProcessVortexLines(std::vector<VortexLine>& lines, float simplify_tolerance=0.1, float bezier_error_bound=0.01, int nthreads=0);
+
+// display geometry: Bezier lines are resampled to N points, polylines are 
+// cleaned and optionally simplified
+void ResampleVortexLines(std::vector<VortexLine>& lines, int N=500, float simplify_tolerance=0, int nthreads=0);
+
+// level-of-detail geometry: lods[k] are the polylines simplified with 
+// tolerances[k] (ascending; 0 keeps the lines as they are)
+void BuildVortexLineLODs(const std::vector<VortexLine>& lines, const std::vector<float>& tolerances, 
+    std::vector<std::vector<VortexLine> >& lods, int nthreads=0);
+
+// the coarsest level whose tolerance does not exceed max_error
+int SelectVortexLineLOD(const std::vector<float>& tolerances, float max_error);
+
+// default level-of-detail tolerances for a grid: 0, 1/2, 2 and 8 cells
+void DefaultVortexLineLODTolerances(const float cell_lengths[3], std::vector<float>& tolerances);
+
 bool SaveVortexLinesVTK(const std::vector<VortexLine>& lines, const std::string& filename);
 bool SaveVortexLinesBinary(const std::vector<VortexLine>& lines, const std::string& filename);
 bool SaveVortexLinesAscii(const std::vector<VortexLine>& lines, const std::string& filename);
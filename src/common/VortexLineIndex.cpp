@@ -0,0 +1,300 @@
+#include "VortexLineIndex.h"
+#include <algorithm>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+static const int leaf_size = 4;
+
+template <typename T>
+static inline T clamp01(T x)
+{
+  return x < 0 ? 0 : (x > 1 ? 1 : x);
+}
+
+// closest points between segments p1q1 and p2q2, returns the squared distance
+static float dist2_segment_segment(
+    const float p1[3], const float q1[3], const float p2[3], const float q2[3],
+    float c1[3], float c2[3])
+{
+  const float eps = 1e-12;
+  float d1[3], d2[3], r[3];
+  for (int k=0; k<3; k++) {
+    d1[k] = q1[k] - p1[k];
+    d2[k] = q2[k] - p2[k];
+    r[k] = p1[k] - p2[k];
+  }
+
+  const float a = d1[0]*d1[0] + d1[1]*d1[1] + d1[2]*d1[2],
+              e = d2[0]*d2[0] + d2[1]*d2[1] + d2[2]*d2[2],
+              f = d2[0]*r[0] + d2[1]*r[1] + d2[2]*r[2];
+  float s, t;
+
+  if (a <= eps && e <= eps) {
+    s = t = 0;
+  } else if (a <= eps) {
+    s = 0;
+    t = clamp01(f / e);
+  } else {
+    const float c = d1[0]*r[0] + d1[1]*r[1] + d1[2]*r[2];
+    if (e <= eps) {
+      t = 0;
+      s = clamp01(-c / a);
+    } else {
+      const float b = d1[0]*d2[0] + d1[1]*d2[1] + d1[2]*d2[2],
+                  denom = a*e - b*b;
+      s = denom != 0 ? clamp01((b*f - c*e) / denom) : 0;
+      t = (b*s + f) / e;
+      if (t < 0) {
+        t = 0;
+        s = clamp01(-c / a);
+      } else if (t > 1) {
+        t = 1;
+        s = clamp01((b - c) / a);
+      }
+    }
+  }
+
+  float d2sum = 0;
+  for (int k=0; k<3; k++) {
+    c1[k] = p1[k] + d1[k] * s;
+    c2[k] = p2[k] + d2[k] * t;
+    d2sum += (c1[k] - c2[k]) * (c1[k] - c2[k]);
+  }
+  return d2sum;
+}
+
+static inline float dist2_box_box(const float LB0[3], const float UB0[3],
+    const float LB1[3], const float UB1[3], const float shift[3])
+{
+  float d2 = 0;
+  for (int k=0; k<3; k++) {
+    const float lb1 = LB1[k] + shift[k], ub1 = UB1[k] + shift[k];
+    float d = 0;
+    if (lb1 > UB0[k]) d = lb1 - UB0[k];
+    else if (LB0[k] > ub1) d = LB0[k] - ub1;
+    d2 += d*d;
+  }
+  return d2;
+}
+
+VortexLineIndex::VortexLineIndex()
+{
+  for (int k=0; k<3; k++) {
+    _L[k] = 0;
+    _pbc[k] = false;
+  }
+}
+
+VortexLineIndex::~VortexLineIndex()
+{
+}
+
+void VortexLineIndex::Build(const std::vector<VortexLine>& vlines, const float L[3], const bool pbc[3])
+{
+  for (int k=0; k<3; k++) {
+    _L[k] = L ? L[k] : 0;
+    _pbc[k] = L && pbc ? pbc[k] : false;
+  }
+
+  _trees.clear();
+  _trees.resize(vlines.size());
+  for (int i=0; i<vlines.size(); i++)
+    BuildTree(vlines[i], _trees[i]);
+}
+
+void VortexLineIndex::BuildTree(const VortexLine& line, Tree& tree) const
+{
+  // collect valid segments; a segment that jumps across a periodic boundary
+  // is unwrapped so that it stays short.  Invalid vertices separate pieces,
+  // and a piece of a single vertex is a degenerate segment.
+  std::vector<float> segs;
+  const int nv = line.size()/3;
+  bool has_p0 = false, single = false;
+  float p0[3];
+
+  for (int i=0; i<=nv; i++) {
+    float p[3] = {NAN, NAN, NAN};
+    if (i<nv) memcpy(p, line.data() + i*3, sizeof(float)*3);
+    if (std::isnan(p[0]) || std::isnan(p[1]) || std::isnan(p[2])) {
+      if (has_p0 && single) {
+        segs.insert(segs.end(), p0, p0+3);
+        segs.insert(segs.end(), p0, p0+3);
+      }
+      has_p0 = false;
+      continue;
+    }
+
+    if (!has_p0) {
+      memcpy(p0, p, sizeof(float)*3);
+      has_p0 = single = true;
+      continue;
+    }
+    single = false;
+
+    for (int k=0; k<3; k++)
+      if (_pbc[k]) {
+        if (p[k] - p0[k] > _L[k]/2) p[k] -= _L[k];
+        else if (p[k] - p0[k] < -_L[k]/2) p[k] += _L[k];
+      }
+
+    segs.insert(segs.end(), p0, p0+3);
+    segs.insert(segs.end(), p, p+3);
+    memcpy(p0, line.data() + i*3, sizeof(float)*3);
+  }
+
+  const int ns = segs.size()/6;
+  tree.nodes.clear();
+  tree.segs.clear();
+  if (ns == 0) return;
+
+  std::vector<int> order(ns);
+  for (int i=0; i<ns; i++) order[i] = i;
+
+  tree.nodes.reserve(2*ns/leaf_size + 1);
+  BuildNode(tree, order, segs, 0, ns);
+
+  // reorder segments so that leaves address contiguous ranges
+  tree.segs.resize(ns*6);
+  for (int i=0; i<ns; i++)
+    memcpy(&tree.segs[i*6], &segs[order[i]*6], sizeof(float)*6);
+}
+
+int VortexLineIndex::BuildNode(Tree& tree, std::vector<int>& order, const std::vector<float>& segs, int s0, int s1) const
+{
+  const int id = tree.nodes.size();
+  tree.nodes.push_back(Node());
+
+  Node node;
+  node.left = node.right = -1;
+  node.s0 = s0;
+  node.s1 = s1;
+  for (int k=0; k<3; k++) {
+    node.LB[k] = FLT_MAX;
+    node.UB[k] = -FLT_MAX;
+  }
+
+  float CLB[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, CUB[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX}; // centroid bounds
+  for (int i=s0; i<s1; i++) {
+    const float *s = &segs[order[i]*6];
+    for (int k=0; k<3; k++) {
+      node.LB[k] = std::min(node.LB[k], std::min(s[k], s[k+3]));
+      node.UB[k] = std::max(node.UB[k], std::max(s[k], s[k+3]));
+      const float c = 0.5f * (s[k] + s[k+3]);
+      CLB[k] = std::min(CLB[k], c);
+      CUB[k] = std::max(CUB[k], c);
+    }
+  }
+
+  if (s1 - s0 > leaf_size) {
+    int axis = 0;
+    for (int k=1; k<3; k++)
+      if (CUB[k] - CLB[k] > CUB[axis] - CLB[axis]) axis = k;
+
+    const int mid = (s0 + s1) / 2;
+    std::nth_element(order.begin() + s0, order.begin() + mid, order.begin() + s1,
+        [&segs, axis](int a, int b) {
+          return segs[a*6+axis] + segs[a*6+axis+3] < segs[b*6+axis] + segs[b*6+axis+3];
+        });
+
+    node.left = BuildNode(tree, order, segs, s0, mid);
+    node.right = BuildNode(tree, order, segs, mid, s1);
+  }
+
+  tree.nodes[id] = node;
+  return id;
+}
+
+void VortexLineIndex::Query(const Tree& A, int a, const Tree& B, int b, const float shift[3],
+    float &best, float P[3], float Q[3]) const
+{
+  const Node &na = A.nodes[a], &nb = B.nodes[b];
+  if (dist2_box_box(na.LB, na.UB, nb.LB, nb.UB, shift) >= best) return;
+
+  const bool leaf_a = na.left < 0, leaf_b = nb.left < 0;
+  if (leaf_a && leaf_b) {
+    float c0[3], c1[3];
+    for (int i=na.s0; i<na.s1; i++) {
+      const float *s = &A.segs[i*6];
+      for (int j=nb.s0; j<nb.s1; j++) {
+        const float *t = &B.segs[j*6];
+        const float q0[3] = {t[0] + shift[0], t[1] + shift[1], t[2] + shift[2]},
+                    q1[3] = {t[3] + shift[0], t[4] + shift[1], t[5] + shift[2]};
+        const float d2 = dist2_segment_segment(s, s+3, q0, q1, c0, c1);
+        if (d2 < best) {
+          best = d2;
+          memcpy(P, c0, sizeof(float)*3);
+          memcpy(Q, c1, sizeof(float)*3);
+        }
+      }
+    }
+    return;
+  }
+
+  // descend the larger node first, visiting the nearer child first
+  const bool split_a = !leaf_a && (leaf_b || na.s1 - na.s0 >= nb.s1 - nb.s0);
+  if (split_a) {
+    int c0 = na.left, c1 = na.right;
+    const Node &n0 = A.nodes[c0], &n1 = A.nodes[c1];
+    if (dist2_box_box(n1.LB, n1.UB, nb.LB, nb.UB, shift) < dist2_box_box(n0.LB, n0.UB, nb.LB, nb.UB, shift))
+      std::swap(c0, c1);
+    Query(A, c0, B, b, shift, best, P, Q);
+    Query(A, c1, B, b, shift, best, P, Q);
+  } else {
+    int c0 = nb.left, c1 = nb.right;
+    const Node &n0 = B.nodes[c0], &n1 = B.nodes[c1];
+    if (dist2_box_box(na.LB, na.UB, n1.LB, n1.UB, shift) < dist2_box_box(na.LB, na.UB, n0.LB, n0.UB, shift))
+      std::swap(c0, c1);
+    Query(A, a, B, c0, shift, best, P, Q);
+    Query(A, a, B, c1, shift, best, P, Q);
+  }
+}
+
+float VortexLineIndex::MinimumDist(int i, int j, float X0[3], float X1[3]) const
+{
+  const Tree &A = _trees[i], &B = _trees[j];
+  if (A.nodes.empty() || B.nodes.empty()) return FLT_MAX;
+
+  float best = FLT_MAX;
+  float P[3] = {0}, Q[3] = {0};
+
+  // periodic images of line j; the unshifted image goes first so that its
+  // result tightens the bound for the others
+  const int nk[3] = {_pbc[0] ? 3 : 1, _pbc[1] ? 3 : 1, _pbc[2] ? 3 : 1};
+  static const int offsets[3] = {0, -1, 1};
+  for (int u=0; u<nk[0]; u++)
+    for (int v=0; v<nk[1]; v++)
+      for (int w=0; w<nk[2]; w++) {
+        const float shift[3] = {offsets[u]*_L[0], offsets[v]*_L[1], offsets[w]*_L[2]};
+        Query(A, 0, B, 0, shift, best, P, Q);
+      }
+
+  if (X0) memcpy(X0, P, sizeof(float)*3);
+  if (X1) memcpy(X1, Q, sizeof(float)*3);
+  return sqrt(best);
+}
+
+void VortexLineIndex::DistanceMatrix(std::vector<float>& dist, int nthreads) const
+{
+  const int n = NLines();
+  dist.assign(n*n, 0.f);
+
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads <= 0) nthreads = 1;
+  nthreads = std::min(nthreads, std::max(n, 1));
+
+  // rows are interleaved across threads to balance the triangular workload
+  auto worker = [this, n, nthreads, &dist](int tid) {
+    for (int i=tid; i<n; i+=nthreads)
+      for (int j=i+1; j<n; j++)
+        dist[i*n+j] = dist[j*n+i] = MinimumDist(i, j);
+  };
+
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker, tid));
+  worker(0);
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
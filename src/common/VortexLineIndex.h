@@ -0,0 +1,56 @@
+#ifndef _VORTEX_LINE_INDEX_H
+#define _VORTEX_LINE_INDEX_H
+
+#include <vector>
+#include "common/VortexLine.h"
+
+/*
+ * \class   VortexLineIndex
+ * \brief   Per-frame spatial index (one BVH over segment bounding boxes per
+ *          line) for line-line distance queries.  Distances are true
+ *          segment-segment distances under the minimum image convention
+ *          along periodic dimensions.  Bezier lines are measured on their
+ *          control polygons; resample them with ToRegular() first.
+*/
+class VortexLineIndex
+{
+public:
+  VortexLineIndex();
+  ~VortexLineIndex();
+
+  // L and pbc may be NULL for non-periodic domains
+  void Build(const std::vector<VortexLine>& vlines, const float L[3]=NULL, const bool pbc[3]=NULL);
+  void Clear() {_trees.clear();}
+  int NLines() const {return _trees.size();}
+
+  // returns the minimum distance between line i and j; X0 and X1 (optional)
+  // are the closest points on line i and on the periodic image of line j
+  float MinimumDist(int i, int j, float X0[3]=NULL, float X1[3]=NULL) const;
+
+  // n*n row-major matrix with zero diagonal, computed in parallel
+  void DistanceMatrix(std::vector<float>& dist, int nthreads=0) const;
+
+private:
+  struct Node {
+    float LB[3], UB[3];
+    int left, right; // children; -1 for leaves
+    int s0, s1; // segment range [s0, s1) for leaves
+  };
+
+  struct Tree {
+    std::vector<Node> nodes; // nodes[0] is the root
+    std::vector<float> segs; // 6 floats per segment
+  };
+
+  void BuildTree(const VortexLine& line, Tree& tree) const;
+  int BuildNode(Tree& tree, std::vector<int>& order, const std::vector<float>& segs, int s0, int s1) const;
+  void Query(const Tree& A, int a, const Tree& B, int b, const float shift[3],
+      float &best, float P[3], float Q[3]) const;
+
+private:
+  std::vector<Tree> _trees;
+  float _L[3];
+  bool _pbc[3];
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "VortexRenderer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+
+static inline float dot3(const float a[3], const float b[3])
+{
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+VortexRenderer::VortexRenderer(int width, int height, int supersampling) :
+  _width(width), _height(height), _ss(std::max(1, supersampling)),
+  _focal(1), _near(1e-3f)
+{
+  _W = _width * _ss;
+  _H = _height * _ss;
+  _bg[0] = _bg[1] = _bg[2] = 255;
+
+  const float LB[3] = {-1, -1, -1}, UB[3] = {1, 1, 1};
+  SetCamera(LB, UB);
+  Clear();
+}
+
+void VortexRenderer::SetBackground(unsigned char r, unsigned char g, unsigned char b)
+{
+  _bg[0] = r; _bg[1] = g; _bg[2] = b;
+}
+
+void VortexRenderer::SetCamera(const float LB[3], const float UB[3], float azimuth, float elevation, float fovy)
+{
+  float C[3], R = 0;
+  for (int k=0; k<3; k++) {
+    C[k] = 0.5f * (LB[k] + UB[k]);
+    R += (UB[k] - LB[k]) * (UB[k] - LB[k]);
+  }
+  R = std::max(0.5f * sqrtf(R), 1e-6f);
+
+  const float az = azimuth * M_PI / 180, el = elevation * M_PI / 180,
+              half = 0.5f * fovy * M_PI / 180;
+
+  // tilt by the elevation about x, then turn by the azimuth about y
+  const float ce = cosf(el), se = sinf(el);
+  const float rows[3][3] = {
+    {1, 0, 0}, // right
+    {0, ce, -se}, // up
+    {0, se, ce}}; // backward, towards the eye
+  for (int i=0; i<3; i++) {
+    const float *v = rows[i];
+    _view[i*3] = v[0]*cos(az) + v[2]*sin(az);
+    _view[i*3+1] = v[1];
+    _view[i*3+2] = -v[0]*sin(az) + v[2]*cos(az);
+  }
+
+  // the bounding sphere fits in the view
+  const float dist = R / sin(half);
+  for (int k=0; k<3; k++)
+    _eye[k] = C[k] + dist * _view[6+k];
+  _focal = 1.f / tan(half);
+  _near = 1e-3f * dist;
+}
+
+void VortexRenderer::Clear()
+{
+  _color.resize(_W*_H*3);
+  for (int i=0; i<_W*_H; i++) {
+    _color[i*3] = _bg[0] / 255.f;
+    _color[i*3+1] = _bg[1] / 255.f;
+    _color[i*3+2] = _bg[2] / 255.f;
+  }
+  _depth.assign(_W*_H, 0.f);
+}
+
+bool VortexRenderer::Project(const float p[3], Vertex& v) const
+{
+  const float d[3] = {p[0] - _eye[0], p[1] - _eye[1], p[2] - _eye[2]};
+  const float depth = -dot3(_view+6, d);
+  if (!(depth > _near)) return false; // also false for NaNs
+
+  const float aspect = (float)_W / _H;
+  const float x = _focal / aspect * dot3(_view, d) / depth,
+              y = _focal * dot3(_view+3, d) / depth;
+  v.x = 0.5f * (x + 1) * _W;
+  v.y = 0.5f * (1 - y) * _H;
+  v.w = 1.f / depth;
+  return true;
+}
+
+void VortexRenderer::Shade(const float p[3], const float n[3], const unsigned char c[3], float out[3]) const
+{
+  // two-sided headlight, as in the viewer
+  float l[3] = {_eye[0] - p[0], _eye[1] - p[1], _eye[2] - p[2]};
+  const float ll = sqrt(dot3(l, l));
+  const float nl = ll > 0 ? fabs(dot3(n, l)) / ll : 1;
+  const float diffuse = 0.25f + 0.75f * nl,
+              specular = 0.3f * pow(nl, 40.f);
+  for (int k=0; k<3; k++)
+    out[k] = std::min(1.f, c[k] / 255.f * diffuse + specular);
+}
+
+inline void VortexRenderer::Plot(int x, int y, float w, const float c[3])
+{
+  if (x < 0 || y < 0 || x >= _W || y >= _H) return;
+  const int i = y*_W + x;
+  if (w <= _depth[i]) return; // larger 1/depth is closer
+  _depth[i] = w;
+  _color[i*3] = c[0];
+  _color[i*3+1] = c[1];
+  _color[i*3+2] = c[2];
+}
+
+void VortexRenderer::RasterizeTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+  const float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+  if (fabs(area) < 1e-12f) return;
+
+  const int x0 = std::max(0, (int)floor(std::min(v0.x, std::min(v1.x, v2.x)))),
+            x1 = std::min(_W-1, (int)ceil(std::max(v0.x, std::max(v1.x, v2.x)))),
+            y0 = std::max(0, (int)floor(std::min(v0.y, std::min(v1.y, v2.y)))),
+            y1 = std::min(_H-1, (int)ceil(std::max(v0.y, std::max(v1.y, v2.y))));
+  if (x0 > x1 || y0 > y1) return;
+
+  // edge functions e_i(x, y) = A_i x + B_i y + C_i, normalized by the area
+  // so that they are the barycentric coordinates
+  const Vertex *v[3] = {&v0, &v1, &v2};
+  float A[3], B[3], C[3];
+  for (int i=0; i<3; i++) {
+    const Vertex &a = *v[(i+1)%3], &b = *v[(i+2)%3];
+    A[i] = (a.y - b.y) / area;
+    B[i] = (b.x - a.x) / area;
+    C[i] = (a.x * b.y - a.y * b.x) / area;
+  }
+
+  for (int y=y0; y<=y1; y++) {
+    const float py = y + 0.5f;
+    for (int x=x0; x<=x1; x++) {
+      const float px = x + 0.5f;
+      const float b0 = A[0]*px + B[0]*py + C[0],
+                  b1 = A[1]*px + B[1]*py + C[1],
+                  b2 = 1 - b0 - b1;
+      if (b0 < 0 || b1 < 0 || b2 < 0) continue;
+
+      const float w = b0*v0.w + b1*v1.w + b2*v2.w;
+      const float c[3] = {
+        b0*v0.c[0] + b1*v1.c[0] + b2*v2.c[0],
+        b0*v0.c[1] + b1*v1.c[1] + b2*v2.c[1],
+        b0*v0.c[2] + b1*v1.c[2] + b2*v2.c[2]};
+      Plot(x, y, w, c);
+    }
+  }
+}
+
+void VortexRenderer::RasterizeLine(const Vertex& v0, const Vertex& v1, int width)
+{
+  const float dx = v1.x - v0.x, dy = v1.y - v0.y;
+  const int n = std::max(1, (int)ceil(std::max(fabs(dx), fabs(dy))));
+  if (n > 4*(_W + _H)) return; // nearly parallel to the view direction, off-screen
+
+  const int r0 = -(width-1)/2, r1 = width/2;
+  for (int i=0; i<=n; i++) {
+    const float t = (float)i / n;
+    const int x = floor(v0.x + t*dx), y = floor(v0.y + t*dy);
+    const float w = v0.w + t*(v1.w - v0.w);
+    const float c[3] = {
+      v0.c[0] + t*(v1.c[0] - v0.c[0]),
+      v0.c[1] + t*(v1.c[1] - v0.c[1]),
+      v0.c[2] + t*(v1.c[2] - v0.c[2])};
+    for (int u=r0; u<=r1; u++)
+      for (int v=r0; v<=r1; v++)
+        Plot(x+u, y+v, w, c);
+  }
+}
+
+void VortexRenderer::DrawTubes(const VortexTubeMesh& mesh)
+{
+  const int nv = mesh.NVertices();
+  std::vector<Vertex> verts(nv);
+  std::vector<bool> visible(nv);
+  for (int i=0; i<nv; i++) {
+    const float *p = &mesh.vertices[i*6];
+    visible[i] = Project(p, verts[i]);
+    if (visible[i])
+      Shade(p, p+3, &mesh.colors[i*3], verts[i].c);
+  }
+
+  for (int i=0; i<mesh.NTriangles(); i++) {
+    const unsigned int *t = &mesh.indices[i*3];
+    if (visible[t[0]] && visible[t[1]] && visible[t[2]]) // clipped at the near plane
+      RasterizeTriangle(verts[t[0]], verts[t[1]], verts[t[2]]);
+  }
+}
+
+void VortexRenderer::DrawLines(const std::vector<VortexLine>& lines, float width)
+{
+  const int w = std::max(1, (int)(width * _ss + 0.5f));
+  std::vector<int> counts;
+  for (int i=0; i<lines.size(); i++) {
+    const VortexLine &l = lines[i];
+    const float c[3] = {l.r / 255.f, l.g / 255.f, l.b / 255.f};
+
+    // pieces that do not cross boundaries, so that no segment spans the domain
+    counts.clear();
+    l.Pieces(counts);
+    int first = 0;
+    for (int j=0; j<counts.size(); j++) {
+      Vertex v0, v1;
+      bool visible0 = false;
+      for (int k=first; k<first+counts[j]; k++) {
+        const bool visible1 = Project(&l[k*3], v1);
+        std::copy(c, c+3, v1.c);
+        if (visible0 && visible1)
+          RasterizeLine(v0, v1, w);
+        v0 = v1;
+        visible0 = visible1;
+      }
+      first += counts[j];
+    }
+  }
+}
+
+const std::vector<unsigned char>& VortexRenderer::Image() const
+{
+  // box filter over the supersamples
+  _image.resize(_width*_height*3);
+  const float scale = 255.f / (_ss*_ss);
+  for (int y=0; y<_height; y++)
+    for (int x=0; x<_width; x++)
+      for (int k=0; k<3; k++) {
+        float sum = 0;
+        for (int v=0; v<_ss; v++)
+          for (int u=0; u<_ss; u++)
+            sum += _color[((y*_ss+v)*_W + x*_ss+u)*3 + k];
+        _image[(y*_width+x)*3+k] = std::min(255.f, sum*scale + 0.5f);
+      }
+  return _image;
+}
+
+bool VortexRenderer::WritePPM(const std::string& filename) const
+{
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (!fp) return false;
+
+  const std::vector<unsigned char>& img = Image();
+  fprintf(fp, "P6\n%d %d\n255\n", _width, _height);
+  const bool succ = fwrite(img.data(), 1, img.size(), fp) == img.size();
+  fclose(fp);
+  return succ;
+}
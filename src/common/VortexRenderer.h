@@ -0,0 +1,63 @@
+#ifndef _VORTEX_RENDERER_H
+#define _VORTEX_RENDERER_H
+
+#include <string>
+#include <vector>
+#include "common/VortexLine.h"
+#include "common/VortexTube.h"
+
+/*
+ * \class   VortexRenderer
+ * \brief   Software rasterizer for vortex lines and tubes, for rendering
+ *          without a display or an OpenGL context.  Tubes are shaded with
+ *          a headlight, and the image is supersampled to smooth the edges.
+ *          An instance is not thread-safe; use one per thread.
+*/
+class VortexRenderer {
+public:
+  VortexRenderer(int width, int height, int supersampling=2);
+
+  // orbit camera that frames the box [LB, UB]; the view direction is -z
+  // when azimuth (about y) and elevation (about x) are zero, in degrees
+  void SetCamera(const float LB[3], const float UB[3], float azimuth=0, float elevation=0, float fovy=30);
+  void SetBackground(unsigned char r, unsigned char g, unsigned char b);
+
+  void Clear();
+  void DrawTubes(const VortexTubeMesh& mesh);
+  void DrawLines(const std::vector<VortexLine>& lines, float width=1); // in pixels of the output image
+
+  int Width() const {return _width;}
+  int Height() const {return _height;}
+  const std::vector<unsigned char>& Image() const; // RGB, top row first
+
+  bool WritePPM(const std::string& filename) const;
+
+private:
+  struct Vertex {
+    float x, y; // pixels
+    float w; // 1/depth
+    float c[3]; // shaded color
+  };
+
+  bool Project(const float p[3], Vertex& v) const;
+  void Shade(const float p[3], const float n[3], const unsigned char c[3], float out[3]) const;
+  void RasterizeTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+  void RasterizeLine(const Vertex& v0, const Vertex& v1, int width);
+  void Plot(int x, int y, float w, const float c[3]);
+
+private:
+  int _width, _height, _ss;
+  int _W, _H; // of the supersampled buffers
+
+  float _eye[3], _view[9]; // rows of the view rotation: right, up, backward
+  float _focal; // 1/tan(fovy/2)
+  float _near;
+
+  unsigned char _bg[3];
+  std::vector<float> _color; // supersampled, RGB
+  std::vector<float> _depth; // 1/depth, 0 for the background
+
+  mutable std::vector<unsigned char> _image;
+};
+
+#endif
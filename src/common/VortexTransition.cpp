@@ -5,12 +5,14 @@
 #include <set>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
 #include "common/diy-ext.hpp"
 #include "random_color.h"
 #include "graph_color.h"
 #include "def.h"
 
-VortexTransition::VortexTransition()
+VortexTransition::VortexTransition() :
+  _max_nvortices_per_frame(0)
 {
 }
 
@@ -27,31 +29,40 @@ bool VortexTransition::LoadFromDB(rocksdb::DB* db)
   s = db->Get(rocksdb::ReadOptions(), "trans", &buf);
   if (s.ok()) {
     diy::unserialize(buf, *this);
-  } else {
-    s = db->Get(rocksdb::ReadOptions(), "f", &buf);
-    if (!s.ok()) return false;
+    if (NTimesteps() > 0) return true;
+    fprintf(stderr, "cached transition of another version, rebuilding..\n");
+  }
 
-    diy::unserialize(buf, _frames);
-    const int nframes = _frames.size();
+  s = db->Get(rocksdb::ReadOptions(), "f", &buf);
+  if (!s.ok()) return false;
 
-    fprintf(stderr, "nframes=%d\n", nframes);
+  diy::unserialize(buf, _frames);
+  const int nframes = _frames.size();
 
-    for (int i=0; i<nframes-1; i++) {
-      std::stringstream ss;
-      ss << "m." << _frames[i] << "." << _frames[i+1];
-      rocksdb::Status s = db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
-      if (!s.ok()) fprintf(stderr, "Key not found, %s\n", ss.str().c_str());
+  fprintf(stderr, "nframes=%d\n", nframes);
 
-      VortexTransitionMatrix mat;
-      diy::unserialize(buf, mat);
-      AddMatrix(mat);
+  // matrices are consumed one by one and dropped, so that only the 
+  // sequences stay in memory
+  _matrices.clear();
+  ClearSequence();
+  for (int i=0; i<nframes-1; i++) {
+    std::stringstream ss;
+    ss << "m." << _frames[i] << "." << _frames[i+1];
+    rocksdb::Status s = db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+    if (!s.ok()) {
+      fprintf(stderr, "Key not found, %s\n", ss.str().c_str());
+      return false;
     }
 
-    ConstructSequence();
-    diy::serialize(*this, buf);
-    db->Put(rocksdb::WriteOptions(), "trans", buf);
+    VortexTransitionMatrix mat;
+    diy::unserialize(buf, mat);
+    ConsumeInterval(i, mat);
   }
 
+  SequenceGraphColoring();
+  diy::serialize(*this, buf);
+  db->Put(rocksdb::WriteOptions(), "trans", buf); // fails harmlessly on read-only databases
+
   return true;
 }
 #endif
@@ -227,22 +238,21 @@ int VortexTransition::NewVortexSequence(int its)
 
 int VortexTransition::lvid2gvid(int t, int lid) const
 {
-  std::pair<int, int> key = std::make_pair(t, lid);
-  std::map<std::pair<int,int>,int>::const_iterator it = _seqmap.find(key);
-  if (it == _seqmap.end())
-    return -1;
-  else 
-    return it->second;
+  if (t<0 || t>=_seqmap.size()) return -1;
+  
+  const std::vector<int> &gids = _seqmap[t];
+  if (lid<0 || lid>=gids.size()) return -1;
+  else return gids[lid];
 }
 
 int VortexTransition::gvid2lvid(int frame, int gvid) const
 {
-  std::pair<int, int> key = std::make_pair(frame, gvid);
-  std::map<std::pair<int, int>,int>::const_iterator it = _invseqmap.find(key);
-  if (it == _invseqmap.end())
-    return -1;
-  else 
-    return it->second;
+  if (gvid<0 || gvid>=_seqs.size()) return -1;
+
+  const VortexSequence &seq = _seqs[gvid];
+  const int k = frame - seq.its;
+  if (k<0 || k>=seq.lids.size()) return -1;
+  else return seq.lids[k];
 }
 
 void VortexTransition::SequenceColor(int gid, unsigned char &r, unsigned char &g, unsigned char &b) const
@@ -252,101 +262,209 @@ void VortexTransition::SequenceColor(int gid, unsigned char &r, unsigned char &g
   b = _seqs[gid].b;
 }
 
+void VortexTransition::ClearSequence()
+{
+  _seqs.clear();
+  _seqmap.clear();
+  _events.clear();
+  _nvortices_per_frame.clear();
+  _max_nvortices_per_frame = 0;
+  _pending_matrices.clear();
+}
+
 void VortexTransition::ConstructSequence()
 {
-  for (int i=0; i<_frames.size()-1; i++) {
+  ClearSequence();
+
+  for (int i=0; i<(int)_frames.size()-1; i++) {
     Interval I(_frames[i], _frames[i+1]);
     // fprintf(stderr, "processing interval {%d, %d}\n", I.first, I.second);
+    ConsumeInterval(i, Matrix(I));
+  }
 
-    VortexTransitionMatrix &tm = Matrix(I);
-    assert(tm.Valid());
+  // RandomColorSchemes();
+  SequenceGraphColoring(); 
+}
 
-    if (i == 0) { // initial
-      for (int k=0; k<tm.n0(); k++) {
-        int gid = NewVortexSequence(i);
-        _seqs[gid].itl ++;
-        _seqs[gid].lids.push_back(k);
-        _seqmap[std::make_pair(i, k)] = gid;
-        _invseqmap[std::make_pair(i, gid)] = k;
-      }
+void VortexTransition::AppendFrame(int frame)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _frames.push_back(frame);
+}
+
+void VortexTransition::PushMatrix(const VortexTransitionMatrix& m)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  // frame index of the next interval to be consumed
+  int i = _seqmap.empty() ? 0 : _seqmap.size() - 1;
+
+  if (i+1 < _frames.size() && m.t0() == _frames[i]) {
+    ConsumeInterval(i++, m);
+  } else {
+    _pending_matrices[m.t0()] = m;
+    return;
+  }
+
+  // drain matrices that arrived earlier than their predecessors
+  while (i+1 < _frames.size()) {
+    std::map<int, VortexTransitionMatrix>::iterator it = _pending_matrices.find(_frames[i]);
+    if (it == _pending_matrices.end()) break;
+    
+    ConsumeInterval(i++, it->second);
+    _pending_matrices.erase(it);
+  }
+}
+
+int VortexTransition::FlushMatrices()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  int gaps = 0;
+  
+  // intervals whose matrices never arrived become gaps
+  int i = _seqmap.empty() ? 0 : _seqmap.size() - 1;
+  for (; i+1 < _frames.size() && !_pending_matrices.empty(); i++) {
+    std::map<int, VortexTransitionMatrix>::iterator it = _pending_matrices.find(_frames[i]);
+    if (it == _pending_matrices.end()) {
+      fprintf(stderr, "WARNING: no matrix for interval {%d, %d}\n", _frames[i], _frames[i+1]);
+      SkipInterval(i);
+      gaps ++;
+    } else {
+      ConsumeInterval(i, it->second);
+      _pending_matrices.erase(it);
     }
+  }
 
-    for (int k=0; k<tm.NModules(); k++) {
-      int event;
-      std::set<int> lhs, rhs;
-      tm.GetModule(k, lhs, rhs, event);
+  if (!_pending_matrices.empty()) {
+    fprintf(stderr, "WARNING: %d matrices do not start at any frame\n", (int)_pending_matrices.size());
+    _pending_matrices.clear();
+  }
+  return gaps;
+}
+
+void VortexTransition::ConsumeInterval(int i, const VortexTransitionMatrix& tm)
+{
+  // matrices are empty if either frame has no vortices, which is still a 
+  // transition; others (e.g. default-constructed) leave a gap
+  if (tm.Valid() || tm.n0() == 0 || tm.n1() == 0) 
+    ConsumeMatrix(i, tm);
+  else {
+    fprintf(stderr, "WARNING: invalid matrix for interval {%d, %d}\n", _frames[i], _frames[i+1]);
+    SkipInterval(i);
+  }
+}
 
-      if (lhs.size() == 1 && rhs.size() == 1) { // ordinary case
-        int l = *lhs.begin(), r = *rhs.begin();
-        int gid = _seqmap[std::make_pair(i, l)];
+void VortexTransition::SkipInterval(int i)
+{
+  // nothing links frame i+1 to frame i; its vortices start new sequences
+  // when the next interval is consumed
+  _seqmap.resize(i+2);
+}
+
+void VortexTransition::ConsumeMatrix(int i, const VortexTransitionMatrix& tm)
+{
+  if (tm.t1() != _frames[i+1])
+    fprintf(stderr, "WARNING: interval {%d, %d} does not match frames {%d, %d}\n", 
+        tm.t0(), tm.t1(), _frames[i], _frames[i+1]);
+
+  // the first frame, and a frame after a gap, start new sequences
+  if (_seqmap.size() < i+1) _seqmap.resize(i+1);
+  if (_seqmap[i].size() < tm.n0()) {
+    const int n = _seqmap[i].size();
+    _seqmap[i].resize(tm.n0(), -1);
+    for (int k=n; k<tm.n0(); k++) {
+      int gid = NewVortexSequence(i);
+      _seqs[gid].itl ++;
+      _seqs[gid].lids.push_back(k);
+      _seqmap[i][k] = gid;
+    }
+    _nvortices_per_frame[_frames[i]] = tm.n0();
+    _max_nvortices_per_frame = std::max(_max_nvortices_per_frame, tm.n0());
+  }
+  
+  _seqmap.resize(i+2);
+  std::vector<int> &gids0 = _seqmap[i], 
+                   &gids1 = _seqmap[i+1];
+  gids1.resize(tm.n1(), -1);
+
+  for (int k=0; k<tm.NModules(); k++) {
+    int event;
+    std::set<int> lhs, rhs;
+    tm.GetModule(k, lhs, rhs, event);
+
+    if (lhs.size() == 1 && rhs.size() == 1) { // ordinary case
+      int l = *lhs.begin(), r = *rhs.begin();
+      int gid = gids0[l];
+      _seqs[gid].itl ++;
+      _seqs[gid].lids.push_back(r);
+      gids1[r] = gid;
+    } else { // some events, need re-ID
+      for (std::set<int>::iterator it=rhs.begin(); it!=rhs.end(); it++) {
+        int r = *it; 
+        int gid = NewVortexSequence(i+1);
         _seqs[gid].itl ++;
         _seqs[gid].lids.push_back(r);
-        _seqmap[std::make_pair(i+1, r)] = gid;
-        _invseqmap[std::make_pair(i+1, gid)] = r;
-      } else { // some events, need re-ID
-        for (std::set<int>::iterator it=rhs.begin(); it!=rhs.end(); it++) {
-          int r = *it; 
-          int gid = NewVortexSequence(i+1);
-          _seqs[gid].itl ++;
-          _seqs[gid].lids.push_back(r);
-          _seqmap[std::make_pair(i+1, r)] = gid;
-          _invseqmap[std::make_pair(i+1, gid)] = r;
-        }
+        gids1[r] = gid;
       }
+    }
 
-      // build events
-      // if (event >= VORTEX_EVENT_MERGE) {
-      if (event > VORTEX_EVENT_DUMMY) {
-        VortexEvent e;
-        e.if0 = i; 
-        e.if1 = i+1;
-        e.type = event;
-        e.lhs = lhs;
-        e.rhs = rhs;
-        _events.push_back(e);
-      }
+    // build events
+    // if (event >= VORTEX_EVENT_MERGE) {
+    if (event > VORTEX_EVENT_DUMMY) {
+      VortexEvent e;
+      e.if0 = i; 
+      e.if1 = i+1;
+      e.type = event;
+      e.lhs = lhs;
+      e.rhs = rhs;
+      _events.push_back(e);
+      
+      if (_event_callback) _event_callback(e);
     }
   }
-
-  // RandomColorSchemes();
-  SequenceGraphColoring(); 
+  
+  _nvortices_per_frame[_frames[i+1]] = tm.n1();
+  _max_nvortices_per_frame = std::max(_max_nvortices_per_frame, tm.n1());
 }
 
 void VortexTransition::PrintSequence() const
 {
-  for (int i=0; i<_events.size(); i++) {
-    const VortexEvent& e = _events[i];
-    std::stringstream ss;
-    ss << "interval={" << _frames[e.if0] << ", " << _frames[e.if1] << "}, ";
-    ss << "type=" << VortexEvent::TypeToString(e.type) << ", ";
-    ss << "lhs={";
-
-    int j = 0;
-    if (e.lhs.empty()) ss << "}, "; 
-    else 
-      for (std::set<int>::iterator it = e.lhs.begin(); it != e.lhs.end(); it++, j++) {
-        const int gvid = lvid2gvid(e.if0, *it);
-        if (j<e.lhs.size()-1) 
-          ss << gvid << ", ";
-        else 
-          ss << gvid << "}, ";
-      }
-    
-    ss << "rhs={";
-   
-    j = 0;
-    if (e.rhs.empty()) ss << "}";
-    else 
-      for (std::set<int>::iterator it = e.rhs.begin(); it != e.rhs.end(); it++, j++) {
-        const int gvid = lvid2gvid(e.if1, *it);
-        if (j<e.rhs.size()-1) 
-          ss << gvid << ", ";
-        else 
-          ss << gvid << "}";
-      }
-    
-    std::cout << ss.str() << std::endl;
-  }
+  for (int i=0; i<_events.size(); i++) 
+    std::cout << EventToString(_events[i]) << std::endl;
+}
+
+std::string VortexTransition::EventToString(const VortexEvent& e) const
+{
+  std::stringstream ss;
+  ss << "interval={" << _frames[e.if0] << ", " << _frames[e.if1] << "}, ";
+  ss << "type=" << VortexEvent::TypeToString(e.type) << ", ";
+  ss << "lhs={";
+
+  int j = 0;
+  if (e.lhs.empty()) ss << "}, "; 
+  else 
+    for (std::set<int>::iterator it = e.lhs.begin(); it != e.lhs.end(); it++, j++) {
+      const int gvid = lvid2gvid(e.if0, *it);
+      if (j<e.lhs.size()-1) 
+        ss << gvid << ", ";
+      else 
+        ss << gvid << "}, ";
+    }
+  
+  ss << "rhs={";
+ 
+  j = 0;
+  if (e.rhs.empty()) ss << "}";
+  else 
+    for (std::set<int>::iterator it = e.rhs.begin(); it != e.rhs.end(); it++, j++) {
+      const int gvid = lvid2gvid(e.if1, *it);
+      if (j<e.rhs.size()-1) 
+        ss << gvid << ", ";
+      else 
+        ss << gvid << "}";
+    }
+  
+  return ss.str();
 }
 
 
@@ -394,47 +512,48 @@ void VortexTransition::SequenceGraphColoring()
 {
   using namespace std;
 
-  // 1. construct graph
+  // 1. construct graph (adjacency lists)
   const int n = _seqs.size();
-  bool **M;
-  malloc2D(M, n, n, bool);
-  memset(M[0], 0, sizeof(bool)*n*n);
+  vector<vector<int> > adj(n);
 
-  // 1.1 concurrent vortices
-  map<int, std::set<int> > time_slots;
+  // 1.1 concurrent vortices.  sweeping over frames, a sequence is linked to 
+  // all sequences that are alive when it starts, so that each pair of 
+  // overlapping lifetimes is visited exactly once
+  vector<vector<int> > starts(_frames.size()), ends(_frames.size()+1);
   for (int i=0; i<n; i++) {
-    for (int j=0; j<_seqs[i].itl; j++) {
-      time_slots[_seqs[i].its+j].insert(i);
-    }
+    starts[_seqs[i].its].push_back(i);
+    ends[_seqs[i].its + _seqs[i].itl].push_back(i);
   }
-  for (map<int, std::set<int> >::iterator it=time_slots.begin(); it!=time_slots.end(); it++) {
-    const set<int> &concurrents = it->second;
-    for (set<int>::iterator it0=concurrents.begin(); it0!=concurrents.end(); it0++)
-      for (set<int>::iterator it1=concurrents.begin(); it1!=concurrents.end(); it1++)
-        if (it0!=it1) {
-          M[*it0][*it1] = M[*it1][*it0] = true;
-        }
+  
+  set<int> alive;
+  for (int t=0; t<_frames.size(); t++) {
+    for (int k=0; k<ends[t].size(); k++) 
+      alive.erase(ends[t][k]);
+    for (int k=0; k<starts[t].size(); k++) {
+      const int i = starts[t][k];
+      for (set<int>::iterator it=alive.begin(); it!=alive.end(); it++) {
+        adj[i].push_back(*it);
+        adj[*it].push_back(i);
+      }
+      alive.insert(i);
+    }
   }
 
   // 1.2 events
-  for (int i=0; i<n; i++) {
-    int t = _seqs[i].its + _seqs[i].itl - 1;
-    if (t>=_frames.size()-1) continue; 
-    int lhs_lid = _seqs[i].lids.back();
-    Interval interval = std::make_pair(_frames[t], _frames[t+1]);
-    VortexTransitionMatrix &mat = _matrices[interval];
-    for (int k=0; k<mat.n1(); k++) {
-      if (mat(lhs_lid, k)) {
-        int rhs_lid = k;
-        int rgid = _seqmap[std::make_pair(t+1, k)];
-        M[i][rgid] = M[rgid][i] = true;
+  for (int i=0; i<_events.size(); i++) {
+    const VortexEvent &e = _events[i];
+    for (std::set<int>::const_iterator it0=e.lhs.begin(); it0!=e.lhs.end(); it0++) 
+      for (std::set<int>::const_iterator it1=e.rhs.begin(); it1!=e.rhs.end(); it1++) {
+        const int lgid = lvid2gvid(e.if0, *it0), 
+                  rgid = lvid2gvid(e.if1, *it1);
+        adj[lgid].push_back(rgid);
+        adj[rgid].push_back(lgid);
       }
-    }
   }
 
   // 2. graph coloring
-  int *cids = (int*)malloc(sizeof(int)*n);
-  int nc = welsh_powell(n, M, cids);
+  vector<int> cids(n);
+  int nc = dsatur(n, adj, cids.data());
 
   // 3. generate colors
   // fprintf(stderr, "#color=%d\n", nc);
@@ -448,11 +567,6 @@ void VortexTransition::SequenceGraphColoring()
     _seqs[i].g = colors[c*3+1];
     _seqs[i].b = colors[c*3+2];
   }
-
-  // 4. release memory
-  free(M[0]);
-  free(M);
-  free(cids);
 }
 
 int VortexTransition::NVortices(int frame) const
@@ -6,6 +6,7 @@
 #include "common/VortexSequence.h"
 #include <utility>
 #include <mutex>
+#include <functional>
 
 #if WITH_ROCKSDB
 #include <rocksdb/db.h>
@@ -36,6 +37,17 @@ public:
 
   void ConstructSequence();
   void PrintSequence() const;
+  std::string EventToString(const VortexEvent& e) const;
+
+  // streaming construction: matrices may arrive in any order; each one is 
+  // consumed (and dropped) as soon as its predecessor has been consumed.
+  // FlushMatrices() consumes what is still pending at the end of a run, 
+  // leaving gaps for missing intervals, and returns the number of gaps.
+  void AppendFrame(int frame);
+  void PushMatrix(const VortexTransitionMatrix& m);
+  int FlushMatrices();
+  void SetEventCallback(const std::function<void(const VortexEvent&)>& f) {_event_callback = f;}
+
   void SequenceGraphColoring();
   void SequenceColor(int gid, unsigned char &r, unsigned char &g, unsigned char &b) const;
 
@@ -59,42 +71,64 @@ public:
 private:
   int NewVortexSequence(int its);
   std::string NodeToString(int i, int j) const;
+  void ConsumeMatrix(int i, const VortexTransitionMatrix& tm); // i: frame index of tm.t0()
+  void ConsumeInterval(int i, const VortexTransitionMatrix& tm); // consumes tm, or skips the interval if tm is invalid
+  void SkipInterval(int i);
+  void ClearSequence();
 
 private:
   // int _ts, _tl;
   std::vector<int> _frames; // frame IDs
   std::map<Interval, VortexTransitionMatrix> _matrices;
   std::vector<struct VortexSequence> _seqs;
-  std::map<std::pair<int, int>, int> _seqmap; // <time, lid>, gid
-  std::map<std::pair<int, int>, int> _invseqmap; // <time, gid>, lid
+  std::vector<std::vector<int> > _seqmap; // [frame index][lid] -> gid; gid->lid is looked up in _seqs
   std::map<int, int> _nvortices_per_frame;
   int _max_nvortices_per_frame;
 
   std::vector<struct VortexEvent> _events;
 
+  std::map<int, VortexTransitionMatrix> _pending_matrices; // keyed by t0, waiting for predecessors
+  std::function<void(const VortexEvent&)> _event_callback;
+
   std::mutex _mutex;
 };
 
 /////////
 namespace diy {
   template <> struct Serialization<VortexTransition> {
+    // records written before the sequence map was flattened start with the
+    // number of frames; later records start with a tag and a version.  Records
+    // of other versions load as an empty transition, which LoadFromDB() 
+    // rebuilds from the matrices.
     static void save(diy::BinaryBuffer& bb, const VortexTransition& m) {
+      const size_t tag = (size_t)-1;
+      const unsigned char version = 1;
+      diy::save(bb, tag);
+      diy::save(bb, version);
       diy::save(bb, m._frames);
       diy::save(bb, m._matrices);
       diy::save(bb, m._seqs);
       diy::save(bb, m._seqmap);
-      diy::save(bb, m._invseqmap);
       diy::save(bb, m._nvortices_per_frame);
       diy::save(bb, m._max_nvortices_per_frame);
       diy::save(bb, m._events);
     }
 
     static void load(diy::BinaryBuffer&bb, VortexTransition& m) {
+      size_t tag = 0;
+      unsigned char version = 0;
+      diy::load(bb, tag);
+      if (tag == (size_t)-1) diy::load(bb, version);
+
+      m._frames.clear();
+      m._matrices.clear();
+      m.ClearSequence();
+      if (version != 1) return;
+
       diy::load(bb, m._frames);
       diy::load(bb, m._matrices);
       diy::load(bb, m._seqs);
       diy::load(bb, m._seqmap);
-      diy::load(bb, m._invseqmap);
       diy::load(bb, m._nvortices_per_frame);
       diy::load(bb, m._max_nvortices_per_frame);
       diy::load(bb, m._events);
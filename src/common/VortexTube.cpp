@@ -0,0 +1,181 @@
+#include "VortexTube.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cmath>
+
+static inline float dot3(const float a[3], const float b[3])
+{
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+static inline void cross3(const float a[3], const float b[3], float c[3])
+{
+  c[0] = a[1]*b[2] - a[2]*b[1];
+  c[1] = a[2]*b[0] - a[0]*b[2];
+  c[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+static inline bool normalize3(float a[3])
+{
+  const float l = sqrt(dot3(a, a));
+  if (!(l > 1e-12f)) return false; // also false for NaNs
+  a[0] /= l; a[1] /= l; a[2] /= l;
+  return true;
+}
+
+// unit direction of the segment from p to q; false if it is degenerate
+static inline bool segment_tangent(const float p[3], const float q[3], float T[3])
+{
+  T[0] = q[0] - p[0];
+  T[1] = q[1] - p[1];
+  T[2] = q[2] - p[2];
+  return normalize3(T);
+}
+
+// a unit vector perpendicular to the unit vector T
+static inline void perpendicular(const float T[3], float N[3])
+{
+  N[0] = -T[1]; N[1] = T[0]; N[2] = 0;
+  if (!normalize3(N)) {
+    N[0] = 1; N[1] = 0; N[2] = 0;
+  }
+}
+
+static void build_tube(const float *P, const unsigned char *C, int n,
+    int npatches, float radius, const float *cosines, const float *sines,
+    unsigned int vbase, float *V, unsigned char *VC, unsigned int *I)
+{
+  // the frame of the first ring follows the first proper segment
+  float T[3] = {0, 0, 1}, N[3], B[3];
+  for (int j=1; j<n; j++)
+    if (segment_tangent(P+(j-1)*3, P+j*3, T)) break;
+  perpendicular(T, N);
+
+  for (int r=0; r<n; r++) {
+    float T1[3];
+    if (r > 0 && segment_tangent(P+(r-1)*3, P+r*3, T1)) {
+      // parallel transport: rotate N about T x T1 by the turning angle
+      float a[3], aN[3];
+      cross3(T, T1, a);
+      const float s = sqrt(dot3(a, a)), c = dot3(T, T1);
+      if (s > 1e-6f) {
+        a[0] /= s; a[1] /= s; a[2] /= s;
+        cross3(a, N, aN);
+        const float k = dot3(a, N) * (1 - c);
+        for (int m=0; m<3; m++)
+          N[m] = N[m]*c + aN[m]*s + a[m]*k;
+      }
+
+      // remove the drift from the plane perpendicular to the tangent
+      const float d = dot3(N, T1);
+      for (int m=0; m<3; m++)
+        N[m] -= d * T1[m];
+      if (!normalize3(N)) perpendicular(T1, N);
+      T[0] = T1[0]; T[1] = T1[1]; T[2] = T1[2];
+    }
+    cross3(N, T, B);
+
+    const float *p = P + r*3;
+    const unsigned char *c = C + r*4;
+    for (int q=0; q<npatches; q++) {
+      float *v = V + (r*npatches + q)*6;
+      for (int m=0; m<3; m++) {
+        v[m+3] = N[m]*cosines[q] + B[m]*sines[q];
+        v[m] = p[m] + v[m+3]*radius;
+      }
+      unsigned char *vc = VC + (r*npatches + q)*3;
+      vc[0] = c[0]; vc[1] = c[1]; vc[2] = c[2];
+    }
+
+    if (r == 0) continue;
+    const unsigned int cur = vbase + r*npatches, prev = cur - npatches;
+    unsigned int *t = I + (r-1)*npatches*6;
+    for (int q=0; q<npatches; q++, t+=6) {
+      const int qn = (q+1) % npatches;
+      t[0] = cur + q;  t[1] = prev + qn; t[2] = prev + q;
+      t[3] = cur + q;  t[4] = cur + qn;  t[5] = prev + qn;
+    }
+  }
+}
+
+void BuildVortexTubes(const float *verts, const unsigned char *colors,
+    const int *counts, const int *first, int npieces,
+    int npatches, float radius, VortexTubeMesh& mesh, int nthreads)
+{
+  // output ranges of the pieces; a piece of n vertices has n rings and
+  // n-1 bands of 2*npatches triangles
+  std::vector<size_t> vbase(npieces+1), ibase(npieces+1);
+  vbase[0] = ibase[0] = 0;
+  for (int i=0; i<npieces; i++) {
+    const int n = counts[i] < 2 ? 0 : counts[i];
+    vbase[i+1] = vbase[i] + (size_t)n*npatches;
+    ibase[i+1] = ibase[i] + (size_t)std::max(n-1, 0)*npatches*6;
+  }
+
+  mesh.vertices.resize(vbase[npieces]*6);
+  mesh.colors.resize(vbase[npieces]*3);
+  mesh.indices.resize(ibase[npieces]);
+
+  std::vector<float> cosines(npatches), sines(npatches);
+  for (int q=0; q<npatches; q++) {
+    const float angle = q * 2.f * M_PI / npatches;
+    cosines[q] = cos(angle);
+    sines[q] = sin(angle);
+  }
+
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  nthreads = std::max(1, std::min(nthreads, npieces));
+
+  // pieces differ a lot in length, so they are handed out one at a time
+  std::atomic<int> next(0);
+  auto worker = [&]() {
+    for (int i = next++; i < npieces; i = next++) {
+      if (vbase[i+1] == vbase[i]) continue;
+      build_tube(verts + (size_t)first[i]*3, colors + (size_t)first[i]*4, counts[i],
+          npatches, radius, cosines.data(), sines.data(), vbase[i],
+          mesh.vertices.data() + vbase[i]*6, mesh.colors.data() + vbase[i]*3,
+          mesh.indices.data() + ibase[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
+
+void BuildVortexTubes(const std::vector<VortexLine>& lines,
+    int npatches, float radius, VortexTubeMesh& mesh, int nthreads)
+{
+  size_t nverts = 0;
+  for (int i=0; i<lines.size(); i++)
+    nverts += lines[i].size()/3;
+
+  std::vector<unsigned char> colors(nverts*4);
+  std::vector<int> counts, first;
+  std::vector<float> verts;
+  verts.reserve(nverts*3);
+
+  for (int i=0; i<lines.size(); i++) {
+    const VortexLine& l = lines[i];
+    const size_t v0 = verts.size()/3;
+    verts.insert(verts.end(), l.begin(), l.begin() + l.size()/3*3);
+    for (size_t j=v0; j<verts.size()/3; j++) {
+      colors[j*4] = l.r; colors[j*4+1] = l.g; colors[j*4+2] = l.b; colors[j*4+3] = 255;
+    }
+
+    const int p0 = counts.size();
+    l.Pieces(counts);
+    int f = v0;
+    for (int k=p0; k<counts.size(); k++) {
+      first.push_back(f);
+      f += counts[k];
+    }
+  }
+
+  BuildVortexTubes(verts.data(), colors.data(), counts.data(), first.data(), counts.size(),
+      npatches, radius, mesh, nthreads);
+}
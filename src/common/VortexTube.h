@@ -0,0 +1,36 @@
+#ifndef _VORTEX_TUBE_H
+#define _VORTEX_TUBE_H
+
+#include <vector>
+#include "common/VortexLine.h"
+
+/*
+ * \struct  VortexTubeMesh
+ * \brief   Triangle mesh of tubes around vortex lines
+*/
+struct VortexTubeMesh {
+  std::vector<float> vertices; // position and normal of each vertex, interleaved
+  std::vector<unsigned char> colors; // RGB of each vertex
+  std::vector<unsigned int> indices; // triangles
+
+  int NVertices() const {return vertices.size()/6;}
+  int NTriangles() const {return indices.size()/3;}
+
+  void clear() {vertices.clear(); colors.clear(); indices.clear();}
+  void swap(VortexTubeMesh& m) {vertices.swap(m.vertices); colors.swap(m.colors); indices.swap(m.indices);}
+};
+
+// tubes around polyline pieces, in parallel (nthreads=0 for all cores);
+// piece i has the vertices [first[i], first[i]+counts[i]) of verts (3 floats
+// each) and colors (RGBA).  The rings of npatches vertices are oriented with
+// parallel-transport frames, so that the tubes do not twist.
+void BuildVortexTubes(const float *verts, const unsigned char *colors,
+    const int *counts, const int *first, int npieces,
+    int npatches, float radius, VortexTubeMesh& mesh, int nthreads=0);
+
+// tubes around the pieces of vortex lines that do not cross boundaries, in
+// the colors of the lines
+void BuildVortexTubes(const std::vector<VortexLine>& lines,
+    int npatches, float radius, VortexTubeMesh& mesh, int nthreads=0);
+
+#endif
@@ -1,6 +1,8 @@
 #include "graph_color.h"
 #include <algorithm>
 #include <cstdlib>
+#include <set>
+#include <tuple>
 
 typedef struct {
   int index; 
@@ -62,3 +64,45 @@ int welsh_powell(int n, bool **M, int *cid)
 
   return k-1;
 }
+
+int dsatur(int n, const std::vector<std::vector<int> >& adj, int *cid)
+{
+  typedef std::tuple<int, int, int> Key; // <-saturation, -degree, index>
+  std::set<Key> Q;
+  std::vector<std::set<int> > neighbor_colors(n);
+
+  for (int i=0; i<n; i++) {
+    cid[i] = -1;
+    Q.insert(Key(0, -(int)adj[i].size(), i));
+  }
+
+  int nc = 0;
+  while (!Q.empty()) {
+    const int i = std::get<2>(*Q.begin());
+    Q.erase(Q.begin());
+
+    // the smallest color that is not used by neighbors
+    const std::set<int> &used = neighbor_colors[i];
+    int c = 0;
+    for (std::set<int>::const_iterator it = used.begin(); it != used.end() && *it == c; it ++)
+      c ++;
+    cid[i] = c;
+    nc = std::max(nc, c+1);
+
+    for (int k=0; k<adj[i].size(); k++) {
+      const int j = adj[i][k];
+      if (cid[j] >= 0) continue;
+
+      std::set<int> &colors = neighbor_colors[j];
+      const int saturation = colors.size();
+      if (colors.insert(c).second) { // saturation increased
+        Q.erase(Key(-saturation, -(int)adj[j].size(), j));
+        Q.insert(Key(-saturation-1, -(int)adj[j].size(), j));
+      }
+    }
+    
+    std::set<int>().swap(neighbor_colors[i]);
+  }
+
+  return nc;
+}
@@ -1,6 +1,11 @@
 #ifndef _GRAPH_COLOR_H
 #define _GRAPH_COLOR_H
 
+#include <vector>
+
 int welsh_powell(int n, bool **adj, int *cid);  
 
+// DSATUR coloring on adjacency lists, O((V+E) log V).  returns the number of colors
+int dsatur(int n, const std::vector<std::vector<int> >& adj, int *cid);
+
 #endif
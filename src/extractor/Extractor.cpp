@@ -2,6 +2,7 @@
 #include "common/Utils.hpp"
 #include "common/VortexTransition.h"
 #include "common/MeshGraphRegular3DTets.h"
+#include "common/MeshGraphCSR.h"
 #include "io/GLDataset.h"
 #include "io/GLGPU3DDataset.h"
 #include <pthread.h>
@@ -16,6 +17,8 @@
 #include "vfgpu/vfgpu.h"
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <thread>
 #include <chrono>
 
@@ -34,9 +37,13 @@ VortexExtractor::VortexExtractor() :
 #endif
   _gauge(false), 
   _vfgpu_ctx(NULL),
+  _flat_mg(NULL), _flat_mg_generation(0),
+  _face_nodes(NULL), _edge_nodes(NULL),
+  _face_edges(NULL), _face_edges_chirality(NULL),
   _archive(false), 
   _gpu(false),
   _cond(false),
+  _keep_transition(true),
   _pertubation(0),
   _extent_threshold(0),
   _interpolation_mode(INTERPOLATION_TRI_BARYCENTRIC | INTERPOLATION_QUAD_BILINEAR)
@@ -88,6 +95,7 @@ void VortexExtractor::OpenDB(const std::string &name)
 void VortexExtractor::SetDataset(const GLDatasetBase* ds)
 {
   _dataset = ds;
+  _flat_mg = NULL;
 
 #if WITH_ROCKSDB
   OpenDB(ds->DataName());
@@ -119,6 +127,11 @@ void VortexExtractor::SetPertubation(float p)
   _pertubation = p;
 }
 
+void VortexExtractor::SetKeepTransition(bool k)
+{
+  _keep_transition = k;
+}
+
 void VortexExtractor::SetExtentThreshold(float threshold)
 {
   _extent_threshold = threshold;
@@ -191,6 +204,8 @@ void VortexExtractor::ClearPuncturedObjects()
   _punctured_edges.clear();
   _punctured_faces.clear();
   _punctured_faces1.clear();
+  _punctured_cells.clear();
+  _punctured_cells1.clear();
 }
 
 void VortexExtractor::Clear()
@@ -256,6 +271,25 @@ bool VortexExtractor::LoadPuncturedFaces(int slot)
   return true;
 }
 
+// the cells around a punctured face, for CFace and CFaceView
+template <typename Face>
+static void puncture_cells(const Face& face, ChiralityType chirality, std::map<CellIdType, PuncturedCell>& cells)
+{
+  for (int i=0; i<face.contained_cells.size(); i++) {
+    CellIdType cid = face.contained_cells[i];
+    if (cid == UINT_MAX) continue;
+
+    int fchirality = face.contained_cells_chirality[i];
+    int fid = face.contained_cells_fid[i];
+    
+    // bool found = _punctured_cells.find(cid) != _punctured_cells.end();
+    // fprintf(stderr, "cid=%u, found=%d\n", cid, found);
+
+    PuncturedCell &c = cells[cid];
+    c.SetChirality(fid, chirality * fchirality);
+  }
+}
+
 void VortexExtractor::AddPuncturedFace(FaceIdType id, int slot, ChiralityType chirality, const float pos[], float cond)
 {
   pthread_mutex_lock(&_mutex);
@@ -279,20 +313,10 @@ void VortexExtractor::AddPuncturedFace(FaceIdType id, int slot, ChiralityType ch
 
   // cell
   const MeshGraph *mg = _dataset->MeshGraph();
-  const CFace &face = mg->Face(id);
-  for (int i=0; i<face.contained_cells.size(); i++) {
-    CellIdType cid = face.contained_cells[i];
-    if (cid == UINT_MAX) continue;
-
-    int fchirality = face.contained_cells_chirality[i];
-    int fid = face.contained_cells_fid[i];
-    
-    // bool found = _punctured_cells.find(cid) != _punctured_cells.end();
-    // fprintf(stderr, "cid=%u, found=%d\n", cid, found);
-
-    PuncturedCell &c = slot == 0 ? _punctured_cells[cid] : _punctured_cells1[cid];
-    c.SetChirality(fid, chirality * fchirality);
-  }
+  const MeshGraphCSR *csr = dynamic_cast<const MeshGraphCSR*>(mg);
+  std::map<CellIdType, PuncturedCell> &cells = slot == 0 ? _punctured_cells : _punctured_cells1;
+  if (csr) puncture_cells(csr->FaceView(id), chirality, cells);
+  else puncture_cells(mg->Face(id), chirality, cells);
  
 #if 0
   int fidx[4];
@@ -701,6 +725,12 @@ void VortexExtractor::VortexObjectsToVortexLines(
       }
     }
 
+    // periodic wraps are computed once here, so that consumers can split or 
+    // unwrap lines without re-scanning them
+    const GLHeader &hdr = _dataset->GetHeader();
+    if (hdr.pbc[0] || hdr.pbc[1] || hdr.pbc[2]) 
+      line.ComputeWraps(hdr.lengths, hdr.pbc);
+
     if (bezier) {
       line.Flattern(Dataset()->Origins(), Dataset()->Lengths());
       line.ToBezier();
@@ -757,7 +787,7 @@ next:
   }
 
   // if (_archive) tm.SaveToFile(Dataset()->DataName(), Dataset()->TimeStep(0), Dataset()->TimeStep(1));
-  _vortex_transition.AddMatrix(tm);
+  if (_keep_transition) _vortex_transition.AddMatrix(tm);
   // tm.Print();
 
 #if 0 // WITH_ROCKSDB
@@ -960,7 +990,7 @@ void VortexExtractor::ExtractFaces(int slot)
   if (!LoadPuncturedFaces(slot)) {
     if (_gpu) {
       ExtractFaces_GPU(slot);
-    } else {
+    } else if (!ExtractFacesUnstructured(slot)) {
       // running in threads
       const int nthreads = _nthreads; 
       pthread_t threads[nthreads-1]; 
@@ -1123,19 +1153,13 @@ int VortexExtractor::ExtractFace(FaceIdType id, int slot)
 {
   const GLHeader& hdr = _dataset->GetHeader(slot); 
   const GLDataset *ds = (GLDataset*)_dataset;
-  const MeshGraphRegular3DTets *mg = (const MeshGraphRegular3DTets*)_dataset->MeshGraph();
+  const MeshGraph *mg = _dataset->MeshGraph();
   
   const CFace& f = mg->Face(id, true);
   const int nnodes = f.nodes.size();
 
   if (!f.Valid()) return 0;
 
-  int nidx0[3], nidx1[3], nidx2[3];
-  mg->nid2nidx(f.nodes[0], nidx0);
-  mg->nid2nidx(f.nodes[1], nidx1);
-  mg->nid2nidx(f.nodes[2], nidx2);
-  // fprintf(stderr, "%d, %d, %d\n", f.nodes[0], f.nodes[1], f.nodes[2]);
-
   float X[nnodes][3], A[nnodes][3];
   float rho[nnodes], phi[nnodes], re[nnodes], im[nnodes];
   ds->GetFaceValues(f, slot, X, A, rho, phi, re, im);
@@ -1151,13 +1175,6 @@ int VortexExtractor::ExtractFace(FaceIdType id, int slot)
   }
 #endif
 
-#if 0
-  if (nidx0[0] == 255) {
-    fprintf(stderr, "%d, %d, %d, crossed=%d\n", nidx0[0], nidx1[0], nidx2[0], crossed);
-    fprintf(stderr, "%f, %f, %f\n", X[0][0], X[1][0], X[2][0]);
-  }
-#endif
-
   // calculating phase shift
   float delta[nnodes], phase_shift = 0;
   for (int i=0; i<nnodes; i++) {
@@ -1204,6 +1221,183 @@ int VortexExtractor::ExtractFace(FaceIdType id, int slot)
   return chirality;
 }
 
+static const int items_per_chunk = 4096;
+
+// contiguous chunks of [0, n) are handed out to the threads dynamically
+template <typename F>
+static void parallel_chunks(size_t n, int nthreads, const F& f)
+{
+  const size_t nchunks = (n + items_per_chunk - 1) / items_per_chunk;
+  nthreads = std::max(1, (int)std::min((size_t)nthreads, nchunks));
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t c = next++; c < nchunks; c = next++)
+      f(c*items_per_chunk, std::min(n, (c+1)*items_per_chunk));
+  };
+
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+}
+
+void VortexExtractor::FlattenMeshGraph(const MeshGraph *mg)
+{
+  if (_flat_mg == mg && _flat_mg_generation == _dataset->MeshGraphGeneration()) return;
+  _flat_mg = NULL;
+
+  const size_t nf = mg->NFaces(), ne = mg->NEdges();
+  const MeshGraphCSR *csr = dynamic_cast<const MeshGraphCSR*>(mg);
+  if (csr) {
+    const uint64_t *nodes_offsets = csr->Data<uint64_t>(MeshGraphCSR::FACE_NODES_OFFSETS),
+                   *edges_offsets = csr->Data<uint64_t>(MeshGraphCSR::FACE_EDGES_OFFSETS);
+    std::atomic<bool> triangles(true);
+    parallel_chunks(nf+1, _nthreads, [&](size_t i0, size_t i1) {
+      for (size_t i=i0; i<i1; i++)
+        if (nodes_offsets[i] != i*3 || edges_offsets[i] != i*3) {
+          triangles = false;
+          break;
+        }
+    });
+
+    if (triangles) {
+      _face_nodes = csr->Data<NodeIdType>(MeshGraphCSR::FACE_NODES);
+      _face_edges = csr->Data<EdgeIdType>(MeshGraphCSR::FACE_EDGES);
+      _face_edges_chirality = csr->Data<signed char>(MeshGraphCSR::FACE_EDGES_CHIRALITY);
+      _edge_nodes = csr->Data<NodeIdType>(MeshGraphCSR::EDGE_NODES);
+      _flat_mg = mg;
+      _flat_mg_generation = _dataset->MeshGraphGeneration();
+      return;
+    }
+  }
+
+  _face_nodes_buf.assign(nf*3, UINT_MAX);
+  _face_edges_buf.assign(nf*3, UINT_MAX);
+  _face_edges_chirality_buf.assign(nf*3, 0);
+  _edge_nodes_buf.resize(ne*2);
+
+  parallel_chunks(nf, _nthreads, [&](size_t i0, size_t i1) {
+    for (size_t i=i0; i<i1; i++) {
+      const CFace f = mg->Face(i);
+      if (f.nodes.size() != 3 || f.edges.size() != 3) continue;
+      for (int j=0; j<3; j++) {
+        _face_nodes_buf[i*3+j] = f.nodes[j];
+        _face_edges_buf[i*3+j] = f.edges[j];
+        _face_edges_chirality_buf[i*3+j] = f.edges_chirality[j];
+      }
+    }
+  });
+
+  parallel_chunks(ne, _nthreads, [&](size_t i0, size_t i1) {
+    for (size_t i=i0; i<i1; i++) {
+      const CEdge e = mg->Edge(i, true);
+      _edge_nodes_buf[i*2] = e.node0;
+      _edge_nodes_buf[i*2+1] = e.node1;
+    }
+  });
+
+  _face_nodes = _face_nodes_buf.data();
+  _face_edges = _face_edges_buf.data();
+  _face_edges_chirality = _face_edges_chirality_buf.data();
+  _edge_nodes = _edge_nodes_buf.data();
+  _flat_mg = mg;
+  _flat_mg_generation = _dataset->MeshGraphGeneration();
+}
+
+bool VortexExtractor::ExtractFacesUnstructured(int slot)
+{
+  const GLDataset *ds = (GLDataset*)_dataset;
+  const MeshGraph *mg = _dataset->MeshGraph();
+  const float *X = ds->PosDataArray(),
+              *rho = ds->RhoDataArray(slot),
+              *phi = ds->PhiDataArray(slot),
+              *A = ds->ADataArray(slot);
+  if (mg == NULL || mg->NEdges() == 0 || !X || !rho || !phi || !A)
+    return false; // implicit mesh graph or no flat arrays
+
+  FlattenMeshGraph(mg);
+
+  // phase increments along the edges, shared by the faces around them
+  const size_t ne = mg->NEdges();
+  _edge_delta.resize(ne);
+  parallel_chunks(ne, _nthreads, [&](size_t i0, size_t i1) {
+    for (size_t i=i0; i<i1; i++) {
+      const NodeIdType n0 = _edge_nodes[i*2], n1 = _edge_nodes[i*2+1];
+      const float *X0 = X + (size_t)n0*3, *X1 = X + (size_t)n1*3;
+      const float delta = phi[n1] - phi[n0],
+                  qp = ds->QP(X0, X1);
+      if (_gauge) {
+        const float li = ds->LineIntegral(X0, X1, A + (size_t)n0*3, A + (size_t)n1*3);
+        _edge_delta[i] = mod2pi1(delta - li + qp);
+      } else
+        _edge_delta[i] = mod2pi1(delta + qp);
+    }
+  });
+
+  parallel_chunks(mg->NFaces(), _nthreads, [&](size_t i0, size_t i1) {
+    for (size_t i=i0; i<i1; i++)
+      ExtractFaceUnstructured(i, slot, X, rho, phi);
+  });
+
+  return true;
+}
+
+void VortexExtractor::ExtractFaceUnstructured(FaceIdType id, int slot, const float *X_, const float *rho, const float *phi_)
+{
+  const NodeIdType *nodes = &_face_nodes[(size_t)id*3];
+  if (nodes[0] == UINT_MAX) return;
+
+  // phase shift from the cached edge increments
+  float delta[3], phase_shift = 0;
+  for (int i=0; i<3; i++) {
+    const float d = _edge_delta[_face_edges[(size_t)id*3+i]];
+    delta[i] = _face_edges_chirality[(size_t)id*3+i] > 0 ? d : -d;
+    phase_shift -= delta[i];
+  }
+
+  float critera = phase_shift / (2*M_PI);
+  if (fabs(critera)<0.5) return; // not punctured
+
+  ChiralityType chirality = critera>0 ? 1 : -1;
+
+  const GLHeader& hdr = _dataset->GetHeader(slot);
+  float X[3][3], phi[3], re[3], im[3];
+  for (int i=0; i<3; i++) {
+    for (int k=0; k<3; k++)
+      X[i][k] = X_[(size_t)nodes[i]*3+k];
+    phi[i] = phi_[nodes[i]];
+  }
+
+  // pbc
+  for (int i=1; i<3; i++) {
+    for (int k=0; k<3; k++) {
+      if (X[i][k] - X[0][k] < -hdr.lengths[k]/2)
+        X[i][k] += hdr.lengths[k];
+      else if (X[i][k] - X[0][k] > hdr.lengths[k]/2)
+        X[i][k] -= hdr.lengths[k];
+    }
+  }
+
+  // gauge transformation
+  for (int i=0; i<3; i++) {
+    if (_gauge && i!=0) phi[i] = phi[i-1] + delta[i-1];
+    re[i] = rho[nodes[i]] * cos(phi[i]);
+    im[i] = rho[nodes[i]] * sin(phi[i]);
+  }
+
+  // find zero
+  float pos[3];
+  float cond = 0.f;
+  if (!FindFaceZero(3, X, re, im, pos, cond)) {
+    fprintf(stderr, "WARNING: punctured but singularity not found.\n");
+    pos[0] = pos[1] = pos[2] = NAN;
+  }
+  AddPuncturedFace(id, slot, chirality, pos, cond);
+}
+
 void *VortexExtractor::execute_thread_helper(void *ctx_)
 {
   extractor_thread_t *ctx = (extractor_thread_t*)ctx_;
@@ -14,6 +14,7 @@
 
 class GLDataset;
 class GLDatasetBase;
+class MeshGraph;
 
 enum {
   INTERPOLATION_TRI_CENTER = 0x1,
@@ -40,6 +41,7 @@ public:
   void SetGPU(bool);
   void SetCond(bool); // extrat faces and return condition numbers
   void SetPertubation(float);
+  void SetKeepTransition(bool); // keep the matrices of TraceOverTime(); off if the caller collects them
   
   virtual void SetDataset(const GLDatasetBase* ds);
   const GLDataset* Dataset() const {return (GLDataset*)_dataset;}
@@ -88,6 +90,13 @@ public:
   void AddPuncturedEdge(EdgeIdType, ChiralityType chirality, float t);
 
 protected:
+  // faces of explicit mesh graphs, from the flat nodal arrays of the dataset
+  bool ExtractFacesUnstructured(int slot);
+  void FlattenMeshGraph(const MeshGraph *mg);
+  void ExtractFaceUnstructured(FaceIdType, int slot, const float *X, const float *rho, const float *phi);
+
+protected:
+  int NumberOfThreads() const {return _nthreads;}
   bool FindFaceZero(int n, const float X[][3], const float re[], const float im[], float pos[3], float &cond) const;
   bool FindSpaceTimeEdgeZero(const float re[], const float im[], float &t) const;
 
@@ -109,12 +118,28 @@ protected:
   bool _archive;
   bool _gpu;
   bool _cond;
+  bool _keep_transition;
   unsigned int _interpolation_mode;
   float _pertubation; // used for stochastic analysis
   float _extent_threshold;
 
   struct vfgpu_ctx_t *_vfgpu_ctx;
 
+  // flattened faces of the mesh graph (3 nodes and 3 edges each; UINT_MAX 
+  // nodes for invalid faces), and the phase increment along each edge 
+  // from node0 to node1, computed once per ExtractFaces().  The arrays of
+  // CSR mesh graphs of triangles are used in place; others are copied.  The
+  // flattening is redone when the dataset or its mesh graph changes.
+  const MeshGraph *_flat_mg;
+  unsigned int _flat_mg_generation; // of the dataset's mesh graph
+  const NodeIdType *_face_nodes, *_edge_nodes;
+  const EdgeIdType *_face_edges;
+  const signed char *_face_edges_chirality;
+  std::vector<NodeIdType> _face_nodes_buf, _edge_nodes_buf;
+  std::vector<EdgeIdType> _face_edges_buf;
+  std::vector<signed char> _face_edges_chirality_buf;
+  std::vector<float> _edge_delta;
+
 #if WITH_ROCKSDB
   rocksdb::DB *_db;
 #endif
@@ -1,10 +1,18 @@
 #include "StochasticExtractor.h"
 #include "vfgpu/vfgpu.h"
+#include "io/GLDataset.h"
+#include "common/MeshGraph.h"
+#include "common/Utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 StochasticVortexExtractor::StochasticVortexExtractor() :
   _nruns(256), 
   _kernel_size(0.5),
   _pertubation(0.04),
+  _seed(1234),
   _density(NULL)
 {
 
@@ -31,6 +39,11 @@ void StochasticVortexExtractor::SetPertubation(float p)
   _pertubation = p;
 }
 
+void StochasticVortexExtractor::SetSeed(uint64_t s)
+{
+  _seed = s;
+}
+
 void StochasticVortexExtractor::ExtractDeterministicVortices()
 {
   Clear();
@@ -70,3 +83,112 @@ void StochasticVortexExtractor::ExtractStochasticVortices()
   double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / 1000000000.0; 
   fprintf(stderr, "t_density=%f\n", elapsed);
 }
+
+// counter-based normal deviates: the perturbation of a node in a realization
+// is a function of (seed, realization, node) only, so that all faces around
+// the node see the same field, in any order and on any thread
+static inline uint64_t mix64(uint64_t x) // splitmix64 finalizer
+{
+  x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static inline void normal2(uint64_t seed, uint64_t run, uint64_t node, float sigma, float &n0, float &n1)
+{
+  const uint64_t h = mix64(mix64((node << 24) ^ run) ^ seed); // up to 2^24 runs
+  const float u0 = ((h >> 40) + 0.5f) / 16777216.f, 
+              u1 = ((h & 0xffffff) + 0.5f) / 16777216.f;
+  const float r = sigma * sqrt(-2.f * log(u0));
+  n0 = r * cos(2*M_PI*u1);
+  n1 = r * sin(2*M_PI*u1);
+}
+
+static const int runs_per_batch = 64;
+static const int faces_per_chunk = 1024;
+
+void StochasticVortexExtractor::EstimatePunctureProbabilities(int slot)
+{
+  const GLHeader& hdr = _dataset->GetHeader(slot);
+  const GLDataset *ds = (GLDataset*)_dataset;
+  const MeshGraph *mg = _dataset->MeshGraph();
+  const size_t nf = mg->NFaces();
+
+  _puncture_probabilities.assign(nf, 0.f);
+  _puncture_chiralities.assign(nf, 0.f);
+  if (_nruns <= 0) return;
+
+  typedef std::chrono::high_resolution_clock clock;
+  auto t0 = clock::now();
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t c = next++; c*faces_per_chunk < nf; c = next++) {
+      for (size_t id = c*faces_per_chunk; id < std::min(nf, (c+1)*faces_per_chunk); id++) {
+        const CFace f = mg->Face(id, true);
+        const int nnodes = f.nodes.size();
+        if (!f.Valid()) continue;
+
+        float X[nnodes][3], A[nnodes][3];
+        float rho[nnodes], phi[nnodes], re[nnodes], im[nnodes];
+        ds->GetFaceValues(f, slot, X, A, rho, phi, re, im);
+
+        // pbc
+        for (int i=1; i<nnodes; i++) {
+          for (int k=0; k<3; k++) {
+            if (X[i][k] - X[0][k] < -hdr.lengths[k]/2) 
+              X[i][k] += hdr.lengths[k];
+            else if (X[i][k] - X[0][k] > hdr.lengths[k]/2) 
+              X[i][k] -= hdr.lengths[k];
+          }
+        }
+
+        // the parts of the phase increments that do not depend on the realization
+        float offset[nnodes];
+        for (int i=0; i<nnodes; i++) {
+          const int j = (i+1) % nnodes;
+          const float qp = ds->QP(X[i], X[j], slot);
+          offset[i] = _gauge ? qp - ds->LineIntegral(X[i], X[j], A[i], A[j]) : qp;
+        }
+
+        // all realizations of the face, a batch at a time
+        int npositive = 0, nnegative = 0;
+        float phis[nnodes][runs_per_batch];
+        for (int r0=0; r0<_nruns; r0+=runs_per_batch) {
+          const int nr = std::min(runs_per_batch, _nruns - r0);
+          for (int i=0; i<nnodes; i++)
+            for (int r=0; r<nr; r++) {
+              float n0, n1;
+              normal2(_seed, r0+r, f.nodes[i], _pertubation, n0, n1);
+              phis[i][r] = atan2(im[i] + n1, re[i] + n0);
+            }
+
+          for (int r=0; r<nr; r++) {
+            float phase_shift = 0;
+            for (int i=0; i<nnodes; i++)
+              phase_shift -= mod2pi1(phis[(i+1)%nnodes][r] - phis[i][r] + offset[i]);
+            const float critera = phase_shift / (2*M_PI);
+            if (critera >= 0.5) npositive ++;
+            else if (critera <= -0.5) nnegative ++;
+          }
+        }
+
+        _puncture_probabilities[id] = (float)(npositive + nnegative) / _nruns;
+        _puncture_chiralities[id] = (float)(npositive - nnegative) / _nruns;
+      }
+    }
+  };
+
+  const int nthreads = std::max(1, (int)std::min((size_t)NumberOfThreads(), (nf + faces_per_chunk - 1) / faces_per_chunk));
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+
+  auto t1 = clock::now();
+  double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / 1000000000.0; 
+  fprintf(stderr, "t_ensemble=%f, #face=%zu, #run=%d\n", elapsed, nf, _nruns);
+}
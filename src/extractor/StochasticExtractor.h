@@ -2,6 +2,7 @@
 #define _STOCHASTIC_EXTRACTOR_H
 
 #include "Extractor.h"
+#include <stdint.h>
 
 class StochasticVortexExtractor : public VortexExtractor {
 public:
@@ -11,18 +12,29 @@ public:
   void SetNumberOfRuns(int);
   void SetKernelSize(float);
   void SetPertubation(float);
+  void SetSeed(uint64_t);
 
   void ExtractDeterministicVortices();
   void ExtractStochasticVortices();
 
+  // ensemble of _nruns realizations with N(0, pertubation^2) noise on the
+  // real and imaginary parts at each node, evaluated face by face without
+  // tracing: the fraction of realizations in which each face is punctured,
+  // and the mean chirality over all realizations
+  void EstimatePunctureProbabilities(int slot=0);
+  const std::vector<float>& PunctureProbabilities() const {return _puncture_probabilities;}
+  const std::vector<float>& PunctureChiralities() const {return _puncture_chiralities;}
+
   void EstimateDensities(int vid);
 
 private:
   int _nruns;
   float _kernel_size;
   float _pertubation;
+  uint64_t _seed;
 
   float *_density;
+  std::vector<float> _puncture_probabilities, _puncture_chiralities;
 };
 
 #endif
@@ -33,12 +33,22 @@ inline Vector<ndims> calc_center_tangent(Point<ndims> *pts, int center)
 	return ((v0 + v1) * 0.5).normalize();
 }
 
+// work is a caller-provided scratch buffer of 2*npts floats
 template <int ndims>
-int fit_curves(int npts, Point<ndims> *pts, float error_bound, Point<ndims> *curve, float &sum_error)
+int fit_curves(int npts, Point<ndims> *pts, float error_bound, Point<ndims> *curve, float &sum_error, float *work)
 {
 	Vector<ndims> t_hat1 = calc_left_tangent(pts, 0);
 	Vector<ndims> t_hat2 = calc_right_tangent(pts, npts - 1);
-	return fit_cubic(pts, 0, npts - 1, t_hat1, t_hat2, error_bound, curve, sum_error);
+	return fit_cubic(pts, 0, npts - 1, t_hat1, t_hat2, error_bound, curve, sum_error, work);
+}
+
+template <int ndims>
+int fit_curves(int npts, Point<ndims> *pts, float error_bound, Point<ndims> *curve, float &sum_error)
+{
+	float *work = (float *)malloc(2 * npts * sizeof(float));
+	int nctrlpts = fit_curves(npts, pts, error_bound, curve, sum_error, work);
+	free(work);
+	return nctrlpts;
 }
 
 template <int ndims>
@@ -52,9 +62,9 @@ void chord_length_parameterize(Point<ndims> *pts, int first, int last, float *u)
 }
 
 template <int ndims>
-Point<ndims> bezier(int deg, Point<ndims> *V, float t)
+Point<ndims> bezier(int deg, Point<ndims> *V, float t) // deg <= 3
 {
-	Point<ndims> *Vtemp = (Point<ndims> *)malloc((deg + 1) * sizeof(Point<ndims>));
+	Point<ndims> Vtemp[4];
 	for (int i = 0; i <= deg; ++i) Vtemp[i] = V[i];
 
 	for (int i = 1; i <= deg; ++i)
@@ -67,9 +77,7 @@ Point<ndims> bezier(int deg, Point<ndims> *V, float t)
 			}
 		}
 	}
-	Point<ndims> ret = Vtemp[0];
-	free(Vtemp);
-	return ret;
+	return Vtemp[0];
 }
 
 template <int ndims>
@@ -93,7 +101,7 @@ float calc_max_error(Point<ndims> *pts, int first, int last, Point<ndims> *curve
 }
 
 template <int ndims>
-int fit_cubic(Point<ndims> *pts, int first, int last, Vector<ndims> t_hat1, Vector<ndims> t_hat2, float error_bound, Point<ndims> *curve, float &sum_error)
+int fit_cubic(Point<ndims> *pts, int first, int last, Vector<ndims> t_hat1, Vector<ndims> t_hat2, float error_bound, Point<ndims> *curve, float &sum_error, float *work)
 {
 	int npts = last - first + 1;
 	if (npts == 2)
@@ -107,41 +115,33 @@ int fit_cubic(Point<ndims> *pts, int first, int last, Vector<ndims> t_hat1, Vect
 		return 4;
 	}
 
-	float *u = (float *)malloc(npts * sizeof(float));
+	// u and u_prime are released before recursing, so the subcurves reuse work
+	float *u = work, *u_prime = work + npts;
 	chord_length_parameterize(pts, first, last, u);
 	int nctrlpts = gen_bezier(pts, first, last, u, t_hat1, t_hat2, curve);
 	int split;
 	float max_error = calc_max_error(pts, first, last, curve, u, split, sum_error);
 	if (max_error < error_bound)
-	{
-		free(u);
 		return nctrlpts;
-	}
 
 	int max_n_iters = 4;
 	if (max_error < error_bound * error_bound)
 	{
 		for (int i = 0; i < max_n_iters; ++i)
 		{
-			float *u_prime = (float *)malloc(npts * sizeof(float));
 			reparameterize(pts, first, last, u, curve, u_prime);
 			nctrlpts = gen_bezier(pts, first, last, u_prime, t_hat1, t_hat2, curve);
 			max_error = calc_max_error(pts, first, last, curve, u_prime, split, sum_error);
-			free(u);
-			u = u_prime;
+			float *tmp = u; u = u_prime; u_prime = tmp;
 		}
 		if (max_error < error_bound)
-		{
-			free(u);
 			return nctrlpts;
-		}
 	}
-	free(u);
 
 	Vector<ndims> t_hat_center = calc_center_tangent(pts, split);
 	float serror1, serror2;
-	int nctrlpts0 = fit_cubic(pts, first, split, t_hat1, t_hat_center, error_bound, curve, serror1);
-	int nctrlpts1 = fit_cubic(pts, split, last, -t_hat_center, t_hat2, error_bound, curve + nctrlpts0, serror2);
+	int nctrlpts0 = fit_cubic(pts, first, split, t_hat1, t_hat_center, error_bound, curve, serror1, work);
+	int nctrlpts1 = fit_cubic(pts, split, last, -t_hat_center, t_hat2, error_bound, curve + nctrlpts0, serror2, work);
 	sum_error = serror1 + serror2;
 	return nctrlpts0 + nctrlpts1;
 }
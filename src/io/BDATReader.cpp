@@ -85,6 +85,7 @@ std::string BDATReader::ReadNextRecordInfo()
   Read(BDAT_UINT32, &recLen);
 
   recType = TypeID2RecType(typeID);
+  recOffset = ftello(fp);
 
   // fprintf(stderr, "recID=%d, recName=%s, recType=%s, recNum=%d, recLen=%d\n", 
   //     recID, recName.c_str(), RecType2String(recType).c_str(), recNum, recLen);
@@ -103,6 +104,24 @@ void BDATReader::ReadNextRecordData(std::string *buf)
   state = BDAT_STATE_HEADER;
 }
 
+bool BDATReader::ReadRecordDataRange(size_t offset, size_t length, void *buf)
+{
+  assert(state == BDAT_STATE_DATA);
+  if (!Valid() || offset + length > RecordDataSize()) return false;
+
+  if (fseeko(fp, recOffset + (off_t)offset, SEEK_SET) != 0) return false;
+  return fread(buf, 1, length, fp) == length;
+}
+
+void BDATReader::SkipNextRecordData()
+{
+  assert(state == BDAT_STATE_DATA);
+  if (!Valid()) return;
+
+  fseeko(fp, recOffset + (off_t)RecordDataSize(), SEEK_SET);
+  state = BDAT_STATE_HEADER;
+}
+
 bool BDATReader::Read(int typeName, void *val)
 {
   if (!Valid()) return false;
@@ -2,6 +2,8 @@
 #define _BDATREADER_H
 
 #include <string>
+#include <cstdio>
+#include <sys/types.h>
 
 class BDATReader {
   enum {
@@ -18,6 +20,12 @@ public:
   std::string ReadNextRecordInfo();
   void ReadNextRecordData(std::string *buf); //!< returns recType
 
+  // random access to the data of the current record, e.g. to read a 
+  // subvolume; call SkipNextRecordData() to move on to the next record
+  size_t RecordDataSize() const {return (size_t)recLen*recNum;}
+  bool ReadRecordDataRange(size_t offset, size_t length, void *buf);
+  void SkipNextRecordData();
+
   unsigned int RecType() const {return recType;}
   unsigned int RedID() const {return recID;}
   
@@ -32,6 +40,7 @@ private: // the state machine
   unsigned short recID;
   std::string recName; 
   unsigned int recType, recNum, recLen; 
+  off_t recOffset; // file offset of the current record's data
 
   int valid, state;
 };
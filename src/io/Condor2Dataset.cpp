@@ -1,9 +1,14 @@
 #include <cassert>
 #include <cfloat>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <libmesh/dof_map.h>
 #include "Condor2Dataset.h"
 #include "common/DataInfo.pb.h"
 #include "common/Utils.hpp"
+#include "common/MeshGraphCSR.h"
 
 using namespace libMesh;
 
@@ -11,8 +16,7 @@ Condor2Dataset::Condor2Dataset(const Parallel::Communicator &comm) :
   ParallelObject(comm), 
   _eqsys(NULL), 
   _exio(NULL), 
-  _mesh(NULL),
-  _locator(NULL)
+  _mesh(NULL)
 {
 }
 
@@ -20,7 +24,6 @@ Condor2Dataset::~Condor2Dataset()
 {
   if (_eqsys) delete _eqsys;
   if (_exio) delete _exio;
-  if (_locator) delete _locator;
   if (_mesh) delete _mesh;
 }
 
@@ -80,12 +83,12 @@ bool Condor2Dataset::OpenDataFile(const std::string& filename)
 
   _eqsys->init(); 
 
-  /// point locator
-  _locator = new PointLocatorTree(*_mesh);
-
   // it takes some time (~0.5s) to compute the bounding box. is there any better way to get this information?
   ProbeBoundingBox();
 
+  /// point locator
+  BuildLocator();
+
   _valid = true;
   return true; 
 }
@@ -107,8 +110,10 @@ void Condor2Dataset::BuildMeshGraph()
     return;
   }
 
-  _mg = new class MeshGraph;
-  MeshGraphBuilder_Tet *builder = new MeshGraphBuilder_Tet(mesh()->n_elem(), *_mg);
+  delete _mg; // left empty by LoadDefaultMeshGraph()
+  _mg = new MeshGraphCSR;
+  _mg_generation ++;
+  MeshGraphBuilder_TetParallel *builder = new MeshGraphBuilder_TetParallel(mesh()->n_elem(), *_mg);
   
   MeshBase::const_element_iterator it = mesh()->local_elements_begin(); 
   const MeshBase::const_element_iterator end = mesh()->local_elements_end(); 
@@ -135,6 +140,7 @@ void Condor2Dataset::BuildMeshGraph()
     builder->AddCell(e->id(), nodes, neighbors, faces);
   }
 
+  builder->Build();
   delete builder;
   
   fprintf(stderr, "mesh graph built..\n");
@@ -195,6 +201,9 @@ void Condor2Dataset::LoadTimeStep(int timestep, int slot)
     if (_ts1.get() != NULL) {
       _ts = _ts1;
       _as = _as1;
+      _rho[0].swap(_rho[1]);
+      _phi[0].swap(_phi[1]);
+      _A[0].swap(_A[1]);
     }
 
     _ts1 = _tsys->solution->clone();
@@ -203,9 +212,35 @@ void Condor2Dataset::LoadTimeStep(int timestep, int slot)
     GLDatasetBase::RotateTimeSteps();
   }
 
+  SnapshotTimeStep(slot);
   return true; // FIXME
 }
 
+void Condor2Dataset::SnapshotTimeStep(int slot)
+{
+  const NumericVector<Number> &ts = slot == 0 ? *_ts : *_ts1;
+  const NumericVector<Number> &as = slot == 0 ? *_as : *_as1;
+  const unsigned int tn = tsys()->number(), an = asys()->number();
+
+  const size_t nn = _mesh->max_node_id();
+  _rho[slot].resize(nn);
+  _phi[slot].resize(nn);
+  _A[slot].resize(nn*3);
+
+  MeshBase::const_node_iterator it = mesh()->nodes_begin(); 
+  const MeshBase::const_node_iterator end = mesh()->nodes_end();
+
+  for (; it != end; it++) {
+    const Node *node = *it;
+    const NodeIdType i = node->id();
+    _rho[slot][i] = ts( node->dof_number(tn, _rho_var, 0) );
+    _phi[slot][i] = ts( node->dof_number(tn, _phi_var, 0) );
+    _A[slot][i*3] = as( node->dof_number(an, _Ax_var, 0) );
+    _A[slot][i*3+1] = as( node->dof_number(an, _Ay_var, 0) );
+    _A[slot][i*3+2] = as( node->dof_number(an, _Az_var, 0) );
+  }
+}
+
 #if 0
 std::vector<ElemIdType> Condor2Dataset::GetNeighborIds(ElemIdType elem_id) const
 {
@@ -224,131 +259,329 @@ std::vector<ElemIdType> Condor2Dataset::GetNeighborIds(ElemIdType elem_id) const
 }
 #endif
 
-CellIdType Condor2Dataset::Pos2CellId(const float X[]) const
+static const int points_per_chunk = 4096;
+static const int max_walk_steps = 64;
+static const float lambda_eps = 1e-5f;
+
+// contiguous chunks of [0, n) are handed out to the threads dynamically
+template <typename F>
+static void parallel_chunks(int n, int nthreads, const F& f)
 {
-  Point p(X[0], X[1], X[2]);
-  
-  const Elem *e = (*_locator)(p);
-  if (e == NULL) return UINT_MAX;
-  else return e->id();
+  const int nchunks = (n + points_per_chunk - 1) / points_per_chunk;
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  nthreads = std::max(1, std::min(nthreads, nchunks));
+
+  std::atomic<int> next(0);
+  auto worker = [&]() {
+    for (int c = next++; c < nchunks; c = next++)
+      f(c*points_per_chunk, std::min(n, (c+1)*points_per_chunk));
+  };
+
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
 }
 
-bool Condor2Dataset::A(const float X[3], float A[3], int slot) const
+void Condor2Dataset::BuildLocator()
 {
-  Point p(X[0], X[1], X[2]);
+  const size_t nn = _mesh->max_node_id(), ne = _mesh->max_elem_id();
 
-  const Elem *e = (*_locator)(p);
-  if (e == NULL) return false;
+  _X.assign(nn*3, 0);
+  MeshBase::const_node_iterator nit = mesh()->nodes_begin();
+  const MeshBase::const_node_iterator nend = mesh()->nodes_end();
+  for (; nit != nend; nit++)
+    for (int k=0; k<3; k++)
+      _X[(*nit)->id()*3+k] = (**nit)(k);
 
-  A[0] = asys()->point_value(_Ax_var, p, e);
-  A[1] = asys()->point_value(_Ay_var, p, e);
-  A[2] = asys()->point_value(_Az_var, p, e);
+  // side i of a libMesh tet is opposite to node opposite[i]
+  static const int opposite[4] = {3, 2, 0, 1};
 
-  return true;
+  _tet_nodes.assign(ne*4, UINT_MAX);
+  _tet_neighbors.assign(ne*4, UINT_MAX);
+  _tet_inv.assign(ne*9, 0);
+
+  MeshBase::const_element_iterator it = mesh()->elements_begin();
+  const MeshBase::const_element_iterator end = mesh()->elements_end();
+  for (; it != end; it++) {
+    const Elem *e = *it;
+    if (e->dim() != 3 || e->n_vertices() != 4) continue;
+    const ElemIdType id = e->id();
+
+    double M[3][3]; // columns are the edges from node 0
+    const float *X0 = &_X[e->node(0)*3];
+    for (int j=0; j<3; j++)
+      for (int k=0; k<3; k++)
+        M[k][j] = _X[e->node(j+1)*3+k] - X0[k];
+
+    const double det =
+        M[0][0]*(M[1][1]*M[2][2] - M[1][2]*M[2][1])
+      - M[0][1]*(M[1][0]*M[2][2] - M[1][2]*M[2][0])
+      + M[0][2]*(M[1][0]*M[2][1] - M[1][1]*M[2][0]);
+    if (fabs(det) < DBL_MIN) continue; // degenerate, never contains a point
+
+    float *inv = &_tet_inv[id*9];
+    for (int r=0; r<3; r++)
+      for (int c=0; c<3; c++) {
+        // cofactor of M[c][r]
+        const int r0 = (c+1)%3, r1 = (c+2)%3, c0 = (r+1)%3, c1 = (r+2)%3;
+        inv[r*3+c] = (M[r0][c0]*M[r1][c1] - M[r0][c1]*M[r1][c0]) / det;
+      }
+
+    for (int i=0; i<4; i++) {
+      _tet_nodes[id*4+i] = e->node(i);
+      if (e->neighbor(i) != NULL)
+        _tet_neighbors[id*4+opposite[i]] = e->neighbor(i)->id();
+    }
+  }
+
+  // about one tet per bin
+  const float *L = Lengths();
+  const double volume = std::max(L[0], FLT_MIN) * std::max(L[1], FLT_MIN) * std::max(L[2], FLT_MIN);
+  const double h = cbrt(volume / std::max(ne, (size_t)1));
+  for (int k=0; k<3; k++) {
+    _bin_dims[k] = std::max(1, std::min(1024, (int)ceil(L[k] / h)));
+    _bin_origins[k] = Origins()[k];
+    _bin_lengths[k] = std::max(L[k], FLT_MIN) / _bin_dims[k];
+  }
+
+  // the tets are binned by their bounding boxes: counted first, then filled
+  const int nbins = _bin_dims[0] * _bin_dims[1] * _bin_dims[2];
+  std::vector<int> bin_range((size_t)ne*6, 0);
+  _bin_offsets.assign(nbins+1, 0);
+
+  for (int pass=0; pass<2; pass++) {
+    std::vector<int> fill(_bin_offsets.begin(), _bin_offsets.end()-1);
+    for (ElemIdType e=0; e<ne; e++) {
+      const NodeIdType *n = &_tet_nodes[e*4];
+      if (n[0] == UINT_MAX) continue;
+
+      int *b = &bin_range[e*6];
+      if (pass == 0) {
+        for (int k=0; k<3; k++) {
+          float lo = FLT_MAX, hi = -FLT_MAX;
+          for (int i=0; i<4; i++) {
+            lo = std::min(lo, _X[n[i]*3+k]);
+            hi = std::max(hi, _X[n[i]*3+k]);
+          }
+          b[k] = std::max(0, std::min(_bin_dims[k]-1, (int)((lo - _bin_origins[k]) / _bin_lengths[k])));
+          b[k+3] = std::max(0, std::min(_bin_dims[k]-1, (int)((hi - _bin_origins[k]) / _bin_lengths[k])));
+        }
+      }
+
+      for (int z=b[2]; z<=b[5]; z++)
+        for (int y=b[1]; y<=b[4]; y++)
+          for (int x=b[0]; x<=b[3]; x++) {
+            const int bin = x + _bin_dims[0] * (y + _bin_dims[1] * z);
+            if (pass == 0) _bin_offsets[bin+1] ++;
+            else _bin_elems[fill[bin]++] = e;
+          }
+    }
+
+    if (pass == 0) {
+      for (int i=0; i<nbins; i++)
+        _bin_offsets[i+1] += _bin_offsets[i];
+      _bin_elems.resize(_bin_offsets[nbins]);
+    }
+  }
 }
 
-bool Condor2Dataset::A(NodeIdType, float A[3], int slot) const
+bool Condor2Dataset::Barycentric(ElemIdType e, const float X[3], float lambda[4]) const
 {
-  // TODO
-  return false;
+  const NodeIdType n0 = _tet_nodes[e*4];
+  if (n0 == UINT_MAX) return false;
+
+  const float *X0 = &_X[n0*3], *inv = &_tet_inv[e*9];
+  const float d[3] = {X[0] - X0[0], X[1] - X0[1], X[2] - X0[2]};
+  for (int r=0; r<3; r++)
+    lambda[r+1] = inv[r*3]*d[0] + inv[r*3+1]*d[1] + inv[r*3+2]*d[2];
+  lambda[0] = 1 - lambda[1] - lambda[2] - lambda[3];
+  return true;
 }
 
-bool Condor2Dataset::Pos(NodeIdType, float X[3]) const
+ElemIdType Condor2Dataset::LocateElem(const float X[3], ElemIdType hint, float lambda[4]) const
 {
-  // TODO
-  return false;
+  // walk from the hint through the face opposite to the most negative
+  // barycentric coordinate, until the point is inside or the walk leaves
+  // the mesh
+  ElemIdType e = hint;
+  for (int step=0; e != UINT_MAX && step < max_walk_steps; step ++) {
+    if (!Barycentric(e, X, lambda)) break;
+    const int m = std::min_element(lambda, lambda+4) - lambda;
+    if (lambda[m] >= -lambda_eps) return e;
+    e = _tet_neighbors[e*4+m];
+  }
+
+  // candidates in the bin of the point
+  int b[3];
+  for (int k=0; k<3; k++) {
+    const float g = (X[k] - _bin_origins[k]) / _bin_lengths[k];
+    if (!(g >= 0 && g <= _bin_dims[k])) return UINT_MAX; // also false for NaNs
+    b[k] = std::min((int)g, _bin_dims[k]-1);
+  }
+  const int bin = b[0] + _bin_dims[0] * (b[1] + _bin_dims[1] * b[2]);
+
+  for (int i=_bin_offsets[bin]; i<_bin_offsets[bin+1]; i++) {
+    e = _bin_elems[i];
+    if (Barycentric(e, X, lambda) && *std::min_element(lambda, lambda+4) >= -lambda_eps)
+      return e;
+  }
+  return UINT_MAX;
 }
 
-#if 0
-bool Condor2Dataset::Psi(const float X[3], float &re, float &im, int slot) const
+void Condor2Dataset::InterpolateElem(ElemIdType e, const float lambda[4], int slot,
+    float *rho, float *phi, float *A, float *J) const
 {
-  if (X[0] < Origins()[0] || X[0] > Origins()[0] + Lengths()[0] ||
-      X[1] < Origins()[1] || X[1] > Origins()[1] + Lengths()[1] || 
-      X[2] < Origins()[2] || X[2] > Origins()[2] + Lengths()[2])
-    return false;
-  
-  Point p(X[0], X[1], X[2]);
-  const Elem *e = (*_locator)(p);
-  if (e == NULL) return false;
+  const NodeIdType *n = &_tet_nodes[e*4];
+  const std::vector<float> &R = _rho[slot], &P = _phi[slot], &AA = _A[slot];
+
+  // the phase is unwrapped around the first node
+  const float dphi[4] = {0,
+    mod2pi1(P[n[1]] - P[n[0]]),
+    mod2pi1(P[n[2]] - P[n[0]]),
+    mod2pi1(P[n[3]] - P[n[0]])};
+
+  float r = 0, p = 0, a[3] = {0};
+  for (int i=0; i<4; i++) {
+    r += lambda[i] * R[n[i]];
+    p += lambda[i] * dphi[i];
+    for (int k=0; k<3; k++)
+      a[k] += lambda[i] * AA[n[i]*3+k];
+  }
 
-  re = tsys()->point_value(_u_var, p, e);
-  im = tsys()->point_value(_v_var, p, e);
+  if (rho) *rho = r;
+  if (phi) *phi = mod2pi1(P[n[0]] + p);
+  if (A) {
+    A[0] = a[0]; A[1] = a[1]; A[2] = a[2];
+  }
+  if (J) {
+    // the gradients of the barycentric coordinates are the rows of the
+    // inverse, so that the phase gradient is constant in the tet
+    const float *inv = &_tet_inv[e*9];
+    for (int k=0; k<3; k++) {
+      const float gphi = dphi[1]*inv[k] + dphi[2]*inv[3+k] + dphi[3]*inv[6+k];
+      J[k] = r*r * (gphi - a[k]);
+    }
+  }
+}
 
-  return true;
+int Condor2Dataset::LocateElems(int n, const float *X, ElemIdType *elems, int nthreads) const
+{
+  std::atomic<int> count(0);
+  parallel_chunks(n, nthreads, [&](int i0, int i1) {
+    ElemIdType hint = UINT_MAX;
+    float lambda[4];
+    int c = 0;
+    for (int i=i0; i<i1; i++) {
+      elems[i] = LocateElem(X+i*3, hint, lambda);
+      if (elems[i] != UINT_MAX) {
+        hint = elems[i];
+        c ++;
+      }
+    }
+    count += c;
+  });
+  return count;
 }
-#endif
 
-bool Condor2Dataset::Supercurrent(NodeIdType, float J[3], int slot) const
+int Condor2Dataset::Interpolate(int n, const float *X, int slot, unsigned char *valid,
+    float *rho, float *phi, float *A, float *J, int nthreads) const
 {
-  // TODO
-  return false;
+  if (_rho[slot].empty()) { // time step not loaded
+    if (valid) std::fill(valid, valid+n, 0);
+    return 0;
+  }
+
+  std::atomic<int> count(0);
+  parallel_chunks(n, nthreads, [&](int i0, int i1) {
+    ElemIdType hint = UINT_MAX;
+    float lambda[4];
+    int c = 0;
+    for (int i=i0; i<i1; i++) {
+      const ElemIdType e = LocateElem(X+i*3, hint, lambda);
+      if (valid) valid[i] = e != UINT_MAX;
+      if (e == UINT_MAX) continue;
+
+      InterpolateElem(e, lambda, slot,
+          rho ? rho+i : NULL, phi ? phi+i : NULL,
+          A ? A+i*3 : NULL, J ? J+i*3 : NULL);
+      hint = e;
+      c ++;
+    }
+    count += c;
+  });
+  return count;
 }
 
-bool Condor2Dataset::Supercurrent(const float X[3], float J[3], int slot) const
+int Condor2Dataset::SupercurrentBatch(int n, const float *X, float *J, unsigned char *valid, CellIdType *cells, int slot) const
 {
-  return false;
-#if 0
-  Point p(X[0], X[1], X[2]);
+  if (_rho[slot].empty()) {
+    std::fill(valid, valid+n, 0);
+    return 0;
+  }
 
-  const Elem *e = (*_locator)(p);
-  if (e == NULL) return false;
+  int count = 0;
+  float lambda[4];
+  for (int i=0; i<n; i++) {
+    const ElemIdType e = LocateElem(X+i*3, cells ? cells[i] : UINT_MAX, lambda);
+    valid[i] = e != UINT_MAX;
+    if (e == UINT_MAX) continue;
 
-  NumberVectorValue A;
-  A(0) = asys()->point_value(_Ax_var, p, e);
-  A(1) = asys()->point_value(_Ay_var, p, e);
-  A(2) = asys()->point_value(_Az_var, p, e);
+    InterpolateElem(e, lambda, slot, NULL, NULL, NULL, J+i*3);
+    if (cells) cells[i] = e;
+    count ++;
+  }
+  return count;
+}
 
-  float rho, phi;
-  Gradient du, dv;
+CellIdType Condor2Dataset::Pos2CellId(const float X[]) const
+{
+  float lambda[4];
+  return LocateElem(X, UINT_MAX, lambda);
+}
 
-  rho = tsys()->point_value(_u_var, p, e);
-  phi = tsys()->point_value(_v_var, p, e);
-  du = tsys()->point_gradient(_u_var, p, e);
-  dv = tsys()->point_gradient(_v_var, p, e);
+bool Condor2Dataset::A(const float X[3], float A[3], int slot) const
+{
+  return Interpolate(1, X, slot, NULL, NULL, NULL, A, NULL, 1) > 0;
+}
 
-  float amp = sqrt(u*u + v*v);
+bool Condor2Dataset::A(NodeIdType i, float A[3], int slot) const
+{
+  if (i >= _A[slot].size()/3) return false;
+  for (int k=0; k<3; k++)
+    A[k] = _A[slot][i*3+k];
+  return true;
+}
 
-  NumberVectorValue Js = (u*dv - v*du)/amp - A;
+bool Condor2Dataset::Pos(NodeIdType i, float X[3]) const
+{
+  if (i >= _X.size()/3) return false;
+  for (int k=0; k<3; k++)
+    X[k] = _X[i*3+k];
+  return true;
+}
 
-  J[0] = Js(0);
-  J[1] = Js(1);
-  J[2] = Js(2);
+bool Condor2Dataset::Psi(const float X[3], float &re, float &im, int slot) const
+{
+  float rho, phi;
+  if (Interpolate(1, X, slot, NULL, &rho, &phi, NULL, NULL, 1) == 0) return false;
 
+  re = rho * cos(phi);
+  im = rho * sin(phi);
   return true;
-#endif
 }
- 
-const Elem* Condor2Dataset::LocateElemCoherently(const float X[3]) const
+
+bool Condor2Dataset::Supercurrent(NodeIdType, float J[3], int slot) const
 {
-  static const Elem* e_last = NULL;
-  
-  if (X[0] < Origins()[0] || X[0] > Origins()[0] + Lengths()[0] ||
-      X[1] < Origins()[1] || X[1] > Origins()[1] + Lengths()[1] || 
-      X[2] < Origins()[2] || X[2] > Origins()[2] + Lengths()[2])
-    return NULL;
-  
-  Point p(X[0], X[1], X[2]);
+  // TODO
+  return false;
+}
 
-  /// check if p is inside last queried element or neighbors
-  if (e_last != NULL) {
-    if (e_last->contains_point(p)) {
-      // fprintf(stderr, "hit last.\n");
-      return e_last;
-    }
-    else {
-      for (int i=0; i<e_last->n_neighbors(); i++) {
-        const Elem* e = e_last->neighbor(i);
-        if (e != NULL && e->contains_point(p)) {
-          // fprintf(stderr, "hit last neighbor.\n");
-          e_last = e;
-          return e;
-        }
-      }
-    }
-  }
-  
-  e_last = (*_locator)(p);
-  return e_last;
+bool Condor2Dataset::Supercurrent(const float X[3], float J[3], int slot) const
+{
+  return Interpolate(1, X, slot, NULL, NULL, NULL, NULL, J, 1) > 0;
 }
 
 bool Condor2Dataset::OnBoundary(ElemIdType id) const
@@ -521,14 +754,12 @@ void Condor2Dataset::GetSpaceTimeEdgeValues(const CEdge& e, float X[][3], float
   phi[3] = ts1( node0.dof_number(tsys()->number(), _phi_var, 0) );
 }
 
-float Condor2Dataset::Rho(NodeIdType, int) const
+float Condor2Dataset::Rho(NodeIdType i, int slot) const
 {
-  // TODO
-  assert(false);
+  return _rho[slot][i];
 }
 
-float Condor2Dataset::Phi(NodeIdType, int) const
+float Condor2Dataset::Phi(NodeIdType i, int slot) const
 {
-  // TODO
-  assert(false);
+  return _phi[slot][i];
 }
@@ -7,8 +7,8 @@
 #include <libmesh/numeric_vector.h>
 #include <libmesh/equation_systems.h>
 #include <libmesh/nonlinear_implicit_system.h>
-#include <libmesh/point_locator_tree.h>
 #include <libmesh/exodusII_io.h>
+#include <vector>
 #include "GLDataset.h"
 
 class Condor2Dataset : public libMesh::ParallelObject, public GLDataset
@@ -57,6 +57,12 @@ public:
   float Phi(NodeIdType, int slot) const;
 
   bool Pos(NodeIdType, float X[3]) const;
+
+  const float* PosDataArray() const {return _X.empty() ? NULL : _X.data();}
+  const float* RhoDataArray(int slot=0) const {return _rho[slot].empty() ? NULL : _rho[slot].data();}
+  const float* PhiDataArray(int slot=0) const {return _phi[slot].empty() ? NULL : _phi[slot].data();}
+  const float* ADataArray(int slot=0) const {return _A[slot].empty() ? NULL : _A[slot].data();}
+
   bool Psi(const float X[3], float &re, float &im, int slot) const;
   // bool Psi(NodeIdType, float &re, float &im, int slot) const;
   bool A(const float X[3], float A[3], int slot) const;
@@ -64,12 +70,33 @@ public:
   bool Supercurrent(const float X[3], float J[3], int slot) const;
   bool Supercurrent(NodeIdType, float J[3], int slot) const;
 
+  int SupercurrentBatch(int n, const float *X, float *J, unsigned char *valid, CellIdType *cells, int slot=0) const;
+  bool ConcurrentQueries() const {return true;}
+
+public: // thread-safe batch queries
+  // elements that contain the n positions (interleaved), UINT_MAX for the 
+  // points outside the mesh; returns the number of points located.  Points 
+  // are split into contiguous chunks for the threads (nthreads=0 for all 
+  // cores), and each point is searched from the element of the previous one.
+  int LocateElems(int n, const float *X, ElemIdType *elems, int nthreads=0) const;
+
+  // linear interpolation of the fields at the n positions in one pass; any 
+  // of the outputs may be NULL.  A and J are interleaved, and the values of 
+  // the points outside the mesh are left untouched.
+  int Interpolate(int n, const float *X, int slot, unsigned char *valid, 
+      float *rho, float *phi, float *A, float *J, int nthreads=0) const;
+
 private: 
   void ProbeBoundingBox();
   void LoadTimeStep_(int timestep);
+  void SnapshotTimeStep(int slot);
 
-private:
-  const libMesh::Elem* LocateElemCoherently(const float X[3]) const; // not thread-safe
+private: // point location
+  void BuildLocator();
+  bool Barycentric(ElemIdType e, const float X[3], float lambda[4]) const;
+  ElemIdType LocateElem(const float X[3], ElemIdType hint, float lambda[4]) const;
+  void InterpolateElem(ElemIdType e, const float lambda[4], int slot, 
+      float *rho, float *phi, float *A, float *J) const;
 
 private:
   libMesh::UnstructuredMesh *_mesh;
@@ -77,7 +104,6 @@ private:
   libMesh::EquationSystems *_eqsys;
   libMesh::NonlinearImplicitSystem *_tsys;
   libMesh::System *_asys;
-  libMesh::PointLocatorTree *_locator;
 
   unsigned int _rho_var, _phi_var;
   unsigned int _Ax_var, _Ay_var, _Az_var;
@@ -85,6 +111,25 @@ private:
 
   libMesh::AutoPtr<libMesh::NumericVector<libMesh::Number> > _ts, _ts1;
   libMesh::AutoPtr<libMesh::NumericVector<libMesh::Number> > _as, _as1;
+
+  // nodal values of the loaded time steps, indexed by node id
+  std::vector<float> _rho[2], _phi[2], _A[2]; // A is interleaved
+
+  // tets of the mesh for point location: node positions, the nodes of each 
+  // tet, the neighbor opposite to each node (UINT_MAX on the boundary), and 
+  // the inverse of [X1-X0, X2-X0, X3-X0] that maps positions to barycentric 
+  // coordinates
+  std::vector<float> _X;
+  std::vector<NodeIdType> _tet_nodes;
+  std::vector<ElemIdType> _tet_neighbors;
+  std::vector<float> _tet_inv;
+
+  // uniform bins over the bounding boxes of the tets, searched when there 
+  // is no hint or the walk from the hint leaves the mesh
+  int _bin_dims[3];
+  float _bin_origins[3], _bin_lengths[3];
+  std::vector<int> _bin_offsets;
+  std::vector<ElemIdType> _bin_elems;
 }; 
 
 #endif
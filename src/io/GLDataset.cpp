@@ -54,6 +54,16 @@ float GLDataset::QP(const float X0[], const float X1[], int slot) const
   return 0.0;
 }
 
+int GLDataset::SupercurrentBatch(int n, const float *X, float *J, unsigned char *valid, CellIdType * /*cells*/, int slot) const
+{
+  int count = 0;
+  for (int i=0; i<n; i++) {
+    valid[i] = Supercurrent(X+i*3, J+i*3, slot);
+    if (valid[i]) count ++;
+  }
+  return count;
+}
+
 #if 0
 bool GLDataset::Rho(const float X[3], float &rho, int slot) const
 {
@@ -55,6 +55,13 @@ public: // properties
   // Positions 
   virtual bool Pos(NodeIdType, float X[3]) const = 0;
 
+  // Nodal values in flat arrays indexed by node id (positions and A are 
+  // interleaved), or NULL if the dataset does not keep them
+  virtual const float* PosDataArray() const {return NULL;}
+  virtual const float* RhoDataArray(int /*slot*/=0) const {return NULL;}
+  virtual const float* PhiDataArray(int /*slot*/=0) const {return NULL;}
+  virtual const float* ADataArray(int /*slot*/=0) const {return NULL;}
+
   // Order parameters (direct access/linear interpolation)
   bool Rho(const float X[3], float &rho, int slot=0) const;
   bool Phi(const float X[3], float &phi, int slot=0) const;
@@ -76,6 +83,14 @@ public: // properties
   virtual bool Supercurrent(const float X[3], float J[3], int slot=0) const = 0;
   virtual bool Supercurrent(NodeIdType, float J[3], int slot) const = 0;
 
+  // Supercurrent at n positions (interleaved); valid[i] tells if X[i] is in 
+  // the domain.  The search for point i starts from cells[i] (UINT_MAX if 
+  // unknown), which is updated with the cell found, so that callers walking 
+  // along a curve keep the search local.  Concurrent calls are safe only if 
+  // ConcurrentQueries() is true.
+  virtual int SupercurrentBatch(int n, const float *X, float *J, unsigned char *valid, CellIdType *cells, int slot=0) const;
+  virtual bool ConcurrentQueries() const {return false;}
+
 protected:
   std::vector<float> _time_stamps; 
   bool _valid;
@@ -1,8 +1,10 @@
 #include "GLDatasetBase.h"
 #include "common/MeshGraph.h"
+#include "common/MeshGraphCSR.h"
+#include <cstdio>
 
 GLDatasetBase::GLDatasetBase() :
-  _mg(NULL)
+  _mg(NULL), _mg_generation(0)
 {
 }
 
@@ -48,7 +50,20 @@ bool GLDatasetBase::LoadDefaultMeshGraph()
 
 bool GLDatasetBase::LoadMeshGraph(const std::string& filename)
 {
-  return _mg->ParseFromFile(filename);
+  if (!MeshGraphCSR::IsCSRFile(filename)) { // protobuf mesh graphs of earlier versions
+    _mg_generation ++;
+    return _mg->ParseFromFile(filename);
+  }
+
+  MeshGraphCSR *mg = new MeshGraphCSR;
+  if (!mg->MapFile(filename)) {
+    delete mg;
+    return false;
+  }
+  delete _mg;
+  _mg = mg;
+  _mg_generation ++;
+  return true;
 }
 
 void GLDatasetBase::SaveDefaultMeshGraph()
@@ -58,6 +73,9 @@ void GLDatasetBase::SaveDefaultMeshGraph()
 
 void GLDatasetBase::SaveMeshGraph(const std::string& filename)
 {
-  _mg->SerializeToFile(filename);
+  const MeshGraphCSR *csr = dynamic_cast<const MeshGraphCSR*>(_mg);
+  const bool succ = csr ? csr->WriteToFile(filename) : MeshGraphCSR(*_mg).WriteToFile(filename);
+  if (!succ)
+    fprintf(stderr, "cannot write the mesh graph to %s\n", filename.c_str());
 }
 
@@ -33,9 +33,11 @@ public:
   void SaveDefaultMeshGraph();
 
   const struct MeshGraph* MeshGraph() const {return _mg;}
+  unsigned int MeshGraphGeneration() const {return _mg_generation;} // changes whenever the mesh graph does
 
 protected: 
   struct MeshGraph *_mg;
+  unsigned int _mg_generation;
   std::string _data_name;
   GLHeader _h[2];
   int _timestep[2];
@@ -17,6 +17,7 @@ void GLGPU2DDataset::BuildMeshGraph()
 {
   if (_mg != NULL) delete _mg;
   _mg = new MeshGraphRegular2D(_h[0].dims, _h[0].pbc);
+  _mg_generation ++;
 }
 
 CellIdType GLGPU2DDataset::Pos2CellId(const float X[]) const
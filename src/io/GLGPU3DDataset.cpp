@@ -28,11 +28,13 @@ void GLGPU3DDataset::SetMeshType(int t)
 
 void GLGPU3DDataset::BuildMeshGraph()
 {
+  if (_mg != NULL) delete _mg;
   if (_mesh_type == GLGPU3D_MESH_TET)
     _mg = new class MeshGraphRegular3DTets(_h[0].dims, _h[0].pbc);
   else if (_mesh_type == GLGPU3D_MESH_HEX)
     _mg = new class MeshGraphRegular3D(_h[0].dims, _h[0].pbc);
   else assert(false);
+  _mg_generation ++;
 }
 
 std::vector<FaceIdType> GLGPU3DDataset::GetBoundaryFaceIds(int type) const
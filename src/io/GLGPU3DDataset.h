@@ -42,7 +42,7 @@ public: // data access
   bool Supercurrent(const float X[3], float J[3], int slot=0) const;
 
 private:
-  bool _mesh_type;
+  int _mesh_type;
 }; 
 
 #endif
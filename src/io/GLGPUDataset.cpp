@@ -34,19 +34,29 @@ GLGPUDataset::GLGPUDataset()
   memset(_Jx, 0, sizeof(float*)*2);
   memset(_Jy, 0, sizeof(float*)*2);
   memset(_Jz, 0, sizeof(float*)*2);
+  _external[0] = _external[1] = false;
 }
 
 GLGPUDataset::~GLGPUDataset()
 {
-  for (int i=0; i<2; i++) {
-    free1(&_rho[i]);
-    free1(&_phi[i]);
-    free1(&_re[i]);
-    free1(&_im[i]);
-    free1(&_Jx[i]);
-    free1(&_Jy[i]);
-    free1(&_Jz[i]);
+  for (int i=0; i<2; i++) 
+    FreeDataArrays(i);
+}
+
+void GLGPUDataset::FreeDataArrays(int slot)
+{
+  if (_external[slot]) { // owned by the caller
+    _rho[slot] = _phi[slot] = _re[slot] = _im[slot] = NULL;
+    _external[slot] = false;
+  } else {
+    free1(&_rho[slot]);
+    free1(&_phi[slot]);
+    free1(&_re[slot]);
+    free1(&_im[slot]);
   }
+  free1(&_Jx[slot]);
+  free1(&_Jy[slot]);
+  free1(&_Jz[slot]);
 }
 
 void GLGPUDataset::PrintInfo(int slot) const
@@ -175,6 +185,7 @@ void GLGPUDataset::GetDataArray(GLHeader& h, float **rho, float **phi, float **r
 
 bool GLGPUDataset::BuildDataFromArray(const GLHeader& h, const float *rho, const float *phi, const float *re, const float *im)
 {
+  FreeDataArrays(0);
   memcpy(&_h[0], &h, sizeof(GLHeader));
 
   const int count = h.dims[0]*h.dims[1]*h.dims[2];
@@ -192,6 +203,23 @@ bool GLGPUDataset::BuildDataFromArray(const GLHeader& h, const float *rho, const
   return true;
 }
 
+bool GLGPUDataset::WrapDataArray(const GLHeader& h, const float *rho, const float *phi, const float *re, const float *im, int slot)
+{
+  if (re == NULL || im == NULL) return false;
+
+  FreeDataArrays(slot);
+  memcpy(&_h[slot], &h, sizeof(GLHeader));
+
+  // the dataset never writes to the order parameter arrays
+  _rho[slot] = const_cast<float*>(rho);
+  _phi[slot] = const_cast<float*>(phi);
+  _re[slot] = const_cast<float*>(re);
+  _im[slot] = const_cast<float*>(im);
+  _external[slot] = true;
+
+  return true;
+}
+
 #if 0
 void GLGPUDataset::ModulateKex(int slot)
 {
@@ -225,6 +253,7 @@ void GLGPUDataset::RotateTimeSteps()
   std::swap(_Jx[0], _Jx[1]);
   std::swap(_Jy[0], _Jy[1]);
   std::swap(_Jz[0], _Jz[1]);
+  std::swap(_external[0], _external[1]);
 
   GLDataset::RotateTimeSteps();
 }
@@ -234,13 +263,7 @@ bool GLGPUDataset::OpenLegacyDataFile(const std::string& filename, int slot)
   int ndims;
   _h[slot].dtype = DTYPE_CA02;
 
-  free1(&_rho[slot]); 
-  free1(&_phi[slot]); 
-  free1(&_re[slot]); 
-  free1(&_im[slot]);
-  free1(&_Jx[slot]);
-  free1(&_Jy[slot]);
-  free1(&_Jz[slot]);
+  FreeDataArrays(slot);
 
   if (!::GLGPU_IO_Helper_ReadLegacy(
         filename, _h[slot], &_rho[slot], &_phi[slot], &_re[slot], &_im[slot], &_Jx[slot], &_Jy[slot], &_Jz[slot], false, _precompute_supercurrent))
@@ -272,13 +295,7 @@ bool GLGPUDataset::OpenBDATDataFile(const std::string& filename, int slot)
   int ndims;
   _h[slot].dtype = DTYPE_BDAT;
   
-  free1(&_rho[slot]); 
-  free1(&_phi[slot]); 
-  free1(&_re[slot]); 
-  free1(&_im[slot]); 
-  free1(&_Jx[slot]);
-  free1(&_Jy[slot]);
-  free1(&_Jz[slot]);
+  FreeDataArrays(slot);
 
   if (!::GLGPU_IO_Helper_ReadBDAT(
         filename, _h[slot], &_rho[slot], &_phi[slot], &_re[slot], &_im[slot], &_Jx[slot], &_Jy[slot], &_Jz[slot], false, _precompute_supercurrent))
@@ -398,10 +415,15 @@ bool GLGPUDataset::Supercurrent(const float X[2], float J[3], int slot) const
   return false;
 }
 
-bool GLGPUDataset::Supercurrent(NodeIdType, float J[3], int slot) const
+bool GLGPUDataset::Supercurrent(NodeIdType id, float J[3], int slot) const
 {
-  // TODO
-  return false;
+  if (_Jx[slot] == NULL || _Jy[slot] == NULL || _Jz[slot] == NULL) 
+    return false; // not precomputed
+
+  J[0] = _Jx[slot][id];
+  J[1] = _Jy[slot][id];
+  J[2] = _Jz[slot][id];
+  return true;
 }
 
 #if 0
@@ -25,12 +25,20 @@ public:
   void PrintInfo(int slot=0) const;
 
   bool BuildDataFromArray(const GLHeader&, const float *rho, const float *phi, const float *re, const float *im);
+  // zero-copy variant; the arrays are referenced, not owned, and must stay 
+  // valid until they are replaced or the dataset is destroyed
+  bool WrapDataArray(const GLHeader&, const float *rho, const float *phi, const float *re, const float *im, int slot=0);
   void GetDataArray(GLHeader& h, float **rho, float **phi, float **re, float **im, float **J, int slot=0);
-  // float *GetSupercurrentDataArray() const {return _J[0];} // FIXME
+  const float* ReDataArray(int slot=0) const {return _re[slot];}
+  const float* ImDataArray(int slot=0) const {return _im[slot];}
+  const float* SupercurrentDataArray(int dim, int slot=0) const { // NULL unless precomputed
+    return dim == 0 ? _Jx[slot] : (dim == 1 ? _Jy[slot] : _Jz[slot]);
+  }
   
 private:
   bool OpenBDATDataFile(const std::string& filename, int slot=0);
   bool OpenLegacyDataFile(const std::string& filename, int slot=0);
+  void FreeDataArrays(int slot);
 
   // void ComputeSupercurrentField(int slot=0);
 
@@ -81,6 +89,7 @@ public:
 protected:
   float *_rho[2], *_phi[2], *_re[2], *_im[2];
   float *_Jx[2], *_Jy[2], *_Jz[2]; // supercurrent
+  bool _external[2]; // rho/phi/re/im of the slot are owned by the caller
 
   std::vector<std::string> _filenames; // filenames for different timesteps
 };
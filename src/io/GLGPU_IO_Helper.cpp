@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #if WITH_LIBMESH || WITH_NETCDF
 #include <netcdf.h>
@@ -24,9 +25,69 @@ enum {
 static const int GLGPU_LEGACY_TAG_SIZE = 4;
 static const char GLGPU_LEGACY_TAG[] = "CA02";
 
-bool GLGPU_IO_Helper_ReadBDAT(
+enum { // storage of the order parameter
+  GLGPU_PSI_RE_IM = 0, 
+  GLGPU_PSI_RHO_PHI = 1, 
+  GLGPU_PSI_RHO2_PHI = 2
+};
+
+// reads the subvolume ext (inclusive node index bounds) of the interleaved 
+// complex field; read(first, count, buf) fetches count floats starting at 
+// float offset first.  The rows of each plane are fetched as one span.
+template <typename Read>
+static bool read_psi_extent(Read read, const GLHeader& h, const int ext[6], int psitype, 
+    float **rho, float **phi, float **re, float **im)
+{
+  for (int i=0; i<3; i++) 
+    if (ext[i*2] < 0 || ext[i*2] > ext[i*2+1] || ext[i*2+1] >= h.dims[i]) 
+      return false;
+
+  const int nx = ext[1] - ext[0] + 1, 
+            ny = ext[3] - ext[2] + 1, 
+            nz = ext[5] - ext[4] + 1;
+  const size_t count = (size_t)nx*ny*nz;
+
+  *rho = (float*)malloc(sizeof(float)*count);
+  *phi = (float*)malloc(sizeof(float)*count);
+  *re = (float*)malloc(sizeof(float)*count);
+  *im = (float*)malloc(sizeof(float)*count);
+
+  std::vector<float> buf;
+  for (int k=0; k<nz; k++) {
+    const size_t first = ((size_t)(ext[4]+k)*h.dims[1] + ext[2])*h.dims[0] + ext[0], 
+                 last = ((size_t)(ext[4]+k)*h.dims[1] + ext[3])*h.dims[0] + ext[1];
+    buf.resize((last - first + 1)*2);
+    if (!read(first*2, buf.size(), buf.data())) {
+      free(*rho); free(*phi); free(*re); free(*im);
+      *rho = *phi = *re = *im = NULL;
+      return false;
+    }
+
+    for (int j=0; j<ny; j++) 
+      for (int i=0; i<nx; i++) {
+        const float *p = &buf[((size_t)j*h.dims[0] + i)*2];
+        const size_t idx = ((size_t)k*ny + j)*nx + i;
+        if (psitype == GLGPU_PSI_RE_IM) {
+          (*rho)[idx] = sqrt(p[0]*p[0] + p[1]*p[1]);
+          (*phi)[idx] = atan2(p[1], p[0]);
+          (*re)[idx] = p[0];
+          (*im)[idx] = p[1];
+        } else {
+          const float Rho = psitype == GLGPU_PSI_RHO2_PHI ? sqrt(p[0]) : p[0], Phi = p[1];
+          (*rho)[idx] = Rho;
+          (*phi)[idx] = Phi;
+          (*re)[idx] = Rho * cos(Phi);
+          (*im)[idx] = Rho * sin(Phi);
+        }
+      }
+  }
+
+  return true;
+}
+
+static bool read_bdat(
     const std::string& filename, 
-    GLHeader &h,
+    GLHeader &h, const int *extent,
     float **rho, float **phi, float **re, float **im, float **Jx, float **Jy, float **Jz,
     bool header_only, bool supercurrent)
 {
@@ -45,11 +106,24 @@ bool GLGPU_IO_Helper_ReadBDAT(
                  recID = reader->RedID(); 
     float f; // temp var
 
-    if (name != "psi")
-      reader->ReadNextRecordData(&buf);
-    else if (!header_only)
-      reader->ReadNextRecordData(&buf);
-    else break;
+    if (name == "psi" && header_only) 
+      break;
+    else if (name == "psi" && extent != NULL) { // seek to the needed slabs only
+      assert(type == BDAT_FLOAT);
+      const int psitype = recID == 2000 ? GLGPU_PSI_RE_IM : GLGPU_PSI_RHO2_PHI;
+      bool succ = read_psi_extent(
+          [reader](size_t first, size_t count, float *p) {
+            return reader->ReadRecordDataRange(first*sizeof(float), count*sizeof(float), p);
+          }, h, extent, psitype, rho, phi, re, im);
+      if (!succ) {
+        delete reader;
+        return false;
+      }
+      reader->SkipNextRecordData();
+      continue;
+    }
+    
+    reader->ReadNextRecordData(&buf);
     void *p = (void*)buf.data();
 
     if (name == "dim") {
@@ -174,9 +248,26 @@ bool GLGPU_IO_Helper_ReadBDAT(
   return true;
 }
 
-bool GLGPU_IO_Helper_ReadLegacy(
+bool GLGPU_IO_Helper_ReadBDAT(
     const std::string& filename, 
-    GLHeader& h,
+    GLHeader &h,
+    float **rho, float **phi, float **re, float **im, float **Jx, float **Jy, float **Jz,
+    bool header_only, bool supercurrent)
+{
+  return read_bdat(filename, h, NULL, rho, phi, re, im, Jx, Jy, Jz, header_only, supercurrent);
+}
+
+bool GLGPU_IO_Helper_ReadBDAT(
+    const std::string& filename, 
+    GLHeader &h, const int extent[6], 
+    float **rho, float **phi, float **re, float **im)
+{
+  return read_bdat(filename, h, extent, rho, phi, re, im, NULL, NULL, NULL, false, false);
+}
+
+static bool read_legacy(
+    const std::string& filename, 
+    GLHeader& h, const int *extent, 
     float **rho, float **phi, float **re, float **im, float **Jx, float **Jy, float **Jz,
     bool header_only, bool supercurrent)
 {
@@ -285,7 +376,18 @@ bool GLGPU_IO_Helper_ReadLegacy(
   for (int i=0; i<h.ndims; i++) 
     count *= h.dims[i]; 
 
-  int offset = ftell(fp);
+  const off_t offset = ftello(fp);
+
+  if (extent != NULL) { // seek to the needed slabs only
+    assert(datatype == GLGPU_TYPE_FLOAT);
+    bool succ = read_psi_extent(
+        [fp, offset](size_t first, size_t count, float *p) {
+          return fseeko(fp, offset + (off_t)(first*sizeof(float)), SEEK_SET) == 0
+            && fread(p, sizeof(float), count, fp) == count;
+        }, h, extent, optype == 0 ? GLGPU_PSI_RE_IM : GLGPU_PSI_RHO_PHI, rho, phi, re, im);
+    fclose(fp);
+    return succ;
+  }
 
   // mem allocation 
   *rho = (float*)malloc(sizeof(float)*count);
@@ -330,6 +432,23 @@ bool GLGPU_IO_Helper_ReadLegacy(
   return true;
 }
 
+bool GLGPU_IO_Helper_ReadLegacy(
+    const std::string& filename, 
+    GLHeader& h,
+    float **rho, float **phi, float **re, float **im, float **Jx, float **Jy, float **Jz,
+    bool header_only, bool supercurrent)
+{
+  return read_legacy(filename, h, NULL, rho, phi, re, im, Jx, Jy, Jz, header_only, supercurrent);
+}
+
+bool GLGPU_IO_Helper_ReadLegacy(
+    const std::string& filename, 
+    GLHeader& h, const int extent[6], 
+    float **rho, float **phi, float **re, float **im)
+{
+  return read_legacy(filename, h, extent, rho, phi, re, im, NULL, NULL, NULL, false, false);
+}
+
 bool GLGPU_IO_Helper_WriteRaw_rho_phi(
     const std::string& filename_rho, 
     const std::string& filename_phi, 
@@ -430,24 +549,14 @@ void GLGPU_IO_Helper_ComputeSupercurrent(
   pp->By = h.B[1]; 
   pp->Bz = h.B[2];
   pp->KEx = h.Kex;
-  pp->psi = (COMPLEX*)malloc(sizeof(COMPLEX)*arraySize);
-  for (int i=0; i<arraySize; i++) {
-    pp->psi[i].re = re[i];
-    pp->psi[i].im = im[i];
-  }
-
-  pp->calc_current();
-  assert(pp->Jx != NULL);
 
   *Jx = (float*)malloc(sizeof(float)*arraySize);
   *Jy = (float*)malloc(sizeof(float)*arraySize);
   *Jz = (float*)malloc(sizeof(float)*arraySize);
 
-  for (int i=0; i<arraySize; i++) {
-    (*Jx)[i] = pp->Jx[i];
-    (*Jy)[i] = pp->Jy[i];
-    (*Jz)[i] = pp->Jz[i];
-  }
+  // reads re/im in place and writes single precision directly
+  const int res = pp->calc_current(re, im, 1, *Jx, *Jy, *Jz, 1);
+  assert(res == 0);
 
   delete pp;
 }
@@ -16,6 +16,18 @@ bool GLGPU_IO_Helper_ReadLegacy(
     float **rho, float **phi, float **re, float **im, float **Jx, float **Jy, float **Jz,
     bool header_only=false, bool supercurrent=false);
 
+// read the subvolume extent={i0, i1, j0, j1, k0, k1} (inclusive node index 
+// bounds) only; hdr still describes the whole domain
+bool GLGPU_IO_Helper_ReadBDAT(
+    const std::string& filename, 
+    GLHeader &hdr, const int extent[6], 
+    float **rho, float **phi, float **re, float **im);
+
+bool GLGPU_IO_Helper_ReadLegacy(
+    const std::string& filename, 
+    GLHeader &hdr, const int extent[6], 
+    float **rho, float **phi, float **re, float **im);
+
 void GLGPU_IO_Helper_ComputeSupercurrent(
     GLHeader &h, const float *re, const float *im, float **Jx, float **Jy, float **Jz);
 
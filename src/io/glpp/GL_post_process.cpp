@@ -12,6 +12,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
+#include <atomic>
+#include <thread>
 
 #include "paramfile.h"
 #include "fileutils.h"
@@ -169,15 +172,8 @@ int GLPP::calc_vector_pot_kappa_inf() {
 
 //---------------------------------------------------------------------------
 
-int GLPP::calc_current(double *gradsq,bool calcnormal) { // uses the vector potential if present, Note: the term $\partial_t {\tilde A}$ is not calculated for the normal part
-    int i,j,k,idx,m,p,lp,lm,bc;
-    double x,y,v,dx2i,dy2i,dz2i;
-    COMPLEX z,zm,zp,U,UK,zd,QP;
-    unsigned int gauge,Bcomp;
-    
-    if(Jx!=NULL) return -1; //if a supercurrent is already present it is not recalculated
-    if(psi==NULL) return -2; //without order parameter, we cannot calculate the supercurrent
-    
+int GLPP::current_gauge(unsigned int &gauge) {
+    unsigned int Bcomp;
     
     Bcomp=0;
     gauge=0;
@@ -192,282 +188,276 @@ int GLPP::calc_current(double *gradsq,bool calcnormal) { // uses the vector pote
     else gauge=16; //use the vector potential
     
     if((gauge<16) && (kappa<5e5)) return -3; //for finite kappa, we need the vector potential, other wise Js cannot be calculated
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+
+int GLPP::calc_current(double *gradsq,bool calcnormal) { // uses the vector potential if present, Note: the term $\partial_t {\tilde A}$ is not calculated for the normal part
+    int res;
+    unsigned int gauge;
+    
+    if(Jx!=NULL) return -1; //if a supercurrent is already present it is not recalculated
+    if(psi==NULL) return -2; //without order parameter, we cannot calculate the supercurrent
+    res=current_gauge(gauge);
+    if(res!=0) return res;
     
     Jx=new double[NN];
     Jy=new double[NN];
     if(dim==3) Jz=new double[NN];
     
+    return calc_current(Jx,Jy,Jz,gradsq,calcnormal);
+}
+
+//---------------------------------------------------------------------------
+// multithreaded supercurrent calculation
+//
+// Each direction is computed row by row (fixed j,k).  Rows with constant
+// neighbor offsets go through glpp_current_run, whose inner loop has no
+// boundary branches; only the end points of x-rows and the boundary rows/
+// planes of y/z with quasi-periodic corrections take the per-node path.
+// Rows are processed in blocks of j (all k for a block) so that the
+// neighboring rows are still in cache when they are reused.
+//---------------------------------------------------------------------------
+
+//zp*U and zm*U^*, same operation order as the original code
+static inline void glpp_link(COMPLEX &zp,COMPLEX &zm,double ur,double ui) {
+    double x;
+    x=zp.re;zp.re=ur*x-ui*zp.im;zp.im=ur*zp.im+ui*x;
+    x=zm.re;zm.re=ur*x+ui*zm.im;zm.im=ur*zm.im-ui*x;
+}
+
+//order parameter sources of calc_current_impl
+struct glpp_psi_complex {
+    const COMPLEX *p;
+    COMPLEX operator[](int i) const {return p[i];}
+};
+
+struct glpp_psi_strided { //single precision re & im arrays owned by the caller
+    const float *re,*im;
+    int stride;
+    COMPLEX operator[](int i) const {
+        COMPLEX z;
+        z.re=re[(size_t)i*stride];
+        z.im=im[(size_t)i*stride];
+        return z;
+    }
+};
+
+//Im(psi^*(x+iy)) with the "UK" factor (1 for y,z), gradient term in g
+static inline double glpp_im(const COMPLEX &z,const COMPLEX &zp,const COMPLEX &zm,double ukre,double ukim,double &g) {
+    double x,y;
+    x=ukre*(zp.re-zm.re)-ukim*(zp.im+zm.im);
+    y=ukre*(zp.im-zm.im)+ukim*(zp.re+zm.re);
+    g=x*x+y*y;
+    return z.re*y-z.im*x;
+}
+
+//n nodes starting at c, with neighbors starting at p and m
+template <typename T,typename S>
+static void glpp_current_run(int n,const S &psi,int c,int p,int m,
+                             const double *ure,const double *uim,int us,double ukre,double ukim,
+                             const double *mup,const double *mum,double scale,T *J,int js,double *gradsq,bool addgrad) {
+    for(int i=0;i<n;i++) {
+        COMPLEX zp=psi[p+i],zm=psi[m+i];
+        double v,g;
+        glpp_link(zp,zm,ure[i*us],uim[i*us]);
+        v=glpp_im(psi[c+i],zp,zm,ukre,ukim,g);
+        if(mup!=NULL) v+=(mum[i]-mup[i]);
+        if(gradsq!=NULL) {
+            if(addgrad) gradsq[i]+=g;
+            else gradsq[i]=g;
+        }
+        J[i*js]=(T)(scale*v);
+    }
+}
+
+//complex multiplication by exp(i*phase) (conj: by exp(-i*phase))
+static inline void glpp_qp(COMPLEX &z,double phase,bool conj) {
+    double x,qre=cos(phase),qim=sin(phase);
+    if(conj) {x=z.re;z.re=z.re*qre+z.im*qim;z.im=z.im*qre-x*qim;}
+    else {x=z.re;z.re=z.re*qre-z.im*qim;z.im=z.im*qre+x*qim;}
+}
+
+template <typename T>
+int GLPP::calc_current(T *jx,T *jy,T *jz,double *gradsq,bool calcnormal,int nthreads) {
+    if(psi==NULL) return -2;
+    glpp_psi_complex src={psi};
+    return calc_current_impl(src,jx,jy,jz,1,gradsq,calcnormal,nthreads);
+}
+
+template <typename T>
+int GLPP::calc_current(const float *re,const float *im,int psistride,T *jx,T *jy,T *jz,int jstride,double *gradsq,bool calcnormal,int nthreads) {
+    if((re==NULL) || (im==NULL)) return -2;
+    glpp_psi_strided src={re,im,psistride};
+    return calc_current_impl(src,jx,jy,jz,jstride,gradsq,calcnormal,nthreads);
+}
+
+template <typename T,typename S>
+int GLPP::calc_current_impl(const S &psi,T *jx,T *jy,T *jz,int js,double *gradsq,bool calcnormal,int nthreads) {
+    int res;
+    unsigned int gauge;
     
-    dx2i=1/(2*dx);
-    dy2i=1/(2*dy);
-    dz2i=1/(2*dz*zaniso);
-    
+    res=current_gauge(gauge);
+    if(res!=0) return res;
+    if((jx==NULL) || (jy==NULL) || ((dim==3) && (jz==NULL))) return -4;
     if(calcnormal && (mu==NULL)) calcnormal=false; //we cannot calculate the normal part w/o the vector potential
     
-    //"K-LV"
-    x=dx*KEx;
-    UK.re=cos(x);UK.im=sin(x);
+    const int nz=(dim==3)?Nz:1;
+    const int bcx=(btype&0xFF),bcy=((btype>>8)&0xFF),bcz=((btype>>16)&0xFF);
+    const double dx2i=1/(2*dx),dy2i=1/(2*dy),dz2i=1/(2*dz*zaniso);
+    const double ukre=cos(dx*KEx),ukim=sin(dx*KEx); //"K-LV"
+    const double one=1.0,zero=0.0;
+    
+    //link variables of the LV gauges that only depend on i
+    std::vector<double> uyre(Nx,1.0),uyim(Nx,0.0),uzre(Nx,1.0),uzim(Nx,0.0);
+    if(gauge<2) {
+        for(int i=0;i<Nx;i++) {
+            double x=-(i-0.5*Nx)*dx*Bz*dy;
+            uyre[i]=cos(x);uyim[i]=sin(x);
+            x=(i-0.5*Nx)*dx*By*dz;
+            uzre[i]=cos(x);uzim[i]=sin(x);
+        }
+    }
     
-    if(dim==3) {
-        for(k=0;k<Nz;k++) {
-            for(j=0;j<Ny;j++) {
-                for(i=0;i<Nx;i++) {
-                    idx=i+Nx*(j+Ny*k);
-                    z=psi[idx];
-                    
-                    
-                    //---- x-direction
-                    bc=(btype&0xFF);  //x-boundary condition (0 - no current \partial_x\psi=0 & \partial_x\mu=0, 1 - periodic)
-                    
-                    if((bc==0) && ((i==0) || (i==(Nx-1)))) Jx[idx]=0;  //definition of the no current condition
-                    else {
-                        lp=i+1;if(lp==Nx) lp=0; //the no-current case is already handled
-                        lm=i-1;if(lm<0) lm=Nx-1;
-                        m=lm+Nx*(j+k*Ny);
-                        p=lp+Nx*(j+k*Ny);
-                        zp=psi[p];zm=psi[m];
-                        
-                        if((gauge==0) || (gauge==1)) { //no LV, except the "UK" factor needed
-                            //nothing to do
-                        } else if(gauge==2) { //here we use QP-BC
-                            //modify the zp & zm terms
-                            y=(j-0.5*Ny)*dy*Bz*dx;
-                            U.re=cos(y);
-                            U.im=sin(y);
-                            x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                            x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                            
-                            if(bc==1) {//quasi boundary conditions, we assume that the fields are multiples of the flux quantum
-                                if(i==0) { //modify zm by QP
-                                    x=(k*dz*By-j*dy*By)*Lx;
-                                    QP.re=cos(x);
-                                    QP.im=sin(x);
-                                    x=zm.re;zm.re=zm.re*QP.re-zm.im*QP.im;zm.im=zm.im*QP.re+x*QP.im;
-                                }
-                                else if(i==(Nx-1)) { //modify zp by QP*
-                                    x=(k*dz*By-j*dy*By)*Lx;
-                                    QP.re=cos(x);
-                                    QP.im=sin(x);
-                                    x=zp.re;zp.re=zp.re*QP.re+zp.im*QP.im;zp.im=zp.im*QP.re-x*QP.im;
-                                }
-                            }
-                        } else {//general case, here we use a periodic A, no QP-BC
-                            y=-0.5*dx*(Ax[p]+Ax[m]);
-                            U.re=cos(y);
-                            U.im=sin(y);
-                            x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                            x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                        }
-                        //apply UK
-                        x=UK.re*(zp.re-zm.re)-UK.im*(zp.im+zm.im);
-                        y=UK.re*(zp.im-zm.im)+UK.im*(zp.re+zm.re);
-                        //calc Im(psi^(x+iy))
-                        v=z.re*y-z.im*x;
-                        if(calcnormal) v+=(mu[m]-mu[p]);
-                        if(gradsq!=NULL) gradsq[idx]=x*x+y*y; //energy value of the gradient term
-                        Jx[idx]=dx2i*v;
-                    }
-                    
-                    
-                    
-                    //---- y-direction
-                    bc=((btype>>8)&0xFF); //y-boundary condition (0 - no current \partial_y\psi=0 & \partial_y\mu=0, 1 - quasi-periodic)
-                    
-                    if((bc==0) && ((j==0) || (j==(Ny-1)))) Jy[idx]=0;  //definition of the no current condition
-                    else {
-                        lp=j+1;if(lp==Ny) lp=0;
-                        lm=j-1;if(lm<0) lm=Ny-1;
-                        m=i+Nx*(lm+k*Ny);
-                        p=i+Nx*(lp+k*Ny);
-                        zp=psi[p];
-                        zm=psi[m];
-                        
-                        if((gauge==0) || (gauge==1)) {//LV
-                            x=-(i-0.5*Nx)*dx*Bz*dy;
-                            U.re=cos(x);
-                            U.im=sin(x);
-                            x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                            x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                        } else if(gauge==2) {//QPBC
-                            if((bc==1) && (j==0)) { //affects zm by QP
-                                y=(i*dx*Bz-k*dz*Bx)*Ly;
-                                QP.re=cos(y);
-                                QP.im=sin(y);
-                                x=zm.re;zm.re=zm.re*QP.re-zm.im*QP.im;zm.im=zm.im*QP.re+x*QP.im;
-                            }
-                            else if((bc==1) && (j==(Ny-1))) { //affects zp by QP*
-                                y=(i*dx*Bz-k*dz*Bx)*Ly;
-                                QP.re=cos(y);
-                                QP.im=sin(y);
-                                x=zp.re;zp.re=zp.re*QP.re+zp.im*QP.im;zp.im=zp.im*QP.re-x*QP.im;
-                            }
-                        } else {//general case, here we use a periodic A, no QP-BC
-                            y=-0.5*dy*(Ay[p]+Ay[m]);
-                            U.re=cos(y);
-                            U.im=sin(y);
-                            x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                            x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                        }
-                        x=zp.re-zm.re;
-                        y=zp.im-zm.im;
-                        v=z.re*y-z.im*x;
-                        if(calcnormal) v+=(mu[m]-mu[p]);
-                        if(gradsq!=NULL) gradsq[idx]+=(x*x+y*y);
-                        Jy[idx]=dy2i*v;
-                        
-                    }
-                    
-                    //---- z-direction
-                    if(dim>2) {
-                        bc=((btype>>16)&0xFF); //z-boundary condition (0 - no current, 1 - periodic)
-                        
-                        if((bc==0) && ((k==0) || (k==(Nz-1)))) Jz[idx]=0;  //definition of the no current condition
-                        else {
-                            lp=k+1;if(lp==Nz)  lp=0;
-                            lm=k-1;if(lm<0) lm=Nz-1;
-                            m=i+Nx*(j+lm*Ny);
-                            p=i+Nx*(j+lp*Ny);
-                            zp=psi[p];
-                            zm=psi[m];
-                            
-                            if((gauge==0) || (gauge==1)) {//LV
-                                x=(i-0.5*Nx)*dx*By*dz;
-                                U.re=cos(x);
-                                U.im=sin(x);
-                            } else if(gauge==2) {//LV
-                                y=-(j-0.5*Ny)*dy*Bx*dz;
-                                U.re=cos(y);
-                                U.im=sin(y);
-                            } else {//general case, here we use a periodic A, no QP-BC
-                                y=-0.5*dz*(Az[p]+Az[m]);
-                                U.re=cos(y);
-                                U.im=sin(y);
-                            }
-                            x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                            x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                            x=zp.re-zm.re;
-                            y=zp.im-zm.im;
-                            v=z.re*y-z.im*x;
-                            if(calcnormal) v+=(mu[m]-mu[p]);
-                            if(gradsq!=NULL) gradsq[idx]+=(x*x+y*y);
-                            Jz[idx]=dz2i*v;
-                        }
-                    }
-                }
+    //blocks of rows; roughly three planes of a j-block fit in L2
+    const int jb=MAX(1,MIN(Ny,(int)(256*1024/(3*sizeof(COMPLEX)*Nx))));
+    const int kb=32;
+    const int njb=(Ny+jb-1)/jb,nkb=(nz+kb-1)/kb;
+    const int nblocks=njb*nkb;
+    
+    if(nthreads<=0) nthreads=std::thread::hardware_concurrency();
+    nthreads=MAX(1,MIN(nthreads,nblocks));
+    
+    auto row=[&](int j,int k,std::vector<double> &ure,std::vector<double> &uim) {
+        const int c=Nx*(j+Ny*k);
+        T *Jx=jx+(size_t)c*js,*Jy=jy+(size_t)c*js,*Jz=(dim==3)?jz+(size_t)c*js:NULL;
+        double *g=(gradsq!=NULL)?gradsq+c:NULL;
+        double ur,ui,gv,v;
+        const double *pre,*pim;
+        int us;
+        
+        //---- x-direction
+        if(gauge==16) {
+            for(int i=0;i<Nx;i++) {
+                int lp=i+1,lm=i-1;
+                if(lp==Nx) lp=0;
+                if(lm<0) lm=Nx-1;
+                double y=-0.5*dx*(Ax[c+lp]+Ax[c+lm]);
+                ure[i]=cos(y);uim[i]=sin(y);
             }
+            pre=&ure[0];pim=&uim[0];us=1;
+        } else {
+            if(gauge==2) {double y=(j-0.5*Ny)*dy*Bz*dx;ur=cos(y);ui=sin(y);}
+            else {ur=one;ui=zero;}
+            pre=&ur;pim=&ui;us=0;
         }
-    }
-    else if(dim==2) {
         
-        for(j=0;j<Ny;j++) {
-            for(i=0;i<Nx;i++) {
-                idx=i+Nx*j;
-                z=psi[idx];
-                
-                //---- x-direction
-                bc=(btype&0xFF);  //x-boundary condition (0 - no current \partial_x\psi=0 & \partial_x\mu=0, 1 - periodic)
-                
-                if((bc==0) && ((i==0) || (i==(Nx-1)))) Jx[idx]=0.0;  //definition of the no current condition
-                else {
-                    lp=i+1;if(lp==Nx) lp=0; //the no-current case is already handled
-                    lm=i-1;if(lm<0) lm=Nx-1;
-                    m=lm+Nx*(j+k*Ny);
-                    p=lp+Nx*(j+k*Ny);
-                    zp=psi[p];zm=psi[m];
-                    
-                    if((gauge==0) || (gauge==1)) { //no LV, except the "UK" factor needed
-                        //nothing to do
-                    } else if(gauge==2) { //here we use QP-BC
-                        //modify the zp & zm terms
-                        y=(j-0.5*Ny)*dy*Bz*dx;
-                        U.re=cos(y);
-                        U.im=sin(y);
-                        x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                        x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                        //boundary conditions
-                        if(bc==1) {//quasi boundary conditions, we assume that the fields are multiples of the flux quantum
-                            if(i==0) { //modify zm by QP
-                                x=(k*dz*By-j*dy*By)*Lx;
-                                QP.re=cos(x);
-                                QP.im=sin(x);
-                                x=zm.re;zm.re=zm.re*QP.re-zm.im*QP.im;zm.im=zm.im*QP.re+x*QP.im;
-                            }
-                            else if(i==(Nx-1)) { //modify zp by QP*
-                                x=(k*dz*By-j*dy*By)*Lx;
-                                QP.re=cos(x);
-                                QP.im=sin(x);
-                                x=zp.re;zp.re=zp.re*QP.re+zp.im*QP.im;zp.im=zp.im*QP.re-x*QP.im;
-                            }
-                        }
-                    } else {//general case, here we use a periodic A, no QP-BC, not valid for 2D really
-                        y=-0.5*dx*(Ax[p]+Ax[m]);
-                        U.re=cos(y);
-                        U.im=sin(y);
-                        x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                        x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                    }
-                    //apply UK
-                    x=UK.re*(zp.re-zm.re)-UK.im*(zp.im+zm.im);
-                    y=UK.re*(zp.im-zm.im)+UK.im*(zp.re+zm.re);
-                    //calc Im(psi^(x+iy))
-                    v=z.re*y-z.im*x;
-                    if(calcnormal) v+=(mu[m]-mu[p]);
-                    if(gradsq!=NULL) gradsq[idx]=(x*x+y*y);
-                    Jx[idx]=dx2i*v;
+        if(Nx>2)
+            glpp_current_run(Nx-2,psi,c+1,c+2,c,pre+us,pim+us,us,ukre,ukim,
+                             calcnormal?mu+c+2:NULL,calcnormal?mu+c:NULL,dx2i,Jx+js,js,g?g+1:NULL,false);
+        
+        for(int i=0;i<Nx;i+=MAX(1,Nx-1)) { //end points
+            if(bcx==0) { //no current
+                Jx[i*js]=0;
+                if(g!=NULL) g[i]=0;
+                continue;
+            }
+            int lp=i+1,lm=i-1;
+            if(lp==Nx) lp=0;
+            if(lm<0) lm=Nx-1;
+            COMPLEX zp=psi[c+lp],zm=psi[c+lm];
+            glpp_link(zp,zm,pre[i*us],pim[i*us]);
+            if((gauge==2) && (bcx==1)) { //quasi boundary conditions
+                double x=(k*dz*By-j*dy*By)*Lx;
+                if(i==0) glpp_qp(zm,x,false);
+                else glpp_qp(zp,x,true);
+            }
+            v=glpp_im(psi[c+i],zp,zm,ukre,ukim,gv);
+            if(calcnormal) v+=(mu[c+lm]-mu[c+lp]);
+            if(g!=NULL) g[i]=gv;
+            Jx[i*js]=(T)(dx2i*v);
+        }
+        
+        //---- y-direction
+        if((bcy==0) && ((j==0) || (j==(Ny-1)))) { //no current
+            for(int i=0;i<Nx;i++) Jy[i*js]=0;
+        } else {
+            const int p=Nx*((j==Ny-1?0:j+1)+Ny*k),m=Nx*((j==0?Ny-1:j-1)+Ny*k);
+            if(gauge<2) {pre=&uyre[0];pim=&uyim[0];us=1;}
+            else if(gauge==2) {pre=&one;pim=&zero;us=0;}
+            else {
+                for(int i=0;i<Nx;i++) {
+                    double y=-0.5*dy*(Ay[p+i]+Ay[m+i]);
+                    ure[i]=cos(y);uim[i]=sin(y);
                 }
-                
-                
-                
-                //---- y-direction
-                bc=((btype>>8)&0xFF); //y-boundary condition (0 - no current \partial_y\psi=0 & \partial_y\mu=0, 1 - quasi-periodic)
-                
-                if((bc==0) && ((j==0) || (j==(Ny-1)))) Jy[idx]=0;  //definition of the no current condition
-                else {
-                    lp=j+1;if(lp==Ny) lp=0;
-                    lm=j-1;if(lm<0) lm=Ny-1;
-                    m=i+Nx*(lm+k*Ny);
-                    p=i+Nx*(lp+k*Ny);
-                    zp=psi[p];
-                    zm=psi[m];
-                    
-                    if((gauge==0) || (gauge==1)) {//LV
-                        x=-(i-0.5*Nx)*dx*Bz*dy;
-                        U.re=cos(x);
-                        U.im=sin(x);
-                        x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                        x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
-                    } else if(gauge==2) {//QPBC
-                        if((bc==1) && (j==0)) { //affects zm by QP
-                            y=(i*dx*Bz-k*dz*Bx)*Ly;
-                            QP.re=cos(y);
-                            QP.im=sin(y);
-                            x=zm.re;zm.re=zm.re*QP.re-zm.im*QP.im;zm.im=zm.im*QP.re+x*QP.im;
-                        }
-                        else if((bc==1) && (j==(Ny-1))) { //affects zp by QP*
-                            y=(i*dx*Bz-k*dz*Bx)*Ly;
-                            QP.re=cos(y);
-                            QP.im=sin(y);
-                            x=zp.re;zp.re=zp.re*QP.re+zp.im*QP.im;zp.im=zp.im*QP.re-x*QP.im;
-                        }
-                    } else {//general case, here we use a periodic A, no QP-BC
-                        y=-0.5*dy*(Ay[p]+Ay[m]);
-                        U.re=cos(y);
-                        U.im=sin(y);
-                        x=zp.re;zp.re=U.re*x-U.im*zp.im;zp.im=U.re*zp.im+U.im*x;
-                        x=zm.re;zm.re=U.re*x+U.im*zm.im;zm.im=U.re*zm.im-U.im*x;
+                pre=&ure[0];pim=&uim[0];us=1;
+            }
+            
+            if((gauge==2) && (bcy==1) && ((j==0) || (j==(Ny-1)))) { //quasi boundary conditions
+                for(int i=0;i<Nx;i++) {
+                    COMPLEX zp=psi[p+i],zm=psi[m+i];
+                    double y=(i*dx*Bz-k*dz*Bx)*Ly;
+                    if(j==0) glpp_qp(zm,y,false);
+                    else glpp_qp(zp,y,true);
+                    v=glpp_im(psi[c+i],zp,zm,one,zero,gv);
+                    if(calcnormal) v+=(mu[m+i]-mu[p+i]);
+                    if(g!=NULL) g[i]+=gv;
+                    Jy[i*js]=(T)(dy2i*v);
+                }
+            } else 
+                glpp_current_run(Nx,psi,c,p,m,pre,pim,us,one,zero,
+                                 calcnormal?mu+p:NULL,calcnormal?mu+m:NULL,dy2i,Jy,js,g,true);
+        }
+        
+        //---- z-direction
+        if(dim==3) {
+            if((bcz==0) && ((k==0) || (k==(Nz-1)))) { //no current
+                for(int i=0;i<Nx;i++) Jz[i*js]=0;
+            } else {
+                const int p=Nx*(j+Ny*(k==Nz-1?0:k+1)),m=Nx*(j+Ny*(k==0?Nz-1:k-1));
+                if(gauge<2) {pre=&uzre[0];pim=&uzim[0];us=1;}
+                else if(gauge==2) {
+                    double y=-(j-0.5*Ny)*dy*Bx*dz;
+                    ur=cos(y);ui=sin(y);
+                    pre=&ur;pim=&ui;us=0;
+                } else {
+                    for(int i=0;i<Nx;i++) {
+                        double y=-0.5*dz*(Az[p+i]+Az[m+i]);
+                        ure[i]=cos(y);uim[i]=sin(y);
                     }
-                    x=zp.re-zm.re;
-                    y=zp.im-zm.im;
-                    v=z.re*y-z.im*x;
-                    if(calcnormal) v+=(mu[m]-mu[p]);
-                    if(gradsq!=NULL) gradsq[idx]+=(x*x+y*y);
-                    Jy[idx]=dy2i*v;
+                    pre=&ure[0];pim=&uim[0];us=1;
                 }
+                glpp_current_run(Nx,psi,c,p,m,pre,pim,us,one,zero,
+                                 calcnormal?mu+p:NULL,calcnormal?mu+m:NULL,dz2i,Jz,js,g,true);
             }
         }
-    }
+    };
+    
+    std::atomic<int> next(0);
+    auto worker=[&]() {
+        std::vector<double> ure(Nx),uim(Nx);
+        for(int b=next++;b<nblocks;b=next++) {
+            const int j0=(b%njb)*jb,j1=MIN(Ny,j0+jb);
+            const int k0=(b/njb)*kb,k1=MIN(nz,k0+kb);
+            for(int k=k0;k<k1;k++)
+                for(int j=j0;j<j1;j++)
+                    row(j,k,ure,uim);
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    for(int t=1;t<nthreads;t++) threads.push_back(std::thread(worker));
+    worker();
+    for(size_t t=0;t<threads.size();t++) threads[t].join();
+    
     return 0;
 }
+
+template int GLPP::calc_current<float>(float*,float*,float*,double*,bool,int);
+template int GLPP::calc_current<double>(double*,double*,double*,double*,bool,int);
+template int GLPP::calc_current<float>(const float*,const float*,int,float*,float*,float*,int,double*,bool,int);
+template int GLPP::calc_current<double>(const float*,const float*,int,double*,double*,double*,int,double*,bool,int);
 //---------------------------------------------------------------------------
 
 int GLPP::analysis(Adata &adat,double *gradsq,double psi2thres) {
@@ -128,6 +128,16 @@ public:
     
     int calc_current(double *gradsq=NULL,bool calcnormal=false); //allocate and calculate the (super)currents using the vector potential if allocated or magnetic field in kappa=inf limit
     
+    //same as above, but writes into caller-provided buffers of NN elements (jz only used for dim==3) instead of Jx,Jy,Jz; multithreaded (nthreads=0: all cores), T is float or double
+    template <typename T>
+    int calc_current(T *jx,T *jy,T *jz,double *gradsq=NULL,bool calcnormal=false,int nthreads=0);
+    //same, but reads the order parameter from caller-owned single precision arrays (element i at re[i*psistride], im[i*psistride]; psi is not used) and writes with stride jstride, e.g. jstride=3 for an interleaved vector array: no copies of the input or the output
+    template <typename T>
+    int calc_current(const float *re,const float *im,int psistride,T *jx,T *jy,T *jz,int jstride,double *gradsq=NULL,bool calcnormal=false,int nthreads=0);
+    int current_gauge(unsigned int &gauge); //gauge used for the supercurrent, returns the error code of calc_current
+    template <typename T,typename S>
+    int calc_current_impl(const S &psi,T *jx,T *jy,T *jz,int jstride,double *gradsq,bool calcnormal,int nthreads);
+    
     
     //data analysis functions
     int analysis(Adata &adat,double *gradsq=NULL,double psi2thres=0.1); //uses subvolume information if defined
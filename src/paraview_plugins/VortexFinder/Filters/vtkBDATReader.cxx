@@ -11,8 +11,7 @@
 #include "vtkStreamingDemandDrivenPipeline.h"
 #include "vtkBDATReader.h"
 #include "io/GLGPU_IO_Helper.h"
-#include "io/GLGPU2DDataset.h"
-#include "io/GLGPU3DDataset.h"
+#include <cstdlib>
 
 vtkStandardNewMacro(vtkBDATReader);
 
@@ -58,6 +57,9 @@ int vtkBDATReader::RequestInformation(
   outInfo->Set(vtkDataObject::SPACING(), cell_lengths, 3);
   outInfo->Set(vtkDataObject::ORIGIN(), origins, 3);
   // vtkDataObject::SetPointDataActiveScalarInfo(outInfo, VTK_FLOAT, 1);
+  
+  // pieces are read as subvolumes of the order parameter
+  outInfo->Set(CAN_PRODUCE_SUB_EXTENT(), 1);
 
   return 1;
 }
@@ -67,33 +69,31 @@ int vtkBDATReader::RequestData(
     vtkInformationVector**, 
     vtkInformationVector* outVec)
 {
-  GLGPUDataset *ds;
-  if (GLdim == 2) ds = new GLGPU2DDataset;
-  else ds = new GLGPU3DDataset;
-  
-  bool succ; 
-  ds->OpenDataFileByPattern(FileName);
-  // ds->SetPrecomputeSupercurrent(true);
-  succ = ds->LoadTimeStep(0, 0);
+  vtkInformation *outInfo = outVec->GetInformationObject(0);
+  int ext[6];
+  outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(), ext);
+
+  GLHeader h;
+  float *rho=NULL, *phi=NULL, *re=NULL, *im=NULL;
 
+  bool succ = false;
+  if (!succ) 
+    succ = GLGPU_IO_Helper_ReadBDAT(FileName, h, ext, &rho, &phi, &re, &im);
+  if (!succ) 
+    succ = GLGPU_IO_Helper_ReadLegacy(FileName, h, ext, &rho, &phi, &re, &im);
   if (!succ) {
     vtkErrorMacro("Error opening file " << FileName);
     return 0;
   }
 
-  GLHeader h;
-  float *rho, *phi, *re, *im, *J;
-  ds->GetDataArray(h, &rho, &phi, &re, &im, &J);
-
   // vtk data structures
-  vtkInformation *outInfo = outVec->GetInformationObject(0);
   vtkImageData *imageData = 
     vtkImageData::SafeDownCast(outInfo->Get(vtkDataObject::DATA_OBJECT()));
-  imageData->SetDimensions(h.dims[0], h.dims[1], h.dims[2]);
+  imageData->SetExtent(ext);
   // imageData->AllocateScalars(VTK_FLOAT, 1);
 
   // copy data
-  const int arraySize = h.dims[0]*h.dims[1]*h.dims[2];
+  const int arraySize = (ext[1]-ext[0]+1)*(ext[3]-ext[2]+1)*(ext[5]-ext[4]+1);
   vtkSmartPointer<vtkDataArray> dataArrayRho, dataArrayPhi, dataArrayRe, dataArrayIm, dataArrayJ;
   
   dataArrayRho.TakeReference(vtkDataArray::CreateDataArray(VTK_FLOAT));
@@ -173,7 +173,10 @@ int vtkBDATReader::RequestData(
   imageData->GetFieldData()->AddArray(dataArrayKx);
   imageData->GetFieldData()->AddArray(dataArrayV);
 
-  delete ds;
+  free(rho);
+  free(phi);
+  free(re);
+  free(im);
   
   return 1;
 }
@@ -99,6 +99,9 @@ int vtkBDATSeriesReader::RequestInformation(
 
   outInfo->Set(vtkStreamingDemandDrivenPipeline::TIME_STEPS(), 
       &TimeSteps[0], static_cast<int>(TimeSteps.size()));
+  
+  // pieces are read as subvolumes of the order parameter
+  outInfo->Set(CAN_PRODUCE_SUB_EXTENT(), 1);
 
   return 1;
 }
@@ -115,6 +118,9 @@ int vtkBDATSeriesReader::RequestData(
 
   fprintf(stderr, "uptime=%f, timestep=%d\n", upTime, upTimeStep);
 
+  int ext[6];
+  outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT(), ext);
+
   GLHeader h;
   float *rho=NULL, *phi=NULL, *re=NULL, *im=NULL;
   // FIXME
@@ -122,11 +128,11 @@ int vtkBDATSeriesReader::RequestData(
   bool succ = false;
   if (!succ) {
     succ = GLGPU_IO_Helper_ReadBDAT(
-        filename.c_str(), h, &rho, &phi, &re, &im, NULL, NULL, NULL);
+        filename.c_str(), h, ext, &rho, &phi, &re, &im);
   }
   if (!succ) {
     succ = GLGPU_IO_Helper_ReadLegacy(
-        filename.c_str(), h, &rho, &phi, &re, &im, NULL, NULL, NULL);
+        filename.c_str(), h, ext, &rho, &phi, &re, &im);
   }
   if (!succ)
   {
@@ -137,11 +143,11 @@ int vtkBDATSeriesReader::RequestData(
   // vtk data structures
   vtkImageData *imageData = 
     vtkImageData::SafeDownCast(outInfo->Get(vtkDataObject::DATA_OBJECT()));
-  imageData->SetDimensions(h.dims[0], h.dims[1], h.dims[2]);
+  imageData->SetExtent(ext);
   // imageData->AllocateScalars(VTK_FLOAT, 1);
 
   // copy data
-  const int arraySize = h.dims[0]*h.dims[1]*h.dims[2];
+  const int arraySize = (ext[1]-ext[0]+1)*(ext[3]-ext[2]+1)*(ext[5]-ext[4]+1);
   vtkSmartPointer<vtkDataArray> dataArrayRe, dataArrayIm, dataArrayRho, dataArrayPhi;
   
   dataArrayRho.TakeReference(vtkDataArray::CreateDataArray(VTK_FLOAT));
@@ -216,6 +222,8 @@ int vtkBDATSeriesReader::RequestData(
 
   free(rho);
   free(phi);
+  free(re);
+  free(im);
 
   return 1;
 }
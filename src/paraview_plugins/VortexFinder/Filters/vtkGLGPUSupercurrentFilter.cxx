@@ -4,6 +4,7 @@
 #include "vtkImageData.h"
 #include "vtkPointData.h"
 #include "vtkDataArray.h"
+#include "vtkFloatArray.h"
 #include "vtkInformationVector.h"
 #include "vtkObjectFactory.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
@@ -99,11 +100,26 @@ int vtkGLGPUSupercurrentFilter::ComputeSupercurrent(vtkImageData* inputData, vtk
       B[0], B[1], B[2], pbc[0], pbc[1], pbc[2], Jxext, Kex, V);
 
   const int arraySize = dims[0]*dims[1]*dims[2];
-  float *rho = (float*)dataArrayRho->GetVoidPointer(0), 
-        *phi = (float*)dataArrayPhi->GetVoidPointer(0), 
-        *re = (float*)dataArrayRe->GetVoidPointer(0), 
-        *im = (float*)dataArrayIm->GetVoidPointer(0);
 
+  // GLPP reads re/im in place; arrays that are not single precision are 
+  // converted once
+  vtkSmartPointer<vtkFloatArray> re = vtkFloatArray::SafeDownCast(dataArrayRe), 
+                                 im = vtkFloatArray::SafeDownCast(dataArrayIm);
+  if (re == NULL) {
+    re = vtkSmartPointer<vtkFloatArray>::New();
+    re->DeepCopy(dataArrayRe);
+  }
+  if (im == NULL) {
+    im = vtkSmartPointer<vtkFloatArray>::New();
+    im->DeepCopy(dataArrayIm);
+  }
+
+  // both are read with one stride
+  if (re->GetNumberOfComponents() != im->GetNumberOfComponents()) {
+    vtkErrorMacro(<< "re and im have different numbers of components: " 
+        << re->GetNumberOfComponents() << " and " << im->GetNumberOfComponents());
+    return 0;
+  }
 
   // GLPP
   GLPP *pp = new GLPP;
@@ -124,32 +140,23 @@ int vtkGLGPUSupercurrentFilter::ComputeSupercurrent(vtkImageData* inputData, vtk
   pp->By = B[1]; 
   pp->Bz = B[2];
   pp->KEx = Kex;
-  pp->psi = (COMPLEX*)malloc(sizeof(COMPLEX)*arraySize);
-  for (int i=0; i<arraySize; i++) {
-    pp->psi[i].re = re[i];
-    pp->psi[i].im = im[i];
-  }
-
-  pp->calc_current();
-  assert(pp->Jx != NULL);
 
-  float *J = (float*)malloc(sizeof(float)*arraySize*3);
-  for (int i=0; i<arraySize; i++) {
-    J[i*3] = pp->Jx[i];
-    J[i*3+1] = pp->Jy[i];
-    J[i*3+2] = pp->Jz[i];
-  }
-  
-  delete pp;
-
-  // output
-  vtkSmartPointer<vtkDataArray> dataArrayJ; 
-  dataArrayJ.TakeReference(vtkDataArray::CreateDataArray(VTK_FLOAT));
+  // output, written by GLPP as interleaved components
+  vtkSmartPointer<vtkFloatArray> dataArrayJ = vtkSmartPointer<vtkFloatArray>::New();
   dataArrayJ->SetNumberOfComponents(3); 
   dataArrayJ->SetNumberOfTuples(arraySize);
   dataArrayJ->SetName("J");
-  memcpy(dataArrayJ->GetVoidPointer(0), J, sizeof(float)*arraySize*3);
-  free(J);
+
+  float *J = dataArrayJ->GetPointer(0);
+  const int res = pp->calc_current(
+      re->GetPointer(0), im->GetPointer(0), re->GetNumberOfComponents(), 
+      J, J+1, J+2, 3);
+  delete pp;
+
+  if (res != 0) {
+    vtkErrorMacro(<< "supercurrent calculation failed, error=" << res);
+    return 0;
+  }
 
   outputData->SetDimensions(dims[0], dims[1], dims[2]);
   outputData->GetPointData()->AddArray(dataArrayJ);
@@ -3,6 +3,8 @@
 #include "vtkSmartPointer.h"
 #include "vtkPointData.h"
 #include "vtkFloatArray.h"
+#include "vtkIntArray.h"
+#include "vtkCellData.h"
 #include "vtkPolyData.h"
 #include "vtkPolyLine.h"
 #include "vtkCellArray.h"
@@ -11,9 +13,13 @@
 #include "vtkInformationVector.h"
 #include "vtkObjectFactory.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
+#include "vtkExtentTranslator.h"
 #include "io/GLGPU2DDataset.h"
 #include "io/GLGPU3DDataset.h"
 #include "extractor/Extractor.h"
+#include "common/VortexTransition.h"
+#include <cmath>
+#include <algorithm>
 
 vtkStandardNewMacro(vtkGLGPUVortexFilter);
 
@@ -25,10 +31,44 @@ vtkGLGPUVortexFilter::vtkGLGPUVortexFilter()
   SetUseGPU(false);
   SetMeshType(0);
   SetExtentThreshold(0);
+  bTracking = false;
+
+  dataset = NULL;
+  extractor = NULL;
+  transition = NULL;
+  currentFrame = -1;
 }
 
 vtkGLGPUVortexFilter::~vtkGLGPUVortexFilter()
 {
+  ReleaseCache();
+}
+
+void vtkGLGPUVortexFilter::ReleaseCache()
+{
+  delete extractor;
+  delete dataset;
+  delete transition;
+  extractor = NULL;
+  dataset = NULL;
+  transition = NULL;
+  currentFrame = -1;
+
+  for (int i=0; i<2; i++) 
+    for (int j=0; j<4; j++) 
+      dataArrays[i][j] = NULL;
+}
+
+// the dataset references single precision arrays in place; other types are 
+// converted once
+static vtkSmartPointer<vtkFloatArray> AsFloatArray(vtkDataArray *array)
+{
+  vtkSmartPointer<vtkFloatArray> f = vtkFloatArray::SafeDownCast(array);
+  if (f == NULL && array != NULL) {
+    f = vtkSmartPointer<vtkFloatArray>::New();
+    f->DeepCopy(array);
+  }
+  return f;
 }
 
 void vtkGLGPUVortexFilter::SetUseGPU(bool b)
@@ -46,6 +86,14 @@ void vtkGLGPUVortexFilter::SetExtentThreshold(double t)
   dExtentThreshold = t;
 }
 
+void vtkGLGPUVortexFilter::SetTracking(bool b)
+{
+  if (bTracking != b) {
+    bTracking = b;
+    Modified();
+  }
+}
+
 int vtkGLGPUVortexFilter::FillOutputPortInformation(int, vtkInformation *info)
 {
   info->Set(vtkDataObject::DATA_TYPE_NAME(), "vtkPolyData");
@@ -63,10 +111,91 @@ int vtkGLGPUVortexFilter::RequestData(
   vtkImageData *input = vtkImageData::SafeDownCast(inInfo->Get(vtkDataObject::DATA_OBJECT()));
   vtkPolyData *output = vtkPolyData::SafeDownCast(outInfo->Get(vtkDataObject::DATA_OBJECT()));
 
-  return ExtractVorticies(input, output);
+  // index of the input time step
+  int frame = -1;
+  if (inInfo->Has(vtkStreamingDemandDrivenPipeline::TIME_STEPS()) && 
+      input->GetInformation()->Has(vtkDataObject::DATA_TIME_STEP())) 
+  {
+    const double t = input->GetInformation()->Get(vtkDataObject::DATA_TIME_STEP());
+    const double *steps = inInfo->Get(vtkStreamingDemandDrivenPipeline::TIME_STEPS());
+    const int nsteps = inInfo->Length(vtkStreamingDemandDrivenPipeline::TIME_STEPS());
+    
+    for (int i=0; i<nsteps; i++) 
+      if (frame < 0 || fabs(steps[i] - t) < fabs(steps[frame] - t)) 
+        frame = i;
+
+    // tracking results are only valid for the same series
+    std::vector<double> steps1(steps, steps+nsteps);
+    if (steps1 != timeSteps) {
+      timeSteps.swap(steps1);
+      delete transition;
+      transition = NULL;
+      currentFrame = -1;
+    }
+  }
+
+  // piece of a distributed pipeline: the cells of the piece without ghost 
+  // layers are owned by this filter instance
+  const int piece = outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_PIECE_NUMBER()), 
+            npieces = outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_NUMBER_OF_PIECES());
+  int wholeExtent[6], ownedExtent[6];
+  inInfo->Get(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), wholeExtent);
+  if (npieces > 1) {
+    vtkSmartPointer<vtkExtentTranslator> translator = vtkSmartPointer<vtkExtentTranslator>::New();
+    translator->PieceToExtentThreadSafe(piece, npieces, 0, wholeExtent, ownedExtent, 
+        vtkExtentTranslator::BLOCK_MODE, 0);
+  }
+
+  return ExtractVorticies(input, output, frame, npieces > 1 ? ownedExtent : NULL, wholeExtent);
 }
 
-int vtkGLGPUVortexFilter::ExtractVorticies(vtkImageData* imageData, vtkPolyData* polyData)
+int vtkGLGPUVortexFilter::RequestUpdateExtent(
+    vtkInformation*, 
+    vtkInformationVector** inputVector, 
+    vtkInformationVector* outputVector)
+{
+  vtkInformation *inInfo = inputVector[0]->GetInformationObject(0);
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+
+  // the same piece of the input, with an extra ghost layer
+  const int piece = outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_PIECE_NUMBER()), 
+            npieces = outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_NUMBER_OF_PIECES()), 
+            nghosts = outInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_NUMBER_OF_GHOST_LEVELS());
+
+  inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_PIECE_NUMBER(), piece);
+  inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_NUMBER_OF_PIECES(), npieces);
+  inInfo->Set(vtkStreamingDemandDrivenPipeline::UPDATE_NUMBER_OF_GHOST_LEVELS(), nghosts + (npieces > 1 ? 1 : 0));
+
+  return 1;
+}
+
+bool vtkGLGPUVortexFilter::HasTransition(int f0, int f1) const
+{
+  return transition != NULL 
+    && transition->Matrices().find(Interval(f0, f1)) != transition->Matrices().end();
+}
+
+void vtkGLGPUVortexFilter::UpdateSequences(int frame)
+{
+  // sequences are built over the longest run of tracked intervals that 
+  // contains the frame, and kept until the run changes
+  int f0 = frame, f1 = frame;
+  while (f0 > 0 && HasTransition(f0-1, f0)) f0 --;
+  while (HasTransition(f1, f1+1)) f1 ++;
+
+  if (f0 == sequenceRun[0] && f1 == sequenceRun[1]) return;
+  sequenceRun[0] = f0;
+  sequenceRun[1] = f1;
+
+  std::vector<int> frames;
+  for (int i=f0; i<=f1; i++) 
+    frames.push_back(i);
+  transition->SetFrames(frames);
+  if (f1 > f0) transition->ConstructSequence();
+}
+
+int vtkGLGPUVortexFilter::ExtractVorticies(vtkImageData* imageData, vtkPolyData* polyData, int frame, 
+    const int ownedExtent[6], const int wholeExtent[6])
 {
   // TODO: check compatability
   vtkSmartPointer<vtkDataArray> dataArrayRho, dataArrayPhi, dataArrayRe, dataArrayIm;
@@ -92,10 +221,13 @@ int vtkGLGPUVortexFilter::ExtractVorticies(vtkImageData* imageData, vtkPolyData*
   if (h.dims[2] == 1) h.ndims = 2;
   else h.ndims = 3;
 
+  // the input may be a piece; the header describes the piece
+  int ext[6];
+  imageData->GetExtent(ext);
   imageData->GetOrigin(origins);
   imageData->GetSpacing(cell_lengths);
   for (int i=0; i<h.ndims; i++) {
-    h.origins[i] = origins[i];
+    h.origins[i] = origins[i] + ext[i*2] * cell_lengths[i];
     h.cell_lengths[i] = cell_lengths[i];
     h.lengths[i] = h.cell_lengths[i] * h.dims[i];
   }
@@ -116,35 +248,93 @@ int vtkGLGPUVortexFilter::ExtractVorticies(vtkImageData* imageData, vtkPolyData*
   // fprintf(stderr, "B={%f, %f, %f}, pbc={%d, %d, %d}, Jxext=%f, Kx=%f, V=%f\n", 
   //     h.B[0], h.B[1], h.B[2], h.pbc[0], h.pbc[1], h.pbc[2], h.Jxext, h.Kex, h.V);
 
-  const int count = h.dims[0]*h.dims[1]*h.dims[2];
-  float *rho = (float*)dataArrayRho->GetVoidPointer(0), 
-        *phi = (float*)dataArrayPhi->GetVoidPointer(0), 
-        *re = (float*)dataArrayRe->GetVoidPointer(0), 
-        *im = (float*)dataArrayIm->GetVoidPointer(0);
-
-  // build data
-  GLGPUDataset *ds;
-  if (h.ndims == 2) ds = new GLGPU2DDataset;
-  else ds = new GLGPU3DDataset;
-  ds->BuildDataFromArray(h, rho, phi, re, im); // FIXME
-
-  if (h.ndims == 3 && iMeshType == 1) {
-    GLGPU3DDataset *ds3 = (GLGPU3DDataset*)ds;
-    ds3->SetMeshType(GLGPU3D_MESH_TET);
+  if (dataArrayRe == NULL || dataArrayIm == NULL) {
+    vtkErrorMacro(<< "re/im arrays not found");
+    return 0;
   }
-  ds->BuildMeshGraph();
 
-  VortexExtractor *ex = new VortexExtractor;
-  ex->SetDataset(ds);
-  ex->SetArchive(false);
+  // rebuild the dataset, mesh graph, and extractor only if the mesh changes
+  const int meshType = h.ndims == 3 ? iMeshType : 0;
+  bool reuse = dataset != NULL 
+    && dataset->Dimensions() == h.ndims
+    && cachedMeshType == meshType
+    && cachedUseGPU == bUseGPU;
+  for (int i=0; i<3; i++) 
+    reuse = reuse && cachedDims[i] == h.dims[i] && cachedPBC[i] == h.pbc[i];
+
+  if (!reuse) {
+    ReleaseCache();
+    
+    if (h.ndims == 2) dataset = new GLGPU2DDataset;
+    else {
+      GLGPU3DDataset *ds3 = new GLGPU3DDataset;
+      ds3->SetMeshType(meshType == 1 ? GLGPU3D_MESH_TET : GLGPU3D_MESH_HEX);
+      dataset = ds3;
+    }
+    dataset->SetHeader(h);
+    dataset->BuildMeshGraph();
+
+    extractor = new VortexExtractor;
+    extractor->SetDataset(dataset);
+    extractor->SetArchive(false);
 #if WITH_CUDA
-  ex->SetGPU(bUseGPU); // FIXME: failure fallback
+    extractor->SetGPU(bUseGPU); // FIXME: failure fallback
 #endif
-  ex->SetCond(true); // TODO
-  ex->SetGaugeTransformation(true); 
+    extractor->SetCond(true); // TODO
+    extractor->SetGaugeTransformation(true); 
+    extractor->SetKeepTransition(false); // the filter keeps its own transition
+
+    for (int i=0; i<3; i++) {
+      cachedDims[i] = h.dims[i];
+      cachedPBC[i] = h.pbc[i];
+    }
+    cachedMeshType = meshType;
+    cachedUseGPU = bUseGPU;
+  }
+
+  const bool tracking = bTracking && frame >= 0;
+  if (tracking && transition == NULL) {
+    transition = new VortexTransition;
+    sequenceRun[0] = sequenceRun[1] = -1;
+  }
+
+  // space-time edges are only extracted when time advances by one step from 
+  // the frame in slot 0, and only if the interval was not tracked before
+  const bool advance = tracking && frame > 0 && currentFrame == frame-1 
+    && !HasTransition(frame-1, frame);
+  const int slot = advance ? 1 : 0;
+
+  // wrap data
+  vtkSmartPointer<vtkFloatArray> *arrays = dataArrays[slot];
+  arrays[0] = AsFloatArray(dataArrayRho);
+  arrays[1] = AsFloatArray(dataArrayPhi);
+  arrays[2] = AsFloatArray(dataArrayRe);
+  arrays[3] = AsFloatArray(dataArrayIm);
+
+  dataset->WrapDataArray(h, 
+      arrays[0] ? arrays[0]->GetPointer(0) : NULL, 
+      arrays[1] ? arrays[1]->GetPointer(0) : NULL, 
+      arrays[2]->GetPointer(0), arrays[3]->GetPointer(0), slot);
+  dataset->SetTimeStep(frame, slot);
+
+  VortexExtractor *ex = extractor;
   ex->SetExtentThreshold(dExtentThreshold);
-  ex->ExtractFaces(0);
-  ex->TraceOverSpace(0);
+  if (!advance) ex->Clear();
+  ex->ExtractFaces(slot);
+  ex->TraceOverSpace(slot);
+
+  if (advance) {
+    ex->ExtractEdges();
+    VortexTransitionMatrix tm = ex->TraceOverTime();
+    tm.Modularize();
+    transition->AddMatrix(tm); // matrices of intervals without vortices are dropped
+
+    ex->RotateTimeSteps();
+    dataset->RotateTimeSteps();
+    for (int j=0; j<4; j++) 
+      std::swap(dataArrays[0][j], dataArrays[1][j]);
+  }
+  currentFrame = frame;
 
   std::vector<VortexLine> vlines = ex->GetVortexLines(0);
   vtkSmartPointer<vtkPoints> points = vtkPoints::New();
@@ -153,52 +343,83 @@ int vtkGLGPUVortexFilter::ExtractVorticies(vtkImageData* imageData, vtkPolyData*
   // conditionNumberArray->SetNumberOfComponents(1);
 
   std::vector<float> conditionNumbers;
+  std::vector<int> cellLines; // line index of each cell
 
   bool hasCond = false; 
   if (vlines.size() > 0 && vlines[0].cond.size() > 0)
     hasCond = true;
 
+  // a distributed piece only emits the line segments (or 2D vortices) in 
+  // the cells it owns; the ghost layer makes sure that the cells on piece 
+  // boundaries are traced by the neighbors as well
+  const bool distributed = ownedExtent != NULL;
+  double lo[3] = {0}, hi[3] = {0};
+  bool closed[3] = {false, false, false};
+  if (distributed) 
+    for (int i=0; i<3; i++) {
+      lo[i] = origins[i] + ownedExtent[i*2] * cell_lengths[i];
+      hi[i] = origins[i] + ownedExtent[i*2+1] * cell_lengths[i];
+      closed[i] = ownedExtent[i*2+1] == wholeExtent[i*2+1];
+    }
+  auto owned = [&](const float X[3]) {
+    for (int i=0; i<h.ndims; i++) 
+      if (X[i] < lo[i] || X[i] > hi[i] || (X[i] == hi[i] && !closed[i])) return false;
+    return true;
+  };
+
   if (h.ndims == 3) { // 3D poly lines
-    std::vector<int> vertCounts;
     for (int i=0; i<vlines.size(); i++) {
-      int vertCount = 0;
-      const int nv = vlines[i].size()/3;
-      // if (nv<2) continue;
-      double p0[3];
-      for (int j=0; j<nv; j++) {
-        double p[3] = {vlines[i][j*3], vlines[i][j*3+1], vlines[i][j*3+2]};
-        points->InsertNextPoint(p);
-
-        if (hasCond) {
-          // fprintf(stderr, "cond1=%f\n", vlines[i].cond[j]);
-          conditionNumbers.push_back(vlines[i].cond[j]);
+      const VortexLine &line = vlines[i];
+      const int nv = line.size()/3;
+
+      // runs of vertices {first, count}
+      std::vector<int> runs;
+      if (!distributed) {
+        std::vector<int> vertCounts;
+        line.Pieces(vertCounts);
+        int first = 0;
+        for (int j=0; j<vertCounts.size(); j++) {
+          runs.push_back(first);
+          runs.push_back(vertCounts[j]);
+          first += vertCounts[j];
         }
-
-        double delta[3] = {p[0] - p0[0], p[1] - p0[1], p[2] - p0[2]};
-        double dist = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
-
-        if (j>0 && dist>5) { // FIXME
-          vertCounts.push_back(vertCount);
-          vertCount = 0;
+      } else if (nv == 1) {
+        if (owned(&line[0])) {
+          runs.push_back(0);
+          runs.push_back(1);
+        }
+      } else {
+        // segments are owned by their midpoints; consecutive owned segments 
+        // form a run
+        for (int j=0; j<nv-1; j++) {
+          const float X[3] = {
+            0.5f*(line[j*3] + line[j*3+3]), 
+            0.5f*(line[j*3+1] + line[j*3+4]), 
+            0.5f*(line[j*3+2] + line[j*3+5])};
+          if (!owned(X)) continue;
+          else if (!runs.empty() && runs[runs.size()-2] + runs.back() - 1 == j) 
+            runs.back() ++;
+          else {
+            runs.push_back(j);
+            runs.push_back(2);
+          }
         }
-        memcpy(p0, p, sizeof(double)*3);
-        vertCount ++;
       }
 
-      if (vertCount > 0) 
-        vertCounts.push_back(vertCount);
-    }
-
-    int nv = 0;
-    for (int i=0; i<vertCounts.size(); i++) {
-      // fprintf(stderr, "vertCount=%d\n", vertCounts[i]);
-      vtkSmartPointer<vtkPolyLine> polyLine = vtkPolyLine::New();
-      polyLine->GetPointIds()->SetNumberOfIds(vertCounts[i]);
-      for (int j=0; j<vertCounts[i]; j++)
-        polyLine->GetPointIds()->SetId(j, j+nv);
+      for (int r=0; r<runs.size(); r+=2) {
+        const int first = runs[r], count = runs[r+1];
+        vtkSmartPointer<vtkPolyLine> polyLine = vtkSmartPointer<vtkPolyLine>::New();
+        polyLine->GetPointIds()->SetNumberOfIds(count);
+        for (int j=first; j<first+count; j++) {
+          double p[3] = {line[j*3], line[j*3+1], line[j*3+2]};
+          polyLine->GetPointIds()->SetId(j-first, points->InsertNextPoint(p));
 
-      cells->InsertNextCell(polyLine);
-      nv += vertCounts[i];
+          if (hasCond) 
+            conditionNumbers.push_back(line.cond[j]);
+        }
+        cells->InsertNextCell(polyLine);
+        cellLines.push_back(i);
+      }
     }
     
     polyData->SetPoints(points);
@@ -212,17 +433,64 @@ int vtkGLGPUVortexFilter::ExtractVorticies(vtkImageData* imageData, vtkPolyData*
     }
   } else { // 2D data
     for (int i=0; i<vlines.size(); i++) {
+      if (distributed && !owned(&vlines[i][0])) continue;
       double p[3] = {vlines[i][0], vlines[i][1], vlines[i][2]};
-      points->InsertNextPoint(p);
       cells->InsertNextCell(1);
-      cells->InsertCellPoint(i);
+      cells->InsertCellPoint(points->InsertNextPoint(p));
+      cellLines.push_back(i);
     }
     polyData->SetPoints(points);
     polyData->SetVerts(cells);
   }
 
-  delete ex;
-  delete ds;
+  if (tracking) {
+    UpdateSequences(frame);
+    
+    // per line sequence IDs (-1 if untracked) and the types of the events 
+    // that lead to (from the previous step) and follow (to the next step) 
+    // each line
+    const int k = frame - sequenceRun[0];
+    std::vector<int> gids(vlines.size(), -1), 
+                     eventsIn(vlines.size(), VORTEX_EVENT_DUMMY), 
+                     eventsOut(vlines.size(), VORTEX_EVENT_DUMMY);
+    std::map<int, int> lid2line;
+    for (int i=0; i<vlines.size(); i++) 
+      lid2line[vlines[i].id] = i;
+
+    if (sequenceRun[1] > sequenceRun[0]) {
+      for (int i=0; i<vlines.size(); i++) 
+        gids[i] = transition->lvid2gvid(k, vlines[i].id);
+
+      const std::vector<VortexEvent> &events = transition->Events();
+      for (int i=0; i<events.size(); i++) {
+        const VortexEvent &e = events[i];
+        if (e.if1 == k) 
+          for (std::set<int>::const_iterator it=e.rhs.begin(); it!=e.rhs.end(); it++) 
+            if (lid2line.count(*it)) eventsIn[lid2line[*it]] = e.type;
+        if (e.if0 == k) 
+          for (std::set<int>::const_iterator it=e.lhs.begin(); it!=e.lhs.end(); it++) 
+            if (lid2line.count(*it)) eventsOut[lid2line[*it]] = e.type;
+      }
+    }
+
+    vtkSmartPointer<vtkIntArray> gidArray = vtkSmartPointer<vtkIntArray>::New(), 
+                                 eventInArray = vtkSmartPointer<vtkIntArray>::New(), 
+                                 eventOutArray = vtkSmartPointer<vtkIntArray>::New();
+    gidArray->SetName("SequenceID");
+    eventInArray->SetName("EventIn");
+    eventOutArray->SetName("EventOut");
+    gidArray->SetNumberOfValues(cellLines.size());
+    eventInArray->SetNumberOfValues(cellLines.size());
+    eventOutArray->SetNumberOfValues(cellLines.size());
+    for (int i=0; i<cellLines.size(); i++) {
+      gidArray->SetValue(i, gids[cellLines[i]]);
+      eventInArray->SetValue(i, eventsIn[cellLines[i]]);
+      eventOutArray->SetValue(i, eventsOut[cellLines[i]]);
+    }
+    polyData->GetCellData()->AddArray(gidArray);
+    polyData->GetCellData()->AddArray(eventInArray);
+    polyData->GetCellData()->AddArray(eventOutArray);
+  }
 
   return 1;
 }
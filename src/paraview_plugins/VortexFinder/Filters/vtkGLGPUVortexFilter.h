@@ -4,8 +4,14 @@
 #include "vtkVortexFiltersModule.h"
 #include "vtkImageAlgorithm.h"
 #include "vtkPolyDataAlgorithm.h"
+#include "vtkSmartPointer.h"
+#include <vector>
 
 class vtkDataSet;
+class vtkFloatArray;
+class GLGPUDataset;
+class VortexExtractor;
+class VortexTransition;
 
 class VTKVORTEXFILTERS_EXPORT vtkGLGPUVortexFilter : public vtkImageAlgorithm
 {
@@ -17,16 +23,26 @@ public:
   void SetMeshType(int);
   void SetExtentThreshold(double);
 
+  // temporal mode: vortices are tracked between consecutive time steps, and 
+  // sequence IDs and events are attached to the lines as cell data
+  void SetTracking(bool);
+
 protected:
   vtkGLGPUVortexFilter();
   ~vtkGLGPUVortexFilter();
 
+  virtual int RequestUpdateExtent(vtkInformation*, vtkInformationVector**, vtkInformationVector*);
   virtual int RequestData(vtkInformation*, vtkInformationVector**, vtkInformationVector*);
   
   int FillOutputPortInformation(int, vtkInformation*);
 
 private:
-  int ExtractVorticies(vtkImageData*, vtkPolyData*);
+  // ownedExtent is NULL unless the input is one of several pieces
+  int ExtractVorticies(vtkImageData*, vtkPolyData*, int frame, 
+      const int ownedExtent[6], const int wholeExtent[6]);
+  void ReleaseCache();
+  bool HasTransition(int frame0, int frame1) const;
+  void UpdateSequences(int frame);
 
 private:
   vtkGLGPUVortexFilter(const vtkGLGPUVortexFilter&);
@@ -36,6 +52,26 @@ private:
   bool bUseGPU;
   int iMeshType;
   double dExtentThreshold;
+  bool bTracking;
+
+  // kept across updates (time steps) while dims, pbc, mesh type and GPU 
+  // usage stay the same, so that the mesh graph and the extractor (and its 
+  // GPU context) are built only once
+  GLGPUDataset *dataset;
+  VortexExtractor *extractor;
+  int cachedDims[3], cachedMeshType;
+  bool cachedPBC[3], cachedUseGPU;
+
+  // input arrays (rho, phi, re, im) referenced by the two dataset slots
+  vtkSmartPointer<vtkFloatArray> dataArrays[2][4];
+
+  // temporal mode; slot 0 of the extractor holds currentFrame, and the 
+  // transition matrices of all tracked intervals are kept, so that revisited 
+  // steps are not tracked again
+  VortexTransition *transition;
+  std::vector<double> timeSteps;
+  int currentFrame;
+  int sequenceRun[2]; // frames covered by the current sequences
 };
 
 #endif
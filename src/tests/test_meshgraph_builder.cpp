@@ -0,0 +1,156 @@
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include "common/MeshGraph.h"
+#include "common/MeshGraphCSR.h"
+
+// checks that MeshGraphBuilder_TetParallel builds the same graph as
+// MeshGraphBuilder_Tet, both in vectors and in CSR form, on a Kuhn
+// subdivision of a grid with shuffled node ids and cell order, and with faces
+// given in random rotations and orientations
+
+struct TetMesh {
+  std::vector<CellIdType> order; // of AddCell()
+  std::vector<std::vector<NodeIdType> > nodes;
+  std::vector<std::vector<CellIdType> > neighbors;
+  std::vector<std::vector<FaceIdType3> > faces;
+};
+
+static void generate_mesh(int n, unsigned int seed, TetMesh& m)
+{
+  std::mt19937 rng(seed);
+
+  const int nn = (n+1)*(n+1)*(n+1), nc = n*n*n*6;
+  std::vector<NodeIdType> labels(nn);
+  for (int i=0; i<nn; i++) labels[i] = i;
+  std::shuffle(labels.begin(), labels.end(), rng);
+
+  std::vector<CellIdType> cids(nc);
+  for (int i=0; i<nc; i++) cids[i] = i;
+  std::shuffle(cids.begin(), cids.end(), rng);
+
+  m.nodes.resize(nc);
+  m.neighbors.assign(nc, std::vector<CellIdType>(4, UINT_MAX));
+  m.faces.resize(nc);
+
+  static const int perms[6][3] = {{0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0}};
+  static const int sides[4][3] = {{0,2,1}, {0,1,3}, {1,2,3}, {2,0,3}}; // libMesh Tet4
+  int c = 0;
+  for (int k=0; k<n; k++)
+    for (int j=0; j<n; j++)
+      for (int i=0; i<n; i++)
+        for (int p=0; p<6; p++, c++) {
+          int x[3] = {i, j, k};
+          std::vector<NodeIdType> &nodes = m.nodes[cids[c]];
+          nodes.push_back(labels[x[0] + (n+1)*(x[1] + (n+1)*x[2])]);
+          for (int s=0; s<3; s++) {
+            x[perms[p][s]] ++;
+            nodes.push_back(labels[x[0] + (n+1)*(x[1] + (n+1)*x[2])]);
+          }
+
+          for (int s=0; s<4; s++) {
+            FaceIdType3 f3 = std::make_tuple(nodes[sides[s][0]], nodes[sides[s][1]], nodes[sides[s][2]]);
+            f3 = AlternateFace(f3, rng()%3, rng()%4 ? 1 : -1);
+            m.faces[cids[c]].push_back(f3);
+          }
+        }
+
+  m.order = cids;
+  std::shuffle(m.order.begin(), m.order.end(), rng);
+}
+
+template <typename Builder>
+static double build(const TetMesh& m, Builder& builder)
+{
+  auto t0 = std::chrono::high_resolution_clock::now();
+  for (int i=0; i<m.order.size(); i++) {
+    const CellIdType c = m.order[i];
+    builder.AddCell(c, m.nodes[c], m.neighbors[c], m.faces[c]);
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(t1 - t0).count();
+}
+
+static bool same_graph(const MeshGraph& a, const MeshGraph& b)
+{
+  if (a.NEdges() != b.NEdges() || a.NFaces() != b.NFaces() || a.NCells() != b.NCells()) {
+    fprintf(stderr, "sizes differ: #edge=%u/%u, #face=%u/%u, #cell=%u/%u\n",
+        a.NEdges(), b.NEdges(), a.NFaces(), b.NFaces(), a.NCells(), b.NCells());
+    return false;
+  }
+
+  for (EdgeIdType i=0; i<a.NEdges(); i++) {
+    const CEdge e0 = a.Edge(i), e1 = b.Edge(i);
+    if (e0.node0 != e1.node0 || e0.node1 != e1.node1 ||
+        e0.contained_faces != e1.contained_faces ||
+        e0.contained_faces_chirality != e1.contained_faces_chirality ||
+        e0.contained_faces_eid != e1.contained_faces_eid) {
+      fprintf(stderr, "edge %u differs\n", i);
+      return false;
+    }
+  }
+
+  for (FaceIdType i=0; i<a.NFaces(); i++) {
+    const CFace f0 = a.Face(i), f1 = b.Face(i);
+    if (f0.nodes != f1.nodes || f0.edges != f1.edges ||
+        f0.edges_chirality != f1.edges_chirality ||
+        f0.contained_cells != f1.contained_cells ||
+        f0.contained_cells_chirality != f1.contained_cells_chirality ||
+        f0.contained_cells_fid != f1.contained_cells_fid) {
+      fprintf(stderr, "face %u differs\n", i);
+      return false;
+    }
+  }
+
+  for (CellIdType i=0; i<a.NCells(); i++) {
+    const CCell c0 = a.Cell(i), c1 = b.Cell(i);
+    if (c0.nodes != c1.nodes || c0.faces != c1.faces ||
+        c0.faces_chirality != c1.faces_chirality ||
+        c0.neighbor_cells != c1.neighbor_cells) {
+      fprintf(stderr, "cell %u differs\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const int n = argc>1 ? atoi(argv[1]) : 12;
+  bool succ = true;
+
+  for (unsigned int seed=1; seed<=3; seed++) {
+    TetMesh m;
+    generate_mesh(n, seed, m);
+
+    MeshGraph mg0;
+    double t0;
+    {
+      MeshGraphBuilder_Tet builder(m.nodes.size(), mg0);
+      t0 = build(m, builder);
+    }
+
+    const int nthreads[3] = {1, 3, 8};
+    for (int k=0; k<6; k++) {
+      MeshGraph vmg;
+      MeshGraphCSR cmg;
+      MeshGraph &mg1 = k<3 ? vmg : cmg;
+      MeshGraphBuilder_TetParallel builder(m.nodes.size(), mg1, nthreads[k%3]);
+      double t1 = build(m, builder);
+      auto start = std::chrono::high_resolution_clock::now();
+      builder.Build();
+      t1 += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+      const bool same = same_graph(mg0, mg1);
+      fprintf(stderr, "seed=%u, %s, nthreads=%d, #edge=%u, #face=%u, #cell=%u, t_seq=%.3fs, t_par=%.3fs: %s\n",
+          seed, k<3 ? "vectors" : "csr", nthreads[k%3], mg1.NEdges(), mg1.NFaces(), mg1.NCells(), t0, t1, same ? "same" : "DIFFERENT");
+      succ = succ && same;
+    }
+  }
+
+  return succ ? EXIT_SUCCESS : EXIT_FAILURE;
+}
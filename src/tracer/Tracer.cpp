@@ -1,9 +1,17 @@
 #include "Tracer.h"
 #include "io/GLDataset.h"
+#include "io/GLGPU3DDataset.h"
+#include "io/GLGPU_IO_Helper.h"
 #include "common/Utils.hpp"
 #include <cstdio>
 #include <cstdlib>
 #include <climits>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #if WITH_VTK
 #include <vtkSmartPointer.h>
@@ -14,9 +22,33 @@
 #include <vtkXMLPolyDataWriter.h>
 #endif
 
-FieldLineTracer::FieldLineTracer()
-{
+// per-thread sampling state; the corner values of the last visited cell are
+// kept, as consecutive RK stages mostly fall into the same cell.  On 
+// irregular meshes the last located cell is where the next search starts.
+struct FieldLineTracer::Sampler {
+  bool cached;
+  int cell[3];
+  float C[8][3];
+  CellIdType elem;
+
+  Sampler() : cached(false), elem(UINT_MAX) {}
+};
 
+static const int seeds_per_chunk = 64;
+
+FieldLineTracer::FieldLineTracer() : 
+  _ds(NULL), 
+  _nthreads(0), 
+  _max_steps(1024), 
+  _min_vertices(10),
+  _max_length(FLT_MAX), 
+  _min_magnitude(0.001), 
+  _h0(0.5), _hmin(0.01), _hmax(2), 
+  _tolerance(1e-3)
+{
+  // const int nseeds[3] = {256, 128, 32};
+  // const int nseeds[3] = {128, 64, 32};
+  SetSeedingDensity(64, 32, 32);
 }
 
 FieldLineTracer::~FieldLineTracer()
@@ -29,6 +61,20 @@ void FieldLineTracer::SetDataset(const GLDataset* ds)
   _ds = ds;
 }
 
+void FieldLineTracer::SetSeedingDensity(int n0, int n1, int n2)
+{
+  _nseeds[0] = std::max(1, n0); 
+  _nseeds[1] = std::max(1, n1); 
+  _nseeds[2] = std::max(1, n2);
+}
+
+void FieldLineTracer::GetFieldLines(std::vector<FieldLine>& lines) const
+{
+  lines.resize(NFieldLines());
+  for (int i=0; i<NFieldLines(); i++) 
+    lines[i].assign(_verts.begin() + _offsets[i]*3, _verts.begin() + _offsets[i+1]*3);
+}
+
 void FieldLineTracer::WriteFieldLines(const std::string& filename)
 {
 #if WITH_VTK
@@ -36,23 +82,17 @@ void FieldLineTracer::WriteFieldLines(const std::string& filename)
   vtkSmartPointer<vtkPoints> points = vtkPoints::New();
   vtkSmartPointer<vtkCellArray> cells = vtkCellArray::New();
 
-  int nv = 0;
-  for (int i=0; i<_fieldlines.size(); i++) {
-    const FieldLine& l = _fieldlines[i];
-    
+  points->SetNumberOfPoints(_verts.size()/3);
+  for (int i=0; i<_verts.size()/3; i++) 
+    points->SetPoint(i, _verts[i*3], _verts[i*3+1], _verts[i*3+2]);
+
+  for (int i=0; i<NFieldLines(); i++) {
     vtkSmartPointer<vtkPolyLine> polyLine = vtkPolyLine::New();
-    polyLine->GetPointIds()->SetNumberOfIds(l.size()/3);
-
-    int j = 0;
-    for (FieldLine::const_iterator it = l.begin(); it != l.end(); ) {
-      double p[3] = {*(it++), *(it++), *(it++)};
-      // double p[3] = {l[i*3], l[i*3+1], l[i*3+2]};
-      points->InsertNextPoint(p);
-      polyLine->GetPointIds()->SetId(j, j+nv);
-      j ++;
-    }
+    const int nv = _offsets[i+1] - _offsets[i];
+    polyLine->GetPointIds()->SetNumberOfIds(nv);
+    for (int j=0; j<nv; j++)
+      polyLine->GetPointIds()->SetId(j, _offsets[i] + j);
     cells->InsertNextCell(polyLine);
-    nv += l.size()/3;
   }
 
   polyData->SetPoints(points);
@@ -63,122 +103,268 @@ void FieldLineTracer::WriteFieldLines(const std::string& filename)
   writer->SetInputData(polyData);
   writer->Write();
 #else
-  // ::WriteFieldLines(filename, _fieldlines);
-  ::WriteFieldLinesASCII(filename, _fieldlines);
+  std::vector<FieldLine> fieldlines;
+  GetFieldLines(fieldlines);
+  // ::WriteFieldLines(filename, fieldlines);
+  ::WriteFieldLinesASCII(filename, fieldlines);
 #endif
 }
 
+bool FieldLineTracer::PrepareSupercurrentField()
+{
+  _J.clear();
+
+  const GLGPU3DDataset *ds = dynamic_cast<const GLGPU3DDataset*>(_ds);
+  if (ds == NULL) return false;
+
+  GLHeader h = ds->GetHeader();
+  for (int k=0; k<3; k++) {
+    _dims[k] = h.dims[k];
+    _pbc[k] = h.pbc[k];
+    _origins[k] = h.origins[k];
+    _cell_lengths[k] = h.cell_lengths[k];
+  }
+
+  const float *J[3] = {
+    ds->SupercurrentDataArray(0), 
+    ds->SupercurrentDataArray(1), 
+    ds->SupercurrentDataArray(2)};
+  float *Jx = NULL, *Jy = NULL, *Jz = NULL;
+  
+  if (J[0] == NULL || J[1] == NULL || J[2] == NULL) {
+    if (ds->ReDataArray() == NULL || ds->ImDataArray() == NULL) return false;
+    GLGPU_IO_Helper_ComputeSupercurrent(h, ds->ReDataArray(), ds->ImDataArray(), &Jx, &Jy, &Jz);
+    J[0] = Jx; J[1] = Jy; J[2] = Jz;
+  }
+
+  const size_t n = (size_t)_dims[0] * _dims[1] * _dims[2];
+  _J.resize(n*3);
+  for (size_t i=0; i<n; i++) {
+    _J[i*3] = J[0][i];
+    _J[i*3+1] = J[1][i];
+    _J[i*3+2] = J[2][i];
+  }
+
+  free(Jx);
+  free(Jy);
+  free(Jz);
+  return true;
+}
+
 void FieldLineTracer::Trace()
 {
   fprintf(stderr, "Trace..\n");
 
-  // const int nseeds[3] = {8, 9, 8};
-  // const int nseeds[3] = {256, 128, 32};
-  // const int nseeds[3] = {128, 64, 32};
-  const int nseeds[3] = {64, 32, 32};
-  const float span[3] = {
-    _ds->Lengths()[0]/(nseeds[0]-1), 
-    _ds->Lengths()[1]/(nseeds[1]-1), 
-    _ds->Lengths()[2]/(nseeds[2]-1)}; 
-
-  for (int i=0; i<nseeds[0]; i++) {
-    for (int j=0; j<nseeds[1]; j++) {
-      for (int k=0; k<nseeds[2]; k++) {
-        float seed[3] = {
-          i * span[0] + _ds->Origins()[0], 
-          j * span[1] + _ds->Origins()[1], 
-          k * span[2] + _ds->Origins()[2]}; 
-        Trace(seed);
+  _verts.clear();
+  _offsets.assign(1, 0);
+
+  // the field is sampled from the grid whenever possible; otherwise it is 
+  // queried from the dataset, in parallel only if the dataset allows
+  const bool gridded = PrepareSupercurrentField();
+
+  // seeds span the domain; a single seed along an axis is at the center
+  float start[3], span[3];
+  for (int k=0; k<3; k++) {
+    span[k] = _nseeds[k] > 1 ? _ds->Lengths()[k]/(_nseeds[k]-1) : 0;
+    start[k] = _ds->Origins()[k] + (_nseeds[k] > 1 ? 0 : 0.5f*_ds->Lengths()[k]);
+  }
+  const int nseeds = _nseeds[0] * _nseeds[1] * _nseeds[2];
+  const int nchunks = (nseeds + seeds_per_chunk - 1) / seeds_per_chunk;
+
+  int nthreads = gridded || _ds->ConcurrentQueries() ? _nthreads : 1;
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  nthreads = std::max(1, std::min(nthreads, nchunks));
+
+  // chunks of seeds are handed out dynamically; each chunk has its own output 
+  // so that the result does not depend on the scheduling
+  std::vector<std::vector<float> > chunk_verts(nchunks);
+  std::vector<std::vector<int> > chunk_counts(nchunks);
+  std::atomic<int> next(0);
+
+  auto worker = [&]() {
+    Sampler sampler;
+    std::vector<float> backward;
+    for (int c = next++; c < nchunks; c = next++) {
+      const int s1 = std::min(nseeds, (c+1)*seeds_per_chunk);
+      for (int s = c*seeds_per_chunk; s < s1; s ++) {
+        const int i = s / (_nseeds[1]*_nseeds[2]), 
+                  j = (s / _nseeds[2]) % _nseeds[1], 
+                  k = s % _nseeds[2];
+        const float seed[3] = {
+          i * span[0] + start[0], 
+          j * span[1] + start[1], 
+          k * span[2] + start[2]}; 
+        Trace(seed, sampler, chunk_verts[c], chunk_counts[c], backward);
       }
     }
+  };
+
+  std::vector<std::thread> threads;
+  for (int tid=1; tid<nthreads; tid++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for (int i=0; i<threads.size(); i++)
+    threads[i].join();
+
+  size_t nverts = 0;
+  for (int c=0; c<nchunks; c++) 
+    nverts += chunk_verts[c].size();
+  _verts.reserve(nverts);
+
+  for (int c=0; c<nchunks; c++) {
+    _verts.insert(_verts.end(), chunk_verts[c].begin(), chunk_verts[c].end());
+    for (int i=0; i<chunk_counts[c].size(); i++)
+      _offsets.push_back(_offsets.back() + chunk_counts[c][i]);
   }
+
+  fprintf(stderr, "#fieldlines=%d, #verts=%d\n", NFieldLines(), (int)(_verts.size()/3));
 }
 
-void FieldLineTracer::Trace(const float seed[3])
+void FieldLineTracer::Trace(const float seed[3], Sampler& sampler, 
+    std::vector<float>& verts, std::vector<int>& counts, std::vector<float>& backward) const
 {
-  static const int max_length = 1024; 
-  const float h = 2; // 0.25; 
-  float X[3] = {seed[0], seed[1], seed[2]}; 
+  const size_t n0 = verts.size();
 
-  FieldLine line;
+  // backward part is traced first and appended in reverse order
+  backward.clear();
+  const int nb = TraceDirection(seed, -1, sampler, backward);
+  for (int i=nb-1; i>=0; i--) 
+    verts.insert(verts.end(), backward.begin() + i*3, backward.begin() + i*3 + 3);
 
-  fprintf(stderr, "Tracing line from X={%f, %f, %f}\n", seed[0], seed[1], seed[2]);
-
-  // forward
-  for (int n=0; n<max_length; n++) {
-    line.push_back(X[0]); line.push_back(X[1]); line.push_back(X[2]); 
-    // if (!RK4(X, h)) break;
-    if (!RK1(X, h)) break;
-  }
- 
-  // backward
-  X[0] = seed[0]; X[1] = seed[1]; X[2] = seed[2];
-  line.pop_front(); line.pop_front(); line.pop_front(); 
-  for (int n=0; n<max_length; n++) {
-    line.push_front(X[2]); line.push_front(X[1]); line.push_front(X[0]); 
-    // if (!RK4(X, -h)) break;
-    if (!RK1(X, -h)) break;
-  }
+  verts.insert(verts.end(), seed, seed+3);
+  const int nf = TraceDirection(seed, 1, sampler, verts);
 
-  // fprintf(stderr, "length=%d\n", line.size()/3);
-  if (line.size()/3 > 10)
-    _fieldlines.push_back(line);
+  const int nv = nb + 1 + nf;
+  if (nv > _min_vertices) 
+    counts.push_back(nv);
+  else 
+    verts.resize(n0);
 }
 
-bool FieldLineTracer::Supercurrent(const float *X, float *J) const
+int FieldLineTracer::TraceDirection(const float seed[3], float dir, Sampler& sampler, std::vector<float>& verts) const
 {
-  return (_ds->Supercurrent(X, J)); 
+  float X[3] = {seed[0], seed[1], seed[2]};
+  float h = _h0, length = 0;
+  int n = 0;
+
+  for (; n<_max_steps && length<_max_length; n++) {
+    const float X0[3] = {X[0], X[1], X[2]};
+    if (!RK45(sampler, X, dir, h)) break;
+
+    verts.insert(verts.end(), X, X+3);
+    length += dist(X0, X);
+  }
+
+  return n;
 }
 
-template <typename T>
-bool FieldLineTracer::RK1(T *X, T h)
+bool FieldLineTracer::Direction(Sampler& s, const float X[3], float dir, float V[3]) const
 {
-  T J[3]; 
-  bool succ = Supercurrent(X, J);
-  if (!succ) return false;
+  float J[3];
+
+  if (_J.empty()) {
+    unsigned char valid;
+    _ds->SupercurrentBatch(1, X, J, &valid, &s.elem);
+    if (!valid) return false;
+  } else {
+    float t[3];
+    int c[3];
+    for (int k=0; k<3; k++) {
+      float g = (X[k] - _origins[k]) / _cell_lengths[k];
+      if (std::isnan(g)) return false;
+      if (_pbc[k]) 
+        g = fmod1(g, (float)_dims[k]);
+      else if (g < 0 || g > _dims[k] - 1) 
+        return false;
+
+      c[k] = std::min((int)g, _dims[k] - (_pbc[k] ? 1 : 2));
+      t[k] = g - c[k];
+    }
 
-  const float threshold = 0.001;
-  float Jmag = sqrt(J[0]*J[0] + J[1]*J[1] + J[2]*J[2]);
-  if (Jmag < threshold) return false;
+    if (!s.cached || c[0] != s.cell[0] || c[1] != s.cell[1] || c[2] != s.cell[2]) {
+      for (int v=0; v<8; v++) {
+        int idx[3];
+        for (int k=0; k<3; k++) {
+          idx[k] = c[k] + ((v >> k) & 1);
+          if (idx[k] >= _dims[k]) idx[k] -= _dims[k]; // periodic
+        }
+        const size_t i = idx[0] + (size_t)_dims[0] * (idx[1] + (size_t)_dims[1] * idx[2]);
+        memcpy(s.C[v], &_J[i*3], sizeof(float)*3);
+      }
+      memcpy(s.cell, c, sizeof(int)*3);
+      s.cached = true;
+    }
 
-  // fprintf(stderr, "X={%f, %f, %f}, J={%f, %f, %f}\n", 
-  //     X[0], X[1], X[2], J[0], J[1], J[2]);
+    const float w[8] = {
+      (1-t[0])*(1-t[1])*(1-t[2]), t[0]*(1-t[1])*(1-t[2]), 
+      (1-t[0])*t[1]*(1-t[2]), t[0]*t[1]*(1-t[2]), 
+      (1-t[0])*(1-t[1])*t[2], t[0]*(1-t[1])*t[2], 
+      (1-t[0])*t[1]*t[2], t[0]*t[1]*t[2]};
+    J[0] = J[1] = J[2] = 0;
+    for (int v=0; v<8; v++) 
+      for (int k=0; k<3; k++) 
+        J[k] += w[v] * s.C[v][k];
+  }
 
-  X[0] = X[0] + h*J[0]; 
-  X[1] = X[1] + h*J[1]; 
-  X[2] = X[2] + h*J[2];
+  const float mag = sqrt(J[0]*J[0] + J[1]*J[1] + J[2]*J[2]);
+  if (!(mag >= _min_magnitude) || mag == 0) return false;
 
-  return true; 
+  const float scale = dir / mag;
+  for (int k=0; k<3; k++) 
+    V[k] = J[k] * scale;
+  return true;
 }
 
-template <typename T>
-bool FieldLineTracer::RK4(T *X, T h)
+// Dormand-Prince 5(4) step along the normalized field, so that h is the arc 
+// length; h is adapted in place.  Returns false where the field cannot be 
+// evaluated even with the minimum step.
+bool FieldLineTracer::RK45(Sampler& s, float X[3], float dir, float& h) const
 {
-  T X0[3] = {X[0], X[1], X[2]};
-  T J[3]; 
-  
-  // 1st RK step
-  if (!Supercurrent(X, J)) return false;
-  T k1[3]; 
-  for (int i=0; i<3; i++) k1[i] = h * J[i];
-  for (int i=0; i<3; i++) X[i] = X0[i] + 0.5 * k1[i];
-  
-  // 2nd RK step
-  if (!Supercurrent(X, J)) return false;
-  T k2[3]; 
-  for (int i=0; i<3; i++) k2[i] = h * J[i];
-  for (int i=0; i<3; i++) X[i] = X0[i] + 0.5 * k2[i];
-  
-  // 3rd RK step
-  if (!Supercurrent(X, J)) return false;
-  T k3[3]; 
-  for (int i=0; i<3; i++) k3[i] = h * J[i];
-  for (int i=0; i<3; i++) X[i] = X0[i] + k3[i];
-
-  // 4th RK step
-  if (!Supercurrent(X, J)) return false;
-  for (int i=0; i<3; i++) 
-    X[i] = X0[i] + (k1[i] + 2.0*(k2[i] + k3[i]) + h*J[i]) / 6.0;
-
-  return true; 
+  static const float 
+    a21 = 1.f/5, 
+    a31 = 3.f/40, a32 = 9.f/40, 
+    a41 = 44.f/45, a42 = -56.f/15, a43 = 32.f/9, 
+    a51 = 19372.f/6561, a52 = -25360.f/2187, a53 = 64448.f/6561, a54 = -212.f/729, 
+    a61 = 9017.f/3168, a62 = -355.f/33, a63 = 46732.f/5247, a64 = 49.f/176, a65 = -5103.f/18656, 
+    b1 = 35.f/384, b3 = 500.f/1113, b4 = 125.f/192, b5 = -2187.f/6784, b6 = 11.f/84, 
+    e1 = 71.f/57600, e3 = -71.f/16695, e4 = 71.f/1920, e5 = -17253.f/339200, e6 = 22.f/525, e7 = -1.f/40;
+
+  float k1[3], k2[3], k3[3], k4[3], k5[3], k6[3], k7[3], Y[3], X1[3];
+  if (!Direction(s, X, dir, k1)) return false;
+
+  while (1) {
+    bool succ = true;
+#define STAGE(k, expr) \
+    for (int i=0; i<3; i++) Y[i] = X[i] + h * (expr); \
+    if (succ) succ = Direction(s, Y, dir, k);
+
+    STAGE(k2, a21*k1[i]);
+    if (succ) {STAGE(k3, a31*k1[i] + a32*k2[i]);}
+    if (succ) {STAGE(k4, a41*k1[i] + a42*k2[i] + a43*k3[i]);}
+    if (succ) {STAGE(k5, a51*k1[i] + a52*k2[i] + a53*k3[i] + a54*k4[i]);}
+    if (succ) {STAGE(k6, a61*k1[i] + a62*k2[i] + a63*k3[i] + a64*k4[i] + a65*k5[i]);}
+    if (succ) {STAGE(k7, b1*k1[i] + b3*k3[i] + b4*k4[i] + b5*k5[i] + b6*k6[i]);}
+#undef STAGE
+
+    if (!succ) { // left the domain or hit a weak field within the step
+      if (h <= _hmin) return false;
+      h = std::max(_hmin, h * 0.25f);
+      continue;
+    }
+
+    float err = 0;
+    for (int i=0; i<3; i++) {
+      X1[i] = Y[i];
+      const float e = h * (e1*k1[i] + e3*k3[i] + e4*k4[i] + e5*k5[i] + e6*k6[i] + e7*k7[i]);
+      err = std::max(err, std::abs(e));
+    }
+
+    const float factor = err > 0 ? 0.9f * pow(_tolerance / err, 0.2f) : 5.f;
+    if (err <= _tolerance || h <= _hmin) {
+      memcpy(X, X1, sizeof(float)*3);
+      h = std::min(_hmax, std::max(_hmin, h * std::min(5.f, factor)));
+      return true;
+    }
+    h = std::max(_hmin, h * std::max(0.2f, factor));
+  }
 }
@@ -5,30 +5,71 @@
 
 class GLDataset;
 
+/*
+ * \class   FieldLineTracer
+ * \brief   Supercurrent field line tracer.  The supercurrent is sampled on
+ *          the grid when the dataset is regular (computed with GLPP if it
+ *          was not precomputed), or queried from datasets that allow
+ *          concurrent queries.  Seeds are traced in parallel with adaptive
+ *          Dormand-Prince (RK45) steps along the normalized field.
+*/
 class FieldLineTracer {
-public: 
-  FieldLineTracer(); 
-  ~FieldLineTracer(); 
+public:
+  FieldLineTracer();
+  ~FieldLineTracer();
 
   void SetDataset(const GLDataset* ds);
+
+  // seeds are placed on a n0*n1*n2 lattice spanning the domain
+  void SetSeedingDensity(int n0, int n1, int n2);
+  void SetNumThreads(int n) {_nthreads = n;} // 0 for all cores
+
+  // termination and step control
+  void SetMaxSteps(int n) {_max_steps = n;} // per direction
+  void SetMaxLength(float l) {_max_length = l;} // arc length per direction
+  void SetMinMagnitude(float j) {_min_magnitude = j;} // stop where |J| is smaller
+  void SetMinVertices(int n) {_min_vertices = n;} // shorter lines are dropped
+  void SetStepSize(float h0, float hmin, float hmax) {_h0 = h0; _hmin = hmin; _hmax = hmax;}
+  void SetTolerance(float tol) {_tolerance = tol;}
+
   void Trace();
 
+  // traced lines in contiguous buffers; line i has the vertices
+  // [offsets[i], offsets[i+1]) of verts (3 floats each)
+  int NFieldLines() const {return (int)_offsets.size() - 1;}
+  const std::vector<float>& Vertices() const {return _verts;}
+  const std::vector<int>& Offsets() const {return _offsets;}
+  void GetFieldLines(std::vector<FieldLine>& lines) const;
+
   void WriteFieldLines(const std::string& filename);
- 
+
 protected:
-  void Trace(const float seed[3]);
+  struct Sampler;
 
-  template <typename T>
-  bool RK1(T pt[3], T h);
-  
-  template <typename T>
-  bool RK4(T pt[3], T h);
-  
-  bool Supercurrent(const float *X, float *J) const;
+  bool PrepareSupercurrentField();
+  void Trace(const float seed[3], Sampler& sampler, std::vector<float>& verts, std::vector<int>& counts, std::vector<float>& backward) const;
+  int TraceDirection(const float seed[3], float dir, Sampler& sampler, std::vector<float>& verts) const;
+
+  bool RK45(Sampler& sampler, float X[3], float dir, float& h) const;
+  bool Direction(Sampler& sampler, const float X[3], float dir, float V[3]) const;
 
 protected:
   const GLDataset *_ds;
-  std::vector<FieldLine> _fieldlines;
-}; 
+
+  int _nseeds[3];
+  int _nthreads;
+  int _max_steps, _min_vertices;
+  float _max_length, _min_magnitude;
+  float _h0, _hmin, _hmax, _tolerance;
+
+  // supercurrent on the grid, interleaved; empty if the dataset is not regular
+  std::vector<float> _J;
+  int _dims[3];
+  bool _pbc[3];
+  float _origins[3], _cell_lengths[3];
+
+  std::vector<float> _verts;
+  std::vector<int> _offsets;
+};
 
 #endif
@@ -18,7 +18,7 @@ int main(int argc, char **argv)
   Condor2Dataset ds(init.comm()); 
   
   ds.OpenDataFile(filename);
-  ds.LoadTimeStep(timestep);
+  ds.LoadTimeStep(timestep, 0);
 
   FieldLineTracer tracer;
   tracer.SetDataset(&ds);
@@ -0,0 +1,132 @@
+#include "frameloader.h"
+
+CFrameLoader::CFrameLoader(int ahead, int behind)
+  : _stop(false), _generation(0), 
+    _ahead(ahead), _behind(behind), 
+    _ts(0), _tl(0), 
+    _current(-1), _dir(1), 
+    _building(-1), _taken(-1)
+{
+  _thread = std::thread(&CFrameLoader::Run, this);
+}
+
+CFrameLoader::~CFrameLoader()
+{
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cond.notify_all();
+  _thread.join();
+}
+
+void CFrameLoader::SetBuilder(const Builder& builder)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _builder = builder;
+  _generation ++;
+  _frames.clear();
+  _cond.notify_all();
+}
+
+void CFrameLoader::SetRange(int ts, int tl)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _ts = ts;
+  _tl = tl;
+  Trim();
+}
+
+bool CFrameLoader::InRange(int t) const
+{
+  return t >= _ts && t < _ts + _tl;
+}
+
+bool CFrameLoader::InWindow(int t) const
+{
+  const int d = (t - _current) * _dir; // steps ahead
+  return d >= -_behind && d <= _ahead;
+}
+
+bool CFrameLoader::NextTimestep(int& t) const
+{
+  if (!_builder || _current < 0) return false;
+
+  // the current timestep first, then those ahead, then those behind
+  for (int i=0; i<=_ahead+_behind; i++) {
+    const int d = i <= _ahead ? i : _ahead - i;
+    t = _current + d*_dir;
+    if (InRange(t) && t != _taken && t != _building && _frames.find(t) == _frames.end())
+      return true;
+  }
+  return false;
+}
+
+void CFrameLoader::Trim()
+{
+  for (std::map<int, Frame>::iterator it = _frames.begin(); it != _frames.end(); ) {
+    if (!InRange(it->first) || !InWindow(it->first))
+      _frames.erase(it ++);
+    else 
+      ++ it;
+  }
+}
+
+CFrameLoader::Frame CFrameLoader::Request(int t, int dir)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (!_builder || !InRange(t)) return Frame();
+
+  _taken = -1; // the caller has given up its previous frame
+  _current = t;
+  if (dir != 0) _dir = dir > 0 ? 1 : -1;
+  Trim();
+  _cond.notify_all();
+
+  // the loader builds the current timestep before any other, or this 
+  // thread waits for it if it is already under construction
+  _ready.wait(lock, [this, t]() {return _frames.find(t) != _frames.end();});
+
+  Frame frame = _frames[t];
+  _frames.erase(t);
+  _taken = t;
+
+  _cond.notify_all(); // the window may have moved while waiting
+  return frame;
+}
+
+void CFrameLoader::Return(const Frame& frame)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (frame->timestep == _taken) _taken = -1;
+  if (frame->generation == _generation && InRange(frame->timestep) && InWindow(frame->timestep)
+      && _frames.find(frame->timestep) == _frames.end())
+    _frames[frame->timestep] = frame;
+  _cond.notify_all();
+}
+
+void CFrameLoader::Run()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (1) {
+    int t = -1;
+    _cond.wait(lock, [this, &t]() {return _stop || NextTimestep(t);});
+    if (_stop) break;
+
+    const Builder builder = _builder;
+    const unsigned int generation = _generation;
+    _building = t;
+    lock.unlock();
+
+    Frame frame(new CVortexFrame);
+    frame->timestep = t;
+    frame->generation = generation;
+    builder(t, *frame);
+
+    lock.lock();
+    _building = -1;
+    if (generation == _generation && InRange(t) && (InWindow(t) || t == _current)) 
+      _frames[t] = frame;
+    _ready.notify_all();
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef _FRAMELOADER_H
+#define _FRAMELOADER_H
+
+#include <QVector>
+#include <QVector3D>
+#include <QColor>
+#include <QGLWidget>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "common/VortexTube.h"
+
+/*
+ * \struct  CVortexFrame
+ * \brief   Render-ready vortex line geometry of a timestep
+*/
+struct CVortexFrame {
+  int timestep;
+  unsigned int generation; // of the loader that built it
+
+  std::vector<GLfloat> line_vertices;
+  std::vector<GLubyte> line_colors; // RGBA
+  std::vector<GLsizei> line_vert_count;
+  std::vector<GLint> line_indices;
+
+  VortexTubeMesh tubes;
+
+  std::vector<float> mds_coords;
+
+  QVector<int> vids;
+  QVector<QVector3D> vids_coord;
+  QVector<QColor> vids_colors;
+  QVector<float> vids_speed;
+};
+
+/*
+ * \class   CFrameLoader
+ * \brief   Builds vortex frames on a background thread, ahead of the
+ *          timestep that is being viewed.  Prepared frames are kept in a
+ *          ring around the current timestep, biased in the direction of
+ *          travel, so that stepping through the timesteps only swaps
+ *          buffers on the GUI thread.
+*/
+class CFrameLoader {
+public:
+  typedef std::shared_ptr<CVortexFrame> Frame;
+  typedef std::function<void(int timestep, CVortexFrame&)> Builder;
+
+  CFrameLoader(int ahead=6, int behind=2);
+  ~CFrameLoader();
+
+  // the builder runs on the loader thread; setting it discards the
+  // prepared frames, e.g. when the render options change
+  void SetBuilder(const Builder& builder);
+  void SetRange(int ts, int tl);
+
+  // makes t the current timestep (dir is the direction of travel), and
+  // hands its frame over to the caller, waiting for it to be built if it
+  // is not prepared; NULL if t is out of range or there is no builder
+  Frame Request(int t, int dir);
+
+  // gives a frame back after use, so that it does not have to be built
+  // again when the viewer steps back; dropped if it is outdated
+  void Return(const Frame& frame);
+
+private:
+  void Run();
+  bool InRange(int t) const;
+  bool InWindow(int t) const;
+  bool NextTimestep(int& t) const; // the most urgent timestep to prepare
+  void Trim(); // drops the frames outside the window
+
+private:
+  std::mutex _mutex;
+  std::condition_variable _cond, _ready;
+  std::thread _thread;
+  bool _stop;
+
+  Builder _builder;
+  unsigned int _generation; // bumped by SetBuilder()
+  int _ahead, _behind;
+  int _ts, _tl;
+  int _current, _dir;
+  int _building; // timestep under construction, or -1
+  int _taken; // timestep whose frame is held by the caller, or -1
+
+  std::map<int, Frame> _frames;
+};
+
+#endif
@@ -57,9 +57,18 @@ CGLWidget::CGLWidget(const QGLFormat& fmt, QWidget *parent, QGLWidget *sharedWid
     _ts(0), _tl(0), 
     _rc(NULL), _rc_fb(NULL),
     _ds(NULL), _vt(NULL),
-    h_max(0)
+    _lod(0),
+    _timestep(0),
+    _has_frame_options(false),
+    h_max(0),
+    _use_vbo(false), 
+    _lines_dirty(true), _history_dirty(true), 
+    _vbo_line_vertices(0), _vbo_line_colors(0), 
+    _vbo_tube_vertices(0), _vbo_tube_colors(0), _ibo_tube_indices(0),
+    _vbo_history_vertices(0), _vbo_history_colors(0)
 {
   _ilrender = new ILines::ILRender;
+  _loader = new CFrameLoader;
 
   // _vips << 39 << 40 << 43 << 44;
   // _vips << 3 << 15 << 16 << 17 << 18 << 19; 
@@ -68,6 +77,11 @@ CGLWidget::CGLWidget(const QGLFormat& fmt, QWidget *parent, QGLWidget *sharedWid
 
 CGLWidget::~CGLWidget()
 {
+  delete _loader; // joins the loader thread, which reads the DB
+
+  makeCurrent();
+  deleteBuffers();
+
   delete _ilrender;
   if (_ds != NULL)
     delete _ds;
@@ -83,6 +97,7 @@ void CGLWidget::SetData(const std::string& dataname, int ts, int tl)
   _dataname = dataname;
   _ts = ts; 
   _tl = tl;
+  _loader->SetRange(ts, tl);
 }
 
 void CGLWidget::SetVortexTransition(const VortexTransition *vt)
@@ -99,10 +114,11 @@ void CGLWidget::OpenGLGPUDataset()
 void CGLWidget::LoadTimeStep(int t)
 {
   if (t<_ts || t>=_ts+_tl) return;
-  _timestep = t;
   
   Clear();
-  LoadVortexLines();
+  const int dir = t - _timestep;
+  _timestep = t;
+  LoadVortexLines(dir);
   
   if (_ds != NULL) {
     _ds->LoadTimeStep(t, 0);
@@ -112,6 +128,7 @@ void CGLWidget::LoadTimeStep(int t)
 
 void CGLWidget::LoadVortexLines2D()
 {
+  _frame.reset(); // the buffers no longer belong to a loaded frame
   QMap<int, QVector<float> > lines;
   QMap<int, QColor> colors;
   const float delta = 0.1;
@@ -321,12 +338,21 @@ void CGLWidget::keyPressEvent(QKeyEvent* e)
 void CGLWidget::wheelEvent(QWheelEvent* e)
 {
   _trackball.wheel(e->delta());
+  if (SelectLOD() != _lod) {
+    Clear();
+    LoadVortexLines();
+  }
   updateGL(); 
 }
 
 void CGLWidget::initializeGL()
 {
-  glewInit();
+  const bool glew = glewInit() == GLEW_OK;
+  _use_vbo = glew && GLEW_VERSION_1_5 && getenv("VF2_NO_VBO") == NULL;
+  if (!_use_vbo) 
+    fprintf(stderr, "buffer objects not available, using client-side arrays\n");
+  _lines_dirty = _history_dirty = true;
+
   initIL();
 
   _trackball.init();
@@ -587,8 +613,9 @@ void CGLWidget::renderVortexPoints()
 {
   glEnableClientState(GL_VERTEX_ARRAY); 
   glEnableClientState(GL_COLOR_ARRAY); 
-  glVertexPointer(3, GL_FLOAT, 0, v_line_vertices.data()); 
-  glColorPointer(4, GL_UNSIGNED_BYTE, 4*sizeof(GLubyte), v_line_colors.data());
+  glVertexPointer(3, GL_FLOAT, 0, bindArray(GL_ARRAY_BUFFER, _vbo_line_vertices, v_line_vertices.data())); 
+  glColorPointer(4, GL_UNSIGNED_BYTE, 4*sizeof(GLubyte), bindArray(GL_ARRAY_BUFFER, _vbo_line_colors, v_line_colors.data()));
+  bindArray(GL_ARRAY_BUFFER, 0, NULL);
 
   glMultiDrawArrays(
       GL_POINTS, 
@@ -617,8 +644,9 @@ void CGLWidget::renderVortexLines()
 {
   glEnableClientState(GL_VERTEX_ARRAY); 
   glEnableClientState(GL_COLOR_ARRAY); 
-  glVertexPointer(3, GL_FLOAT, 0, v_line_vertices.data()); 
-  glColorPointer(4, GL_UNSIGNED_BYTE, 4*sizeof(GLubyte), v_line_colors.data());
+  glVertexPointer(3, GL_FLOAT, 0, bindArray(GL_ARRAY_BUFFER, _vbo_line_vertices, v_line_vertices.data())); 
+  glColorPointer(4, GL_UNSIGNED_BYTE, 4*sizeof(GLubyte), bindArray(GL_ARRAY_BUFFER, _vbo_line_colors, v_line_colors.data()));
+  bindArray(GL_ARRAY_BUFFER, 0, NULL);
 
 #if 0
   _ilrender->enableZSort(true);
@@ -645,34 +673,36 @@ void CGLWidget::renderVortexLines()
 
 void CGLWidget::renderHistoryVortexLines()
 {
+  if (h_packed_vert_count.empty()) return;
+
   _ilrender->enableZSort(true);
   glLineWidth(3.f);
   glEnable(GL_DEPTH_TEST);
  
-  for (int i=0; i<h_line_vertices.size(); i++) {
-    glEnableClientState(GL_VERTEX_ARRAY); 
-    glEnableClientState(GL_COLOR_ARRAY); 
-    glVertexPointer(3, GL_FLOAT, 0, h_line_vertices[i].data());
-    glColorPointer(4, GL_UNSIGNED_BYTE, 4*sizeof(GLubyte), h_line_colors[i].data());
-
-    if (_toggle_il) {
-      // glDepthMask(GL_FALSE);
-      _ilrender->multiDrawArrays(
-          h_line_indices[i].data(),
-          h_line_vert_count[i].data(), 
-          h_line_vert_count[i].size());
-      // glDepthMask(GL_TRUE);
-    }
-    else 
-      glMultiDrawArrays(
-          GL_LINE_STRIP, 
-          h_line_indices[i].data(), 
-          h_line_vert_count[i].data(), 
-          h_line_vert_count[i].size());
-
-    glDisableClientState(GL_COLOR_ARRAY); 
-    glDisableClientState(GL_VERTEX_ARRAY);
+  // all history frames at once, see packHistory()
+  glEnableClientState(GL_VERTEX_ARRAY); 
+  glEnableClientState(GL_COLOR_ARRAY); 
+  glVertexPointer(3, GL_FLOAT, 0, bindArray(GL_ARRAY_BUFFER, _vbo_history_vertices, h_packed_vertices.data()));
+  glColorPointer(4, GL_UNSIGNED_BYTE, 4*sizeof(GLubyte), bindArray(GL_ARRAY_BUFFER, _vbo_history_colors, h_packed_colors.data()));
+
+  if (_toggle_il) {
+    // glDepthMask(GL_FALSE);
+    _ilrender->multiDrawArrays(
+        h_packed_indices.data(),
+        h_packed_vert_count.data(), 
+        h_packed_vert_count.size());
+    // glDepthMask(GL_TRUE);
   }
+  else 
+    glMultiDrawArrays(
+        GL_LINE_STRIP, 
+        h_packed_indices.data(), 
+        h_packed_vert_count.data(), 
+        h_packed_vert_count.size());
+
+  bindArray(GL_ARRAY_BUFFER, 0, NULL);
+  glDisableClientState(GL_COLOR_ARRAY); 
+  glDisableClientState(GL_VERTEX_ARRAY);
 
   CHECK_GLERROR();
 }
@@ -691,10 +721,14 @@ void CGLWidget::renderVortexTubes()
   glEnableClientState(GL_NORMAL_ARRAY); 
   glEnableClientState(GL_COLOR_ARRAY); 
 
-  glVertexPointer(3, GL_FLOAT, 0, vortex_tube_vertices.data()); 
-  glNormalPointer(GL_FLOAT, 0, vortex_tube_normals.data()); 
-  glColorPointer(3, GL_UNSIGNED_BYTE, 0, vortex_tube_colors.data()); 
-  glDrawElements(GL_TRIANGLES, vortex_tube_indices_vertices.size(), GL_UNSIGNED_INT, vortex_tube_indices_vertices.data()); 
+  const GLfloat *vertices = (const GLfloat*)bindArray(GL_ARRAY_BUFFER, _vbo_tube_vertices, vortex_tubes.vertices.data());
+  glVertexPointer(3, GL_FLOAT, sizeof(GLfloat)*6, vertices); 
+  glNormalPointer(GL_FLOAT, sizeof(GLfloat)*6, vertices + 3); 
+  glColorPointer(3, GL_UNSIGNED_BYTE, 0, bindArray(GL_ARRAY_BUFFER, _vbo_tube_colors, vortex_tubes.colors.data())); 
+  glDrawElements(GL_TRIANGLES, vortex_tubes.indices.size(), GL_UNSIGNED_INT, 
+      bindArray(GL_ELEMENT_ARRAY_BUFFER, _ibo_tube_indices, vortex_tubes.indices.data())); 
+  bindArray(GL_ARRAY_BUFFER, 0, NULL);
+  bindArray(GL_ELEMENT_ARRAY_BUFFER, 0, NULL);
 
   glPopClientAttrib(); 
 
@@ -750,6 +784,8 @@ void CGLWidget::paintGL()
   glLoadIdentity(); 
   glLoadMatrixd(_mvmatrix.data()); 
 
+  updateBuffers();
+
 #if 0
   glEnable(GL_DEPTH_TEST);
   glColor3f(0.f, 0.f, 0.f);
@@ -830,15 +866,18 @@ void CGLWidget::LoadFieldLines(const std::string& filename)
 
 void CGLWidget::Clear()
 {
+  _lines_dirty = true;
+  if (_frame) { // keep the frame in the loader's ring for stepping back
+    swapFrame(*_frame);
+    _loader->Return(_frame);
+    _frame.reset();
+  }
+
   v_line_vertices.clear();
   v_line_colors.clear();
   v_line_vert_count.clear();
   v_line_indices.clear();
-  vortex_tube_vertices.clear();
-  vortex_tube_normals.clear();
-  vortex_tube_colors.clear();
-  vortex_tube_indices_lines.clear();
-  vortex_tube_indices_vertices.clear();
+  vortex_tubes.clear();
 
   f_line_vertices.clear();
   f_line_colors.clear();
@@ -863,32 +902,125 @@ void CGLWidget::SetDB(rocksdb::DB* db)
   std::string buf;
   rocksdb::Status s = _db->Get(rocksdb::ReadOptions(), "hdrs", &buf);
   diy::unserialize(buf, vfgpu_hdrs);
+
+  // databases written without levels of detail simplify on the fly, as in
+  // the web viewer
+  _lod_tolerances.clear();
+  s = _db->Get(rocksdb::ReadOptions(), "lods", &buf);
+  if (s.ok()) 
+    diy::unserialize(buf, _lod_tolerances);
+  else {
+    s = _db->Get(rocksdb::ReadOptions(), "cfg", &buf);
+    if (s.ok()) {
+      vfgpu_cfg_t cfg;
+      diy::unserialize(buf, cfg);
+      DefaultVortexLineLODTolerances(cfg.cell_lengths, _lod_tolerances);
+    }
+  }
 }
 #endif
 
-void CGLWidget::LoadVortexLines()
+int CGLWidget::SelectLOD() const
+{
+  // data units per pixel at the center of the view, see paintGL()
+  const float d = (_eye - _center).length(), 
+              scale = _trackball.getScale() * 0.02;
+  const float max_error = 2 * d * tan(_fovy * M_PI / 360) / (height() * scale);
+  return SelectVortexLineLOD(_lod_tolerances, max_error);
+}
+
+CGLWidget::FrameOptions CGLWidget::currentFrameOptions() const
+{
+  FrameOptions opts;
+  opts.lod = SelectLOD();
+  opts.bezier = _toggle_bezier;
+  opts.vip = _toggle_vip;
+  opts.mds = _vortex_render_mode == 4;
+  opts.vips = _vips;
+  return opts;
+}
+
+void CGLWidget::LoadVortexLines(int dir)
+{
+  // frames are built by the loader thread; a change of the options that the
+  // geometry depends on restarts it with a new builder
+  const FrameOptions opts = currentFrameOptions();
+  if (!_has_frame_options || !(opts == _frame_options)) {
+    _frame_options = opts;
+    _has_frame_options = true;
+    _loader->SetBuilder(std::bind(&CGLWidget::buildFrame, this, opts, 
+          std::placeholders::_1, std::placeholders::_2));
+  }
+  
+  _frame.reset();
+  CFrameLoader::Frame frame = _loader->Request(_timestep, dir);
+  if (!frame) return;
+
+  _lod = opts.lod;
+  swapFrame(*frame);
+  _frame = frame;
+}
+
+void CGLWidget::swapFrame(CVortexFrame& f)
+{
+  _lines_dirty = true;
+  v_line_vertices.swap(f.line_vertices);
+  v_line_colors.swap(f.line_colors);
+  v_line_vert_count.swap(f.line_vert_count);
+  v_line_indices.swap(f.line_indices);
+
+  vortex_tubes.swap(f.tubes);
+
+  v_mds_coords.swap(f.mds_coords);
+
+  _vids.swap(f.vids);
+  _vids_coord.swap(f.vids_coord);
+  _vids_colors.swap(f.vids_colors);
+  _vids_speed.swap(f.vids_speed);
+}
+
+void CGLWidget::buildFrame(const FrameOptions& opts, int timestep, CVortexFrame& frame) const
 {
 #if WITH_ROCKSDB
-  // vortex lines
+  // vortex lines at the level of detail that matches the zoom; the resampled 
+  // geometry is used if the extractor cached it
+  const int lod = opts.lod;
   std::stringstream ss;
-  ss << "v." << _vt->TimestepToFrame(_timestep);
-  const std::string key = ss.str();
   std::string info_bytes, buf;
 
-  rocksdb::Status s = _db->Get(rocksdb::ReadOptions(), key, &buf);
   std::vector<VortexLine> vlines;
-  diy::unserialize(buf, vlines);
-  for (int i=0; i<vlines.size(); i++) {
-    if (vlines[i].is_bezier) {
-      vlines[i].ToRegular(500);
-    }
-    else 
-      vlines[i].RemoveInvalidPoints();
+  rocksdb::Status s;
+  bool precomputed = false;
+  if (lod > 0) {
+    ss << "l" << lod << "." << _vt->TimestepToFrame(timestep);
+    s = _db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+    precomputed = s.ok();
+    ss.str("");
+  }
+
+  if (!precomputed) {
+    ss << "r." << _vt->TimestepToFrame(timestep);
+    s = _db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+  }
+  if (s.ok()) 
+    diy::unserialize(buf, vlines);
+  else {
+    ss.str("");
+    ss << "v." << _vt->TimestepToFrame(timestep);
+    s = _db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+    diy::unserialize(buf, vlines);
+    ResampleVortexLines(vlines, 500);
+  }
+
+  if (lod > 0 && !precomputed) {
+    VortexLineWorkspace ws;
+    for (int i=0; i<vlines.size(); i++)
+      vlines[i].SimplifyDP(_lod_tolerances[lod], &ws);
   }
 
-  if (_vortex_render_mode == 4) {
-    ss.clear(); 
-    ss << "d." << _vt->TimestepToFrame(_timestep);
+  if (opts.mds) {
+    ss.str(""); 
+    ss << "d." << _vt->TimestepToFrame(timestep);
     s = _db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
     
     std::vector<float> fdist;
@@ -901,18 +1033,18 @@ void CGLWidget::LoadVortexLines()
     int nelems = vlines.size();
     cmds2_(&nelems, dist.data(), coords.data());
 
-    v_mds_coords.resize(nelems*2);
+    frame.mds_coords.resize(nelems*2);
     for (int i=0; i<nelems; i++) {
-      v_mds_coords[i*2] = coords[i];
-      v_mds_coords[i*2+1] = coords[i+nelems];
+      frame.mds_coords[i*2] = coords[i];
+      frame.mds_coords[i*2+1] = coords[i+nelems];
     }
 #endif
   }
 
-  fprintf(stderr, "Loaded vortex line from DB, key=%s\n", key.c_str());
+  fprintf(stderr, "Loaded vortex lines from DB, frame=%d\n", _vt->TimestepToFrame(timestep));
 #else
   std::stringstream ss;
-  ss << _dataname << ".vlines." << _timestep;
+  ss << _dataname << ".vlines." << timestep;
   const std::string filename = ss.str();
 
   std::string info_bytes;
@@ -926,98 +1058,46 @@ void CGLWidget::LoadVortexLines()
   generate_random_colors(vlines.size(), random_colors);
   for (int i=0; i<vlines.size(); i++) {
 #if 0
-    vlines[i].gid = _vt->lvid2gvid(_timestep, vlines[i].id);
+    vlines[i].gid = _vt->lvid2gvid(timestep, vlines[i].id);
     _vt->SequenceColor(vlines[i].gid, vlines[i].r, vlines[i].g, vlines[i].b);
-    // fprintf(stderr, "t=%d, lid=%d, gid=%d\n", _timestep, vlines[i].id, vlines[i].gid);
+    // fprintf(stderr, "t=%d, lid=%d, gid=%d\n", timestep, vlines[i].id, vlines[i].gid);
 #else
     vlines[i].r = random_colors[i*3];
     vlines[i].g = random_colors[i*3+1];
     vlines[i].b = random_colors[i*3+2];
 #endif
   }
-  
-  if (_timestep == 249) {
-    fprintf(stderr, "shit\n");
-    for (int i=0; i<vlines.size(); i++) {
-      if (vlines[i].gid == 203) {
-        vlines[i].Print();
-      }
-    }
-  }
-
 
   // const float O[3] = {_data_info.ox(), _data_info.oy(), _data_info.oz()},
   //              L[3] = {_data_info.lx(), _data_info.ly(), _data_info.lz()};
 
-  int vertCount = 0; 
   for (int k=0; k<vlines.size(); k++) { //iterator over lines
-    if (_toggle_vip && !_vips.contains(vlines[k].gid)) continue;
+    if (opts.vip && !opts.vips.contains(vlines[k].gid)) continue;
 
     if (vlines[k].size()>=3) {
-      _vids.push_back(vlines[k].gid);
-#if 0
-      // search for the min(x) point
-      QVector3D maxv;
-      int maxi;
-      for (int i=0; i<vlines[k].size()/3; i++) {
-        if (vlines[k][i*3] < minx) {
-          minx = vlines[k][i*3];
-          minxi = i;
-        }
-      }
-      QVector3D pt(vlines[k][minxi*3], 
-                   vlines[k][minxi*3+1],
-                   vlines[k][minxi*3+2]);
-#else
+      frame.vids.push_back(vlines[k].gid);
       QVector3D pt(*(vlines[k].begin()), 
                    *(vlines[k].begin()+1),
                    *(vlines[k].begin()+2));
-#endif
-      _vids_coord.push_back(pt);
+      frame.vids_coord.push_back(pt);
       
       QColor color(vlines[k].r, vlines[k].g, vlines[k].b);
-      _vids_colors.push_back(color);
-      _vids_speed.push_back(vlines[k].moving_speed);
+      frame.vids_colors.push_back(color);
+      frame.vids_speed.push_back(vlines[k].moving_speed);
     }
 
-    if (_toggle_bezier) {
+    if (opts.bezier) {
       // vlines[k].Flattern(O, L);
       vlines[k].ToBezier();
     }
 
     if (vlines[k].is_bezier) { // TODO: make it more graceful..
-      VortexLine& vl = vlines[k];
-      const int span = vl.size()/4/2/2;
-      // const int span = 18;
-
-#if 0
-      for (int i=4*span; i<vl.size()/3; i+=4*span) {
-#if 0
-        QVector3D p(
-            fmod1(vl[i*3]-O[0], L[0]) + O[0], 
-            fmod1(vl[i*3+1]-O[1], L[1]) + O[1], 
-            fmod1(vl[i*3+2]-O[2], L[2]) + O[2]);
-#else
-        QVector3D p(vl[i*3], vl[i*3+1], vl[i*3+2]);
-#endif
-        QVector3D p0(vl[i*3], vl[i*3+1], vl[i*3+2]), 
-                  p1(vl[i*3+3], vl[i*3+4], vl[i*3+5]);
-        QVector3D d = (p1 - p0).normalized();
-        QColor color(vl.r, vl.g, vl.b);
-
-        _cones_pos.push_back(p);
-        _cones_dir.push_back(d);
-        _cones_color.push_back(color);
-      }
-#endif
-
-      vl.ToRegular(100);
+      vlines[k].ToRegular(100);
       // vl.Unflattern(O, L);
     }
     
     std::vector<float>::iterator it = vlines[k].begin();
     unsigned char c[3] = {vlines[k].r, vlines[k].g, vlines[k].b};
-    QVector3D p0;
     for (int i=0; i<vlines[k].size()/3; i++) {
       QVector3D p(*it, *(++it), *(++it));
       it ++;
@@ -1028,42 +1108,32 @@ void CGLWidget::LoadVortexLines()
         c[2] = 0;
       }
       
-      v_line_vertices.push_back(p.x()); 
-      v_line_vertices.push_back(p.y()); 
-      v_line_vertices.push_back(p.z()); 
-      v_line_colors.push_back(c[0]); 
-      v_line_colors.push_back(c[1]); 
-      v_line_colors.push_back(c[2]); 
-      v_line_colors.push_back(255); 
-
-      if (i>0 && (p-p0).length()>5) {
-        v_line_vert_count.push_back(vertCount); 
-        vertCount = 0;
-      }
-      p0 = p;
-      
-      vertCount ++;
+      frame.line_vertices.push_back(p.x()); 
+      frame.line_vertices.push_back(p.y()); 
+      frame.line_vertices.push_back(p.z()); 
+      frame.line_colors.push_back(c[0]); 
+      frame.line_colors.push_back(c[1]); 
+      frame.line_colors.push_back(c[2]); 
+      frame.line_colors.push_back(255); 
     }
 
-    if (vertCount != 0) {
-      v_line_vert_count.push_back(vertCount); 
-      vertCount = 0;
-    }
+    vlines[k].Pieces(frame.line_vert_count);
   }
   
   int cnt = 0; 
-  for (int i=0; i<v_line_vert_count.size(); i++) {
-    v_line_indices.push_back(cnt); 
-    cnt += v_line_vert_count[i]; 
-    // fprintf(stderr, "break, vertCount=%d, lineIndices=%d\n", v_line_vert_count[i], v_line_indices[i]);
+  for (int i=0; i<frame.line_vert_count.size(); i++) {
+    frame.line_indices.push_back(cnt); 
+    cnt += frame.line_vert_count[i]; 
   }
-  // v_line_indices.push_back(cnt); 
 
-  updateVortexTubes(20, 0.3); 
+  BuildVortexTubes(frame.line_vertices.data(), frame.line_colors.data(), 
+      frame.line_vert_count.data(), frame.line_indices.data(), frame.line_vert_count.size(), 
+      20, 0.3, frame.tubes);
 }
 
 void CGLWidget::LoadVortexLinesFromTextFile(const std::string& filename)
 {
+  _frame.reset(); // the buffers no longer belong to a loaded frame
   std::ifstream ifs; 
   ifs.open(filename.c_str());
   if (!ifs.is_open()) return;
@@ -1127,75 +1197,10 @@ void CGLWidget::LoadInclusionsFromTextFile(const std::string& filename)
 ////////////////
 void CGLWidget::updateVortexTubes(int nPatches, float radius) 
 {
-  vortex_tube_vertices.clear(); 
-  vortex_tube_normals.clear(); 
-  vortex_tube_colors.clear(); 
-  vortex_tube_indices_lines.clear(); 
-  vortex_tube_indices_vertices.clear(); 
-
-  for (int i=0; i<v_line_vert_count.size(); i++) {
-    if (v_line_vert_count[i] < 2) continue; 
-     
-    int first = v_line_indices[i]; 
-    QVector3D N0; 
-    for (int j=1; j<v_line_vert_count[i]; j++) {
-      QVector3D P0 = QVector3D(v_line_vertices[(first+j-1)*3], v_line_vertices[(first+j-1)*3+1], v_line_vertices[(first+j-1)*3+2]); 
-      QVector3D P  = QVector3D(v_line_vertices[(first+j)*3], v_line_vertices[(first+j)*3+1], v_line_vertices[(first+j)*3+2]);
-      GLubyte color[3] = {v_line_colors[(first+j)*4], v_line_colors[(first+j)*4+1], v_line_colors[(first+j)*4+2]}; 
-
-      QVector3D T = (P - P0).normalized(); 
-      QVector3D N = QVector3D(-T.y(), T.x(), 0.0).normalized(); 
-      QVector3D B = QVector3D::crossProduct(N, T); 
-
-      if (N.length() == 0 || isnan(N.length())) N=QVector3D(1,0,0);
-      // if (N.length() == 0 || isnan(N.length())) continue;
-
-      if (j>1) {
-        float n0 = QVector3D::dotProduct(N0, N); 
-        float b0 = QVector3D::dotProduct(N0, B);
-        QVector3D N1 = n0 * N + b0 * B;
-        N = N1.normalized(); 
-        B = QVector3D::crossProduct(N, T).normalized(); 
-      }
-      N0 = N;
-
-      const int nIteration = (j==1)?2:1; 
-      for (int k=0; k<nIteration; k++) {
-        for (int p=0; p<nPatches; p++) {
-          float angle = p * 2.f * M_PI / nPatches; 
-          QVector3D normal = (N*cos(angle) + B*sin(angle)).normalized(); 
-          QVector3D offset = normal * radius; 
-          QVector3D coord; 
-
-          if (k==0 && j==1) coord = P0 + offset; 
-          else coord = P + offset; 
-
-          vortex_tube_vertices.push_back(coord.x()); 
-          vortex_tube_vertices.push_back(coord.y()); 
-          vortex_tube_vertices.push_back(coord.z()); 
-          // vortex_tube_vertices.push_back(1); 
-          vortex_tube_normals.push_back(normal.x()); 
-          vortex_tube_normals.push_back(normal.y()); 
-          vortex_tube_normals.push_back(normal.z()); 
-          vortex_tube_colors.push_back(color[0]); 
-          vortex_tube_colors.push_back(color[1]); 
-          vortex_tube_colors.push_back(color[2]);
-          vortex_tube_indices_lines.push_back(j); 
-        }
-      }
-
-      for (int p=0; p<nPatches; p++) {
-        const int n = vortex_tube_vertices.size()/3; 
-        const int pn = (p+1)%nPatches; 
-        vortex_tube_indices_vertices.push_back(n-nPatches+p); 
-        vortex_tube_indices_vertices.push_back(n-nPatches-nPatches+pn); 
-        vortex_tube_indices_vertices.push_back(n-nPatches-nPatches+p); 
-        vortex_tube_indices_vertices.push_back(n-nPatches+p); 
-        vortex_tube_indices_vertices.push_back(n-nPatches+pn); 
-        vortex_tube_indices_vertices.push_back(n-nPatches-nPatches+pn); 
-      }
-    }
-  }
+  _lines_dirty = true;
+  BuildVortexTubes(v_line_vertices.data(), v_line_colors.data(), 
+      v_line_vert_count.data(), v_line_indices.data(), v_line_vert_count.size(), 
+      nPatches, radius, vortex_tubes);
 }
 
 void CGLWidget::extractIsosurfaces()
@@ -1304,6 +1309,7 @@ void CGLWidget::addCurrentLineToHistory()
   }
 
   correctHistoryAlpha();
+  _history_dirty = true;
 }
 
 void CGLWidget::correctHistoryAlpha()
@@ -1328,4 +1334,82 @@ void CGLWidget::clearHistory()
   h_line_colors.clear();
   h_line_vert_count.clear();
   h_line_indices.clear();
+  _history_dirty = true;
+}
+
+void CGLWidget::packHistory()
+{
+  const int n = h_line_vertices.size();
+  h_frame_offsets.resize(n+1);
+  h_frame_offsets[0] = 0;
+  for (int i=0; i<n; i++)
+    h_frame_offsets[i+1] = h_frame_offsets[i] + h_line_vertices[i].size()/3;
+
+  h_packed_vertices.resize(h_frame_offsets[n]*3);
+  h_packed_colors.resize(h_frame_offsets[n]*4);
+  h_packed_vert_count.clear();
+  h_packed_indices.clear();
+
+  for (int i=0; i<n; i++) {
+    const int offset = h_frame_offsets[i];
+    std::copy(h_line_vertices[i].begin(), h_line_vertices[i].end(), h_packed_vertices.begin() + offset*3);
+    std::copy(h_line_colors[i].begin(), h_line_colors[i].end(), h_packed_colors.begin() + offset*4);
+    for (int j=0; j<h_line_vert_count[i].size(); j++) {
+      h_packed_vert_count.push_back(h_line_vert_count[i][j]);
+      h_packed_indices.push_back(h_line_indices[i][j] + offset);
+    }
+  }
+}
+
+template <typename T>
+static void upload_buffer(GLenum target, GLuint& buf, const std::vector<T>& data)
+{
+  if (buf == 0) glGenBuffers(1, &buf);
+  glBindBuffer(target, buf);
+  glBufferData(target, sizeof(T)*data.size(), data.empty() ? NULL : data.data(), GL_STATIC_DRAW);
+  glBindBuffer(target, 0);
+}
+
+void CGLWidget::updateBuffers()
+{
+  const bool history = _history_dirty && _toggle_history;
+  if (history) 
+    packHistory();
+
+  if (_use_vbo && _lines_dirty) {
+    upload_buffer(GL_ARRAY_BUFFER, _vbo_line_vertices, v_line_vertices);
+    upload_buffer(GL_ARRAY_BUFFER, _vbo_line_colors, v_line_colors);
+    upload_buffer(GL_ARRAY_BUFFER, _vbo_tube_vertices, vortex_tubes.vertices);
+    upload_buffer(GL_ARRAY_BUFFER, _vbo_tube_colors, vortex_tubes.colors);
+    upload_buffer(GL_ELEMENT_ARRAY_BUFFER, _ibo_tube_indices, vortex_tubes.indices);
+  }
+
+  if (_use_vbo && history) {
+    upload_buffer(GL_ARRAY_BUFFER, _vbo_history_vertices, h_packed_vertices);
+    upload_buffer(GL_ARRAY_BUFFER, _vbo_history_colors, h_packed_colors);
+    std::vector<GLfloat>().swap(h_packed_vertices); // only needed for the upload
+    std::vector<GLubyte>().swap(h_packed_colors);
+  }
+
+  _lines_dirty = false;
+  if (history) _history_dirty = false;
+
+  CHECK_GLERROR();
+}
+
+void CGLWidget::deleteBuffers()
+{
+  if (!_use_vbo) return;
+
+  GLuint bufs[] = {_vbo_line_vertices, _vbo_line_colors, 
+    _vbo_tube_vertices, _vbo_tube_colors, _ibo_tube_indices, 
+    _vbo_history_vertices, _vbo_history_colors};
+  glDeleteBuffers(sizeof(bufs)/sizeof(GLuint), bufs); // zeros are ignored
+}
+
+const GLvoid* CGLWidget::bindArray(GLenum target, GLuint buf, const GLvoid *data) const
+{
+  if (!_use_vbo) return data;
+  glBindBuffer(target, buf);
+  return NULL; // offset into the buffer
 }
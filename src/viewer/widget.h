@@ -4,11 +4,13 @@
 #include <QGLWidget>
 #include <QList>
 #include <QVector>
+#include <QSet>
 #include <QVector3D>
 #include <QMatrix4x4>
 #include <cmath>
 #include "def.h"
 #include "trackball.h"
+#include "frameloader.h"
 #include "common/Inclusions.h"
 #include "common/VortexTransition.h"
 
@@ -41,7 +43,7 @@ public:
   CGLWidget(const QGLFormat& fmt=QGLFormat::defaultFormat(), QWidget *parent=NULL, QGLWidget *sharedWidget=NULL); 
   ~CGLWidget(); 
 
-  void LoadVortexLines();
+  void LoadVortexLines(int dir=0); // dir is the direction of travel in time
   void LoadVortexLinesFromTextFile(const std::string& filename); // legacy
   void LoadVortexLines2D(); // special for 2D simulation
   void LoadFieldLines(const std::string& filename);
@@ -100,6 +102,28 @@ private: //data
 
   const VortexTransition *_vt;
 
+  std::vector<float> _lod_tolerances; // levels of detail in the DB
+  int _lod; // of the loaded lines
+  int SelectLOD() const;
+
+private: // background frame loading
+  struct FrameOptions {
+    int lod;
+    bool bezier, vip, mds;
+    QSet<int> vips;
+    bool operator==(const FrameOptions& o) const {
+      return lod == o.lod && bezier == o.bezier && vip == o.vip && mds == o.mds && vips == o.vips;
+    }
+  };
+  FrameOptions currentFrameOptions() const;
+  void buildFrame(const FrameOptions& opts, int timestep, CVortexFrame& frame) const; // loader thread
+  void swapFrame(CVortexFrame& frame);
+
+  CFrameLoader *_loader;
+  FrameOptions _frame_options; // of the loader's builder
+  bool _has_frame_options;
+  CFrameLoader::Frame _frame; // whose buffers are swapped in, and go back to the loader
+
 private: // camera
   const float _fovy, _znear, _zfar; 
   const QVector3D _eye, _center, _up;
@@ -124,9 +148,7 @@ private: // vortex line rendering
   std::vector<GLsizei> v_line_vert_count; 
   std::vector<GLint> v_line_indices; 
   
-  std::vector<GLfloat> vortex_tube_vertices, vortex_tube_normals;
-  std::vector<GLubyte> vortex_tube_colors; 
-  std::vector<GLuint> vortex_tube_indices_lines, vortex_tube_indices_vertices;
+  VortexTubeMesh vortex_tubes;
 
 private: //HDR
   typedef struct {
@@ -138,6 +160,19 @@ private: //HDR
     } vfgpu_hdr_t;
   std::vector<vfgpu_hdr_t> vfgpu_hdrs;
 
+  typedef struct {
+    unsigned char meshtype;
+    bool tracking;
+    float dt;
+    int d[3];
+    unsigned int count; // d[0]*d[1]*d[2];
+    bool pbc[3];
+    float origins[3];
+    float lengths[3];
+    float cell_lengths[3];
+    float zaniso;
+  } vfgpu_cfg_t;
+
 private: // MDS
   std::vector<float> v_mds_coords;
 
@@ -153,6 +188,27 @@ private: // history line render
   void clearHistory();
   void renderHistoryVortexLines();
 
+  // history frames packed into one set of arrays, for a single multi-draw;
+  // frame i has the vertices [h_frame_offsets[i], h_frame_offsets[i+1])
+  std::vector<GLfloat> h_packed_vertices;
+  std::vector<GLubyte> h_packed_colors;
+  std::vector<GLsizei> h_packed_vert_count;
+  std::vector<GLint> h_packed_indices;
+  std::vector<GLint> h_frame_offsets;
+  void packHistory();
+
+private: // buffer objects, uploaded once per change of the data; client-side
+         // arrays are used where they are not supported (e.g. indirect GLX)
+  bool _use_vbo;
+  bool _lines_dirty, _history_dirty;
+  GLuint _vbo_line_vertices, _vbo_line_colors;
+  GLuint _vbo_tube_vertices, _vbo_tube_colors, _ibo_tube_indices;
+  GLuint _vbo_history_vertices, _vbo_history_colors;
+
+  void updateBuffers(); // in paintGL(), with the context current
+  void deleteBuffers();
+  const GLvoid* bindArray(GLenum target, GLuint buf, const GLvoid *data) const;
+
 private: // isosurface rendering
   std::vector<GLfloat> s_triangle_vertices, s_triangle_normals;
   std::vector<GLuint> s_triangle_indices;
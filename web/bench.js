@@ -0,0 +1,102 @@
+// Compares the JSON and the binary frame paths: payload size (raw and 
+// deflated), server-side encoding time, client-side decoding time, the 
+// estimated transfer time on a given link, and the quantization error.
+//
+// usage: node bench.js <dbname> [first_frame] [last_frame] [link_mbps] [quantum]
+
+const zlib = require("zlib");
+const vf2 = require("./build/Release/vf2.node");
+const frameCodec = require("./public/frame.js");
+
+if (process.argv.length < 3) {
+  console.log("usage: node bench.js <dbname> [first_frame] [last_frame] [link_mbps] [quantum]");
+  process.exit(1);
+}
+
+const dbname = process.argv[2];
+const mbps = process.argv.length > 5 ? Number(process.argv[5]) : 10;
+const quantum = process.argv.length > 6 ? Number(process.argv[6]) : 0;
+
+var obj = new vf2.vf2();
+obj.openDB(dbname);
+const nframes = obj.getDataInfo().hdrs.length;
+const first = process.argv.length > 3 ? Number(process.argv[3]) : 0;
+const last = Math.min(process.argv.length > 4 ? Number(process.argv[4]) : first + 99, nframes - 1);
+
+function now() {
+  var t = process.hrtime();
+  return t[0] * 1e3 + t[1] * 1e-6; // ms
+}
+
+function toArrayBuffer(buf) {
+  return buf.buffer.slice(buf.byteOffset, buf.byteOffset + buf.byteLength);
+}
+
+var stats = {
+  json: {bytes: 0, deflated: 0, encode: 0, decode: 0},
+  binary: {bytes: 0, deflated: 0, encode: 0, decode: 0}
+};
+var maxError = 0, nverts = 0, nframesBenched = 0;
+
+for (var f=first; f<=last; f++) {
+  // json path: addon objects + stringify on the server, parse on the client
+  var t0 = now();
+  var str = JSON.stringify({type: "vlines", data: obj.loadFrame(f)});
+  var t1 = now();
+  var jmsg = JSON.parse(str);
+  var t2 = now();
+  var jbuf = Buffer.from(str);
+  stats.json.bytes += jbuf.length;
+  stats.json.deflated += zlib.deflateRawSync(jbuf).length;
+  stats.json.encode += t1 - t0;
+  stats.json.decode += t2 - t1;
+
+  // binary path
+  t0 = now();
+  var bbuf = obj.loadFrameBinary(f, quantum);
+  t1 = now();
+  var ab = toArrayBuffer(bbuf); // what the browser receives
+  var t1b = now();
+  var bmsg = frameCodec.decodeFrame(ab);
+  t2 = now();
+  stats.binary.bytes += bbuf.length;
+  stats.binary.deflated += zlib.deflateRawSync(bbuf).length;
+  stats.binary.encode += t1 - t0;
+  stats.binary.decode += t2 - t1b;
+
+  // accuracy
+  var jlines = jmsg.data.vlines, blines = bmsg.vlines;
+  if (jlines.length != blines.length) {
+    console.log("frame " + f + ": line count mismatch");
+    process.exit(1);
+  }
+  for (var i=0; i<jlines.length; i++) {
+    var a = jlines[i].verts, b = blines[i].verts;
+    if (a.length != b.length || jlines[i].gid != blines[i].gid) {
+      console.log("frame " + f + ": line " + i + " mismatch");
+      process.exit(1);
+    }
+    for (var j=0; j<a.length; j++) 
+      maxError = Math.max(maxError, Math.abs(a[j] - b[j]));
+    nverts += a.length / 3;
+  }
+  nframesBenched ++;
+}
+
+function report(name, s) {
+  var n = nframesBenched;
+  var transfer = s.bytes * 8 / (mbps * 1e3) / n; // ms per frame
+  console.log(name + 
+      ": bytes/frame=" + (s.bytes/n).toFixed(0) + 
+      ", deflated/frame=" + (s.deflated/n).toFixed(0) + 
+      ", encode=" + (s.encode/n).toFixed(3) + "ms" +
+      ", decode=" + (s.decode/n).toFixed(3) + "ms" + 
+      ", transfer@" + mbps + "Mbps=" + transfer.toFixed(2) + "ms" + 
+      ", total=" + (s.encode/n + s.decode/n + transfer).toFixed(2) + "ms");
+}
+
+console.log("dbname=" + dbname + ", frames=[" + first + ", " + last + "], nverts=" + nverts);
+report("json  ", stats.json);
+report("binary", stats.binary);
+console.log("size ratio=" + (stats.json.bytes / stats.binary.bytes).toFixed(2) + 
+    ", max abs error=" + maxError.toExponential(3));
@@ -5,21 +5,45 @@ var dbList;
 var dbname = "GL_3D_Xfieldramp_inter_tet.rocksdb";
 // var dbname = "GL_3D_Bramp_4holes.rocksdb";
 var currentFrame = 1000;
+var dataLods = [0]; // simplification tolerance of each level of detail
+var currentLod = 0; // of the requested frame
+const lodPixelError = 1; // tolerated screen-space error, in pixels
 
 const wsUri = "ws://localhost:8080/ws";
 
 function requestFrame(frame) {
   console.log("requesting frame " + frame + " in " + dbname);
+  currentLod = selectLod();
   var msg = {
     type: "requestFrame",
     dbname: dbname,
-    frame: currentFrame
+    frame: currentFrame,
+    lod: currentLod
   };
 
   if (ws.readyState == 1) ws.send(JSON.stringify(msg));
   else connectToServer();
 }
 
+// the coarsest level of detail whose error is below lodPixelError at the 
+// camera target
+function selectLod() {
+  var d = camera.position.distanceTo(cameraControls.target);
+  var worldPerPixel = 2 * d * Math.tan(camera.fov * Math.PI / 360) / window.innerHeight;
+  var maxError = lodPixelError * worldPerPixel;
+
+  var lod = 0;
+  for (var k=1; k<dataLods.length; k++)
+    if (dataLods[k] <= maxError) lod = k;
+  return lod;
+}
+
+// refetches the current frame when zooming changes its level of detail
+function updateLod() {
+  if (ws == undefined || ws.readyState != 1 || dataHdrs.length == 0) return;
+  if (selectLod() != currentLod) requestFrame(currentFrame);
+}
+
 function requestDataInfo() {
   console.log("requesting data info");
   var msg = {
@@ -56,7 +80,7 @@ function connectToServer() {
 
   // ws = new WebSocket("ws://red.mcs.anl.gov:8080");
   ws = new WebSocket(wsUri);
-  // ws.binaryType = "arraybuffer";
+  ws.binaryType = "arraybuffer";
   ws.onopen = onOpen;
   ws.onclose = onClose;
   ws.onerror = onError;
@@ -81,6 +105,15 @@ function rgb(r, g, b) {
 
 function onMessage(evt)
 {
+  if (isBinaryFrame(evt.data)) {
+    var frame = decodeFrame(evt.data);
+    // frames of earlier requests may arrive after the current one
+    if (frame.frame != currentFrame || frame.lod != currentLod) return;
+    updateVlines(frame.vlines);
+    updateDistances(frame.dist);
+    return;
+  }
+
   var msg = JSON.parse(evt.data);
   // console.log(msg);
   if (msg.type == "dbList") {
@@ -103,6 +136,7 @@ function updateDBList(list) {
 function updateDataInfo(info, events) {
   dataCfg = info.cfg;
   dataHdrs = info.hdrs;
+  dataLods = info.lods || [0];
   vortexEvents = events;
   updateInclusions(info.inclusions);
 
@@ -221,3 +255,4 @@ function onError(evt)
 }
 
 connectToServer();
+setInterval(updateLod, 250);
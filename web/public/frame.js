@@ -0,0 +1,79 @@
+// Decoder for the binary frame messages produced by vf2.loadFrameBinary().
+// See VF2::EncodeFrame in vf2.cpp for the layout.  The result has the same
+// shape as the JSON frames ({vlines: [{gid, verts, r, g, b, moving_speed}],
+// dist}), except that verts and dist are Float32Arrays.  The int16 streams
+// are read through typed arrays, i.e. in the client's (little) endianness.
+
+const FRAME_MAGIC = 0x46324656; // "VF2F"
+const FRAME_ESCAPE = -32768;
+
+function isBinaryFrame(data) {
+  return data instanceof ArrayBuffer && data.byteLength >= 28 && 
+    new DataView(data).getUint32(0, true) == FRAME_MAGIC;
+}
+
+function decodeFrame(data) {
+  var view = new DataView(data);
+  if (view.getUint32(0, true) != FRAME_MAGIC)
+    throw new Error("not a binary frame");
+  var version = view.getUint16(4, true);
+  if (version != 1)
+    throw new Error("unsupported frame version " + version);
+
+  var lod = view.getUint16(6, true),
+      frame = view.getInt32(8, true),
+      timestep = view.getInt32(12, true),
+      nlines = view.getUint32(16, true),
+      ndist = view.getUint32(20, true),
+      q = view.getFloat32(24, true);
+
+  var vlines = [];
+  var offset = 28;
+  for (var i=0; i<nlines; i++) {
+    var vline = {
+      gid: view.getInt32(offset, true),
+      r: view.getUint8(offset+12),
+      g: view.getUint8(offset+13),
+      b: view.getUint8(offset+14),
+      is_loop: (view.getUint8(offset+15) & 1) != 0,
+      moving_speed: view.getFloat32(offset+16, true)
+    };
+    var nv = view.getUint32(offset+4, true), 
+        nshorts = view.getUint32(offset+8, true);
+    var verts = new Float32Array(nv*3);
+    var x = view.getFloat32(offset+20, true), 
+        y = view.getFloat32(offset+24, true), 
+        z = view.getFloat32(offset+28, true);
+    offset += 32;
+
+    var stream = new Int16Array(data, offset, nshorts);
+    if (nv > 0) {
+      verts[0] = x; verts[1] = y; verts[2] = z;
+    }
+    for (var j=1, s=0; j<nv; j++) {
+      if (stream[s] == FRAME_ESCAPE) {
+        var p = offset + (s+1)*2;
+        x = view.getFloat32(p, true);
+        y = view.getFloat32(p+4, true);
+        z = view.getFloat32(p+8, true);
+        s += 7;
+      } else {
+        x += stream[s] * q;
+        y += stream[s+1] * q;
+        z += stream[s+2] * q;
+        s += 3;
+      }
+      verts[j*3] = x; verts[j*3+1] = y; verts[j*3+2] = z;
+    }
+    offset += (nshorts + (nshorts & 1)) * 2;
+
+    vline.verts = verts;
+    vlines.push(vline);
+  }
+
+  var dist = new Float32Array(data.slice(offset, offset + ndist*4));
+  return {frame: frame, timestep: timestep, lod: lod, vlines: vlines, dist: dist};
+}
+
+if (typeof module !== "undefined")
+  module.exports = {decodeFrame: decodeFrame, isBinaryFrame: isBinaryFrame};
@@ -8,8 +8,18 @@ const vf2 = require('./build/Release/vf2.node');
 // var BSON = new bson.BSONPure.BSON()
 // var BSON = new bson.BSONPure.BSON()
 
+// frames are decoded on the libuv thread pool (UV_THREADPOOL_SIZE, 4 by 
+// default) and cached across connections; frames around the most recent 
+// request of each connection are prefetched
+const prefetchRadius = 4;
+const cacheCapacity = 512 << 20; // bytes
+vf2.setCacheCapacity(cacheCapacity);
+
 var app = express();
 app.use(express.static("public"));
+app.get("/stats", function(req, res) {
+  res.json({cache: vf2.cacheStats(), databases: vf2.databases()});
+});
 
 var server = http.createServer(app);
 server.listen(8080);
@@ -26,13 +36,17 @@ wss.on("connection", function(ws) {
   sendDBList(ws);
 
   var obj = new vf2.vf2();
+  obj.setPrefetch(prefetchRadius);
+  var requests = {latest: 0}; // id of the most recent frame request
 
   ws.on("message", function(data) {
     var msg = JSON.parse(data);
     if (msg.type == "requestDataInfo") {
       sendDataInfo(ws, obj, msg.dbname);
     } else if (msg.type == "requestFrame") {
-      sendFrame(ws, obj, msg.frame);
+      var lod = msg.lod || 0; // level of detail, see getDataInfo().lods
+      if (msg.format == "json") sendFrameJSON(ws, obj, msg.frame, lod);
+      else sendFrame(ws, obj, msg.frame, lod, requests);
     }
   });
 
@@ -55,9 +69,11 @@ function sendDBList(ws) {
   })
 }
 
+// databases are opened once and shared by all connections (see 
+// vf2.databases()); the data info and events are built once per database
 function sendDataInfo(ws, obj, dbname) {
   console.log("requested data info");
-  obj.openDB(dbname);
+  if (!obj.openDB(dbname)) return;
   var dataInfo = obj.getDataInfo();
   var events = obj.getEvents();
 
@@ -69,9 +85,22 @@ function sendDataInfo(ws, obj, dbname) {
   ws.send(JSON.stringify(msg));
 }
 
-function sendFrame(ws, obj, frame) {
-  console.log("requested frame " + frame);
-  var frameData = obj.loadFrame(frame);
+// frames are sent as binary messages; see public/frame.js for the decoder.
+// Requests complete out of order (cache hits before misses), so results of
+// requests superseded by a newer one from the same connection are dropped.
+function sendFrame(ws, obj, frame, lod, requests) {
+  console.log("requested frame " + frame + ", lod " + lod);
+  var id = ++ requests.latest;
+  obj.loadFrameBinaryAsync(frame, 0, lod, function(err, buf) {
+    if (err) console.log(err.message);
+    else if (id != requests.latest) return;
+    else if (ws.readyState == 1) ws.send(buf, {binary: true});
+  });
+}
+
+function sendFrameJSON(ws, obj, frame, lod) {
+  console.log("requested frame " + frame + ", lod " + lod + " (json)");
+  var frameData = obj.loadFrame(frame, lod);
  
   msg = {
     type: "vlines", 
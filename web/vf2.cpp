@@ -1,8 +1,15 @@
 #include "vf2.h"
+#include <node_buffer.h>
 #include <string>
 #include <sstream>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+#include <cstdlib>
 
 Persistent<Function> VF2::constructor;
+std::map<std::string, std::shared_ptr<VF2DB> > VF2::databases;
 
 void VF2::Init(Local<Object> exports) {
   Isolate *isolate = exports->GetIsolate();
@@ -14,10 +21,18 @@ void VF2::Init(Local<Object> exports) {
   NODE_SET_PROTOTYPE_METHOD(tpl, "getDataInfo", GetDataInfo);
   NODE_SET_PROTOTYPE_METHOD(tpl, "getEvents", GetEvents);
   NODE_SET_PROTOTYPE_METHOD(tpl, "loadFrame", LoadFrame);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "loadFrameBinary", LoadFrameBinary);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "loadFrameBinaryAsync", LoadFrameBinaryAsync);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "setPrefetch", SetPrefetch);
 
   constructor.Reset(isolate, tpl->GetFunction());
   exports->Set(String::NewFromUtf8(isolate, "vf2"), 
       tpl->GetFunction());
+
+  NODE_SET_METHOD(exports, "cacheStats", CacheStats);
+  NODE_SET_METHOD(exports, "setCacheCapacity", SetCacheCapacity);
+  NODE_SET_METHOD(exports, "databases", Databases);
+  NODE_SET_METHOD(exports, "releaseDB", ReleaseDB);
 }
 
 void VF2::New(const FunctionCallbackInfo<Value>& args) {
@@ -57,13 +72,28 @@ void VF2::OpenDB(const FunctionCallbackInfo<Value>& args) {
   String::Utf8Value dbname1(args[0]->ToString());
   std::string dbname(*dbname1);
 
-  obj->OpenDB(dbname);
+  // frame workers still running on the previous database keep it alive
+  obj->db = AcquireDB(dbname);
+
+  args.GetReturnValue().Set(Boolean::New(isolate, (bool)obj->db));
 }
 
 void VF2::GetEvents(const FunctionCallbackInfo<Value>& args) {
   Isolate *isolate = args.GetIsolate();
   VF2* obj = ObjectWrap::Unwrap<VF2>(args.Holder());
-  const VortexTransition& vt = obj->vt;
+
+  if (!obj->db) {
+    isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Database not opened")));
+    return;
+  }
+
+  if (!obj->db->jevents.IsEmpty()) {
+    args.GetReturnValue().Set(Local<Value>::New(isolate, obj->db->jevents));
+    return;
+  }
+
+  const VortexTransition& vt = obj->db->vt;
   const std::vector<VortexEvent>& events = vt.Events();
 
   Local<Array> jevents = Array::New(isolate);
@@ -95,17 +125,28 @@ void VF2::GetEvents(const FunctionCallbackInfo<Value>& args) {
     jevents->Set(Number::New(isolate, i), jevent);
   }
 
+  obj->db->jevents.Reset(isolate, jevents);
   args.GetReturnValue().Set(jevents);
 }
 
 void VF2::GetDataInfo(const FunctionCallbackInfo<Value>& args) {
   Isolate *isolate = args.GetIsolate();
   VF2* obj = ObjectWrap::Unwrap<VF2>(args.Holder());
-  
-  obj->LoadDataInfo();
-  const vfgpu_cfg_t& cfg = obj->cfg;
-  const std::vector<vfgpu_hdr_t> &hdrs = obj->hdrs;
-  const Inclusions& incs = obj->incs;
+
+  if (!obj->db) {
+    isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Database not opened")));
+    return;
+  }
+
+  if (!obj->db->jdataInfo.IsEmpty()) {
+    args.GetReturnValue().Set(Local<Value>::New(isolate, obj->db->jdataInfo));
+    return;
+  }
+
+  const vfgpu_cfg_t& cfg = obj->db->cfg;
+  const std::vector<vfgpu_hdr_t> &hdrs = obj->db->hdrs;
+  const Inclusions& incs = obj->db->incs;
 
   // outputs
   Local<Object> jout = Object::New(isolate);
@@ -175,6 +216,14 @@ void VF2::GetDataInfo(const FunctionCallbackInfo<Value>& args) {
   }
   jout->Set(String::NewFromUtf8(isolate, "inclusions"), jincs);
 
+  // levels of detail
+  const std::vector<float>& lods = obj->db->lods;
+  Local<Array> jlods = Array::New(isolate);
+  for (int i=0; i<lods.size(); i++)
+    jlods->Set(i, Number::New(isolate, lods[i]));
+  jout->Set(String::NewFromUtf8(isolate, "lods"), jlods);
+
+  obj->db->jdataInfo.Reset(isolate, jout);
   args.GetReturnValue().Set(jout);
 }
 
@@ -182,7 +231,12 @@ void VF2::LoadFrame(const FunctionCallbackInfo<Value>& args) {
   Isolate *isolate = args.GetIsolate();
 
   VF2* obj = ObjectWrap::Unwrap<VF2>(args.Holder());
-  // const std::string& dbname = obj->dbname;
+
+  if (!obj->db) {
+    isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Database not opened")));
+    return;
+  }
 
   if (args.Length() < 1) {
     isolate->ThrowException(Exception::TypeError(
@@ -190,18 +244,19 @@ void VF2::LoadFrame(const FunctionCallbackInfo<Value>& args) {
     return;
   }
 
-  if (!args[0]->IsNumber()) {
+  if (!args[0]->IsNumber() || (args.Length() > 1 && !args[1]->IsNumber())) {
     isolate->ThrowException(Exception::TypeError(
           String::NewFromUtf8(isolate, "Wrong arguments")));
     return;
   }
 
-  // input args
+  // input args: frame [, lod]
   const int frame = args[0]->NumberValue();
+  int lod = args.Length() > 1 ? args[1]->NumberValue() : 0;
 
   std::vector<VortexLine> vlines;
   std::vector<float> dist;
-  bool succ = obj->LoadFrame(frame, vlines, dist);
+  bool succ = obj->db->LoadFrame(frame, vlines, dist, &lod);
 
   // output 
   Local<Object> jout = Object::New(isolate);
@@ -210,14 +265,6 @@ void VF2::LoadFrame(const FunctionCallbackInfo<Value>& args) {
   Local<Array> jvlines = Array::New(isolate);
   for (size_t i=0; i<vlines.size(); i++) {
     VortexLine& vline = vlines[i];
-    if (vline.is_bezier) {
-      vline.ToRegular(500);
-    } else {
-      vline.RemoveInvalidPoints();
-      vline.Simplify(0.1);
-      // vline.ToBezier(0.01);
-      // vline.ToRegular(100);
-    }
     Local<Object> jvline = Object::New(isolate);
 
     // gid
@@ -252,12 +299,481 @@ void VF2::LoadFrame(const FunctionCallbackInfo<Value>& args) {
   for (size_t i=0; i<dist.size(); i++) 
     jdist->Set(i, Number::New(isolate, dist[i]));
   jout->Set(String::NewFromUtf8(isolate, "dist"), jdist);
+  jout->Set(String::NewFromUtf8(isolate, "lod"), Number::New(isolate, lod));
 
   args.GetReturnValue().Set(jout);
 }
 
-bool VF2::OpenDB(const std::string& dbname_)
+static bool ParseFrameArgs(const FunctionCallbackInfo<Value>& args, int nargs, int& frame, float& quantum, int& lod)
+{
+  Isolate *isolate = args.GetIsolate();
+
+  if (args.Length() < nargs) {
+    isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Wrong number of arguments")));
+    return false;
+  }
+
+  for (int i=0; i<nargs; i++) 
+    if (!args[i]->IsNumber()) {
+      isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8(isolate, "Wrong arguments")));
+      return false;
+    }
+
+  frame = args[0]->NumberValue();
+  quantum = nargs > 1 ? args[1]->NumberValue() : 0;
+  lod = nargs > 2 ? args[2]->NumberValue() : 0;
+  return true;
+}
+
+void VF2::LoadFrameBinary(const FunctionCallbackInfo<Value>& args) {
+  Isolate *isolate = args.GetIsolate();
+  VF2* obj = ObjectWrap::Unwrap<VF2>(args.Holder());
+
+  // input args: frame [, quantum [, lod]]
+  int frame, lod;
+  float quantum;
+  if (!ParseFrameArgs(args, std::min(args.Length(), 3), frame, quantum, lod)) return;
+
+  if (!obj->db) {
+    isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Database not opened")));
+    return;
+  }
+
+  FrameCache::Entry buf = EncodedFrame(*obj->db, frame, quantum, lod, false);
+  args.GetReturnValue().Set(
+      node::Buffer::Copy(isolate, buf->data(), buf->size()).ToLocalChecked());
+}
+
+void VF2::LoadFrameBinaryAsync(const FunctionCallbackInfo<Value>& args) {
+  Isolate *isolate = args.GetIsolate();
+  VF2* obj = ObjectWrap::Unwrap<VF2>(args.Holder());
+
+  // input args: frame [, quantum [, lod]], callback(err, buf)
+  const int nargs = std::max(1, std::min(args.Length() - 1, 3));
+  int frame, lod;
+  float quantum;
+  if (!ParseFrameArgs(args, nargs, frame, quantum, lod)) return;
+  if (args.Length() < nargs + 1 || !args[nargs]->IsFunction()) {
+    isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Wrong arguments")));
+    return;
+  }
+
+  if (!obj->db) {
+    isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8(isolate, "Database not opened")));
+    return;
+  }
+
+  obj->QueueFrameWork(frame, quantum, lod, Local<Function>::Cast(args[nargs]));
+}
+
+void VF2::SetPrefetch(const FunctionCallbackInfo<Value>& args) {
+  Isolate *isolate = args.GetIsolate();
+  VF2* obj = ObjectWrap::Unwrap<VF2>(args.Holder());
+
+  if (args.Length() < 1 || !args[0]->IsNumber()) {
+    isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Wrong arguments")));
+    return;
+  }
+
+  obj->prefetch = std::max(0, (int)args[0]->NumberValue());
+}
+
+void VF2::CacheStats(const FunctionCallbackInfo<Value>& args) {
+  Isolate *isolate = args.GetIsolate();
+  const FrameCache::Stats s = FrameCache::Instance().GetStats();
+
+  Local<Object> jstats = Object::New(isolate);
+  jstats->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, s.hits));
+  jstats->Set(String::NewFromUtf8(isolate, "misses"), Number::New(isolate, s.misses));
+  jstats->Set(String::NewFromUtf8(isolate, "waits"), Number::New(isolate, s.waits));
+  jstats->Set(String::NewFromUtf8(isolate, "hitRate"), 
+      Number::New(isolate, s.hits + s.misses > 0 ? (double)s.hits / (s.hits + s.misses) : 0));
+  jstats->Set(String::NewFromUtf8(isolate, "prefetches"), Number::New(isolate, s.prefetches));
+  jstats->Set(String::NewFromUtf8(isolate, "prefetchHits"), Number::New(isolate, s.prefetch_hits));
+  jstats->Set(String::NewFromUtf8(isolate, "evictions"), Number::New(isolate, s.evictions));
+  jstats->Set(String::NewFromUtf8(isolate, "entries"), Number::New(isolate, s.entries));
+  jstats->Set(String::NewFromUtf8(isolate, "bytes"), Number::New(isolate, s.bytes));
+  jstats->Set(String::NewFromUtf8(isolate, "capacity"), Number::New(isolate, s.capacity));
+
+  args.GetReturnValue().Set(jstats);
+}
+
+void VF2::SetCacheCapacity(const FunctionCallbackInfo<Value>& args) {
+  Isolate *isolate = args.GetIsolate();
+
+  if (args.Length() < 1 || !args[0]->IsNumber() || args[0]->NumberValue() < 0) {
+    isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Wrong arguments")));
+    return;
+  }
+
+  FrameCache::Instance().SetCapacity(args[0]->NumberValue());
+}
+
+void VF2::Databases(const FunctionCallbackInfo<Value>& args) {
+  Isolate *isolate = args.GetIsolate();
+
+  Local<Array> jdbs = Array::New(isolate);
+  int i = 0;
+  for (std::map<std::string, std::shared_ptr<VF2DB> >::iterator it = databases.begin(); 
+      it != databases.end(); it ++) {
+    Local<Object> jdb = Object::New(isolate);
+    jdb->Set(String::NewFromUtf8(isolate, "dbname"), String::NewFromUtf8(isolate, it->first.c_str()));
+    jdb->Set(String::NewFromUtf8(isolate, "users"), Number::New(isolate, it->second.use_count() - 1));
+    jdbs->Set(i ++, jdb);
+  }
+
+  args.GetReturnValue().Set(jdbs);
+}
+
+void VF2::ReleaseDB(const FunctionCallbackInfo<Value>& args) {
+  Isolate *isolate = args.GetIsolate();
+
+  if (args.Length() < 1 || !args[0]->IsString()) {
+    isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8(isolate, "Wrong arguments")));
+    return;
+  }
+
+  // the database is closed once its current users are done with it; the 
+  // next openDB() opens it again, e.g. to pick up new frames
+  String::Utf8Value dbname(args[0]->ToString());
+  args.GetReturnValue().Set(Boolean::New(isolate, 
+        databases.erase(CanonicalDBName(*dbname)) > 0));
+}
+
+std::string VF2::CanonicalDBName(const std::string& dbname)
+{
+  char path[PATH_MAX];
+  if (realpath(dbname.c_str(), path) != NULL) return path;
+  else return dbname;
+}
+
+std::shared_ptr<VF2DB> VF2::AcquireDB(const std::string& dbname_)
+{
+  const std::string dbname = CanonicalDBName(dbname_);
+  std::map<std::string, std::shared_ptr<VF2DB> >::iterator it = databases.find(dbname);
+  if (it != databases.end()) return it->second;
+
+  std::shared_ptr<VF2DB> db(new VF2DB);
+  if (!db->Open(dbname)) return std::shared_ptr<VF2DB>();
+  databases[dbname] = db;
+  return db;
+}
+
+////// frame workers
+struct VF2::FrameWork {
+  uv_work_t req;
+  VF2 *obj; // referenced until the work is done
+  std::shared_ptr<VF2DB> db;
+  int frame;
+  float quantum;
+  int lod;
+  bool prefetch;
+  unsigned int generation; // of the request that queued this work
+  FrameCache::Entry entry;
+  Persistent<Function> callback; // empty for prefetches
+};
+
+void VF2::QueueFrameWork(int frame, float quantum, int lod, Local<Function> callback)
+{
+  Isolate *isolate = Isolate::GetCurrent();
+  const unsigned int gen = ++ generation;
+
+  // the request goes first, followed by its neighbors, nearest first
+  std::vector<int> frames(1, frame);
+  const int nframes = db->vt.NTimesteps();
+  for (int d=1; d<=prefetch; d++) {
+    if (frame + d < nframes) frames.push_back(frame + d);
+    if (frame - d >= 0) frames.push_back(frame - d);
+  }
+
+  for (size_t i=0; i<frames.size(); i++) {
+    FrameWork *w = new FrameWork;
+    w->req.data = w;
+    w->obj = this;
+    w->db = db;
+    w->frame = frames[i];
+    w->quantum = quantum;
+    w->lod = lod;
+    w->prefetch = i > 0;
+    w->generation = gen;
+    if (i == 0) w->callback.Reset(isolate, callback);
+
+    Ref();
+    uv_queue_work(uv_default_loop(), &w->req, ExecuteFrameWork, AfterFrameWork);
+  }
+}
+
+void VF2::ExecuteFrameWork(uv_work_t *req)
+{
+  FrameWork *w = static_cast<FrameWork*>(req->data);
+  w->entry = EncodedFrame(*w->db, w->frame, w->quantum, w->lod, w->prefetch, 
+      &w->obj->generation, w->generation);
+}
+
+void VF2::AfterFrameWork(uv_work_t *req, int status)
+{
+  Isolate *isolate = Isolate::GetCurrent();
+  HandleScope scope(isolate);
+  FrameWork *w = static_cast<FrameWork*>(req->data);
+
+  if (!w->callback.IsEmpty()) {
+    Local<Function> callback = Local<Function>::New(isolate, w->callback);
+    Local<Value> argv[2] = {Null(isolate), Null(isolate)};
+    if (status == 0 && w->entry) 
+      argv[1] = node::Buffer::Copy(isolate, w->entry->data(), w->entry->size()).ToLocalChecked();
+    else 
+      argv[0] = Exception::Error(String::NewFromUtf8(isolate, "Failed to load frame"));
+    node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(), callback, 2, argv);
+    w->callback.Reset();
+  }
+
+  w->obj->Unref();
+  delete w;
+}
+
+FrameCache::Entry VF2::EncodedFrame(const VF2DB& db, int frame, float quantum, int lod, 
+    bool prefetch, const std::atomic<unsigned int> *generation, unsigned int gen)
+{
+  if (!(quantum > 0)) quantum = db.DefaultQuantum();
+
+  // prefetches queued before a newer request are dropped
+  FrameCache::Entry entry;
+  if (prefetch && generation && *generation != gen) return entry;
+
+  uint32_t qbits;
+  memcpy(&qbits, &quantum, sizeof(float));
+  std::stringstream ss;
+  ss << db.dbname << "#" << db.instance << "#" << frame << "#" << qbits << "#" << lod;
+  const std::string key = ss.str();
+
+  FrameCache &cache = FrameCache::Instance();
+  if (cache.Acquire(key, entry, prefetch) != FrameCache::ACQUIRED)
+    return entry;
+
+  std::vector<VortexLine> vlines;
+  std::vector<float> dist;
+  const bool found = db.LoadFrame(frame, vlines, dist, &lod);
+
+  std::string *buf = new std::string;
+  db.EncodeFrame(frame, lod, vlines, dist, quantum, *buf);
+  entry.reset(buf);
+
+  // a missing frame is encoded as an empty one but not cached, so that it is
+  // loaded again once the extractor has written it
+  if (found) cache.Put(key, entry, prefetch);
+  else cache.Release(key);
+  return entry;
+}
+
+////// frame cache
+FrameCache& FrameCache::Instance()
+{
+  static FrameCache cache;
+  return cache;
+}
+
+void FrameCache::SetCapacity(size_t bytes)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _capacity = bytes;
+  Evict();
+}
+
+FrameCache::Stats FrameCache::GetStats() const
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  Stats s = _stats;
+  s.entries = _lru.size();
+  s.capacity = _capacity;
+  return s;
+}
+
+int FrameCache::Acquire(const std::string& key, Entry& entry, bool prefetch)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  bool waited = false;
+
+  while (1) {
+    std::unordered_map<std::string, std::list<Item>::iterator>::iterator it = _index.find(key);
+    if (it != _index.end()) {
+      Item &item = *it->second;
+      if (!prefetch) {
+        _stats.hits ++;
+        if (item.prefetched) _stats.prefetch_hits ++;
+        item.prefetched = false;
+      }
+      entry = item.entry;
+      _lru.splice(_lru.begin(), _lru, it->second);
+      return CACHED;
+    }
+
+    if (_pending.find(key) == _pending.end()) break;
+    if (prefetch) return PENDING;
+
+    if (!waited) _stats.waits ++;
+    waited = true;
+    _cond.wait(lock);
+  }
+
+  if (!prefetch) _stats.misses ++;
+  _pending.insert(key);
+  return ACQUIRED;
+}
+
+void FrameCache::Put(const std::string& key, const Entry& entry, bool prefetched)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _pending.erase(key);
+
+  Item item;
+  item.key = key;
+  item.entry = entry;
+  item.prefetched = prefetched;
+  _lru.push_front(item);
+  _index[key] = _lru.begin();
+  _stats.bytes += entry->size();
+  if (prefetched) _stats.prefetches ++;
+
+  Evict();
+  _cond.notify_all();
+}
+
+void FrameCache::Release(const std::string& key)
 {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _pending.erase(key);
+  _cond.notify_all();
+}
+
+void FrameCache::Evict()
+{
+  // the most recent entry is kept even if it alone exceeds the capacity
+  while (_stats.bytes > _capacity && _lru.size() > 1) {
+    const Item &item = _lru.back();
+    _stats.bytes -= item.entry->size();
+    _index.erase(item.key);
+    _lru.pop_back();
+    _stats.evictions ++;
+  }
+}
+
+// Binary frame layout (little endian, all records 4-byte aligned):
+//   header:  uint32 magic "VF2F", uint16 version, uint16 lod, 
+//            int32 frame, int32 timestep, uint32 nlines, uint32 ndist, 
+//            float32 quantum
+//   nlines x line: int32 gid, uint32 nverts, uint32 nshorts, 
+//            uint8 r, g, b, flags (bit 0: loop), float32 moving_speed, 
+//            float32 x0, y0, z0, 
+//            int16 stream[nshorts] (padded to an even count)
+//   ndist x float32: distance matrix
+// Each vertex after the first is a delta from the previously decoded vertex
+// in units of quantum, as three int16.  Deltas are taken against the 
+// reconstructed position so that errors do not accumulate (at most quantum/2
+// per coordinate).  A delta that does not fit, or a non-finite vertex, is 
+// escaped with INT16_MIN followed by the raw float32 coordinates (six int16).
+static const uint32_t frame_magic = 0x46324656; // "VF2F"
+static const uint16_t frame_version = 1;
+static const int16_t frame_escape = SHRT_MIN;
+
+template <typename T>
+static inline void append(std::string& buf, const T& v)
+{
+  buf.append((const char*)&v, sizeof(T));
+}
+
+void VF2DB::EncodeFrame(int frame, int lod, 
+    const std::vector<VortexLine>& vlines, 
+    const std::vector<float>& dist, 
+    float quantum,
+    std::string& buf) const
+{
+  size_t nverts_total = 0;
+  for (size_t i=0; i<vlines.size(); i++)
+    nverts_total += vlines[i].size() / 3;
+
+  buf.clear();
+  buf.reserve(28 + vlines.size()*36 + nverts_total*6 + dist.size()*4);
+
+  append(buf, frame_magic);
+  append(buf, frame_version);
+  append(buf, (uint16_t)lod);
+  append(buf, (int32_t)frame);
+  append(buf, (int32_t)(frame >= 0 && frame < vt.NTimesteps() ? vt.Frame(frame) : -1));
+  append(buf, (uint32_t)vlines.size());
+  append(buf, (uint32_t)dist.size());
+  append(buf, quantum);
+
+  const double q = quantum; 
+  std::vector<int16_t> stream;
+
+  for (size_t i=0; i<vlines.size(); i++) {
+    const VortexLine& vline = vlines[i];
+    const int nv = vline.size() / 3;
+
+    stream.clear();
+    double P[3] = {0, 0, 0}; // reconstructed position
+    for (int j=0; j<nv; j++) {
+      const float *X = &vline[j*3];
+      if (j == 0) {
+        for (int k=0; k<3; k++) P[k] = X[k];
+        continue;
+      }
+
+      long d[3];
+      bool fits = true;
+      for (int k=0; k<3; k++) {
+        const double r = std::round((X[k] - P[k]) / q);
+        if (!(r > SHRT_MIN && r <= SHRT_MAX)) { // also catches NaN
+          fits = false;
+          break;
+        }
+        d[k] = (long)r;
+      }
+
+      if (fits) {
+        for (int k=0; k<3; k++) {
+          stream.push_back((int16_t)d[k]);
+          P[k] += d[k] * q;
+        }
+      } else {
+        int16_t raw[6];
+        memcpy(raw, X, sizeof(float)*3);
+        stream.push_back(frame_escape);
+        stream.insert(stream.end(), raw, raw+6);
+        for (int k=0; k<3; k++) P[k] = X[k];
+      }
+    }
+    const uint32_t nshorts = stream.size();
+    if (stream.size() % 2) stream.push_back(0);
+
+    append(buf, (int32_t)vline.gid);
+    append(buf, (uint32_t)nv);
+    append(buf, nshorts);
+    append(buf, vline.r);
+    append(buf, vline.g);
+    append(buf, vline.b);
+    append(buf, (uint8_t)(vline.is_loop ? 1 : 0));
+    append(buf, vline.moving_speed);
+    for (int k=0; k<3; k++) 
+      append(buf, nv > 0 ? vline[k] : 0.f);
+    buf.append((const char*)stream.data(), stream.size()*sizeof(int16_t));
+  }
+
+  buf.append((const char*)dist.data(), dist.size()*sizeof(float));
+}
+
+bool VF2DB::Open(const std::string& dbname_)
+{
+  static unsigned int instances = 0; // opened on the main thread only
+  instance = ++ instances;
   dbname = dbname_;
   rocksdb::Options options;
   options.create_if_missing = false;
@@ -271,16 +787,15 @@ bool VF2::OpenDB(const std::string& dbname_)
   } else return false;
 }
 
-void VF2::CloseDB()
+float VF2DB::DefaultQuantum() const
 {
-  if (db != NULL) {
-    dbname.clear();
-    delete db;
-    db = NULL;
-  }
+  // 1/1024 of the smallest cell
+  const float *h = cfg.cell_lengths;
+  const float hmin = std::min(h[0], std::min(h[1], h[2]));
+  return hmin > 0 ? hmin / 1024 : 1e-3;
 }
 
-void VF2::LoadDataInfo()
+void VF2DB::LoadDataInfo()
 {
   rocksdb::Status s;
   std::string buf;
@@ -297,31 +812,64 @@ void VF2::LoadDataInfo()
   if (buf.size() > 0) 
     diy::unserialize(buf, incs);
   
-  s = db->Get(rocksdb::ReadOptions(), "trans", &buf);
-  if (buf.size() > 0) {
-    diy::unserialize(buf, vt);
-    // std::srand(0);
-    // vt.SequenceGraphColoring(); // TODO
-  }
+  // rebuilt from the matrices if the cached transition is of another version
+  vt.LoadFromDB(db);
+
+  // databases written without levels of detail simplify on the fly
+  s = db->Get(rocksdb::ReadOptions(), "lods", &buf);
+  if (buf.size() > 0) 
+    diy::unserialize(buf, lods);
+  else
+    DefaultVortexLineLODTolerances(cfg.cell_lengths, lods);
 }
 
-bool VF2::LoadFrame(
+bool VF2DB::LoadFrame(
     int frame, 
     std::vector<VortexLine>& vlines,
-    std::vector<float>& dist)
+    std::vector<float>& dist, 
+    int *lod_) const
 {
+  const int lod = lod_ ? std::max(0, std::min(*lod_, (int)lods.size()-1)) : 0;
+  if (lod_) *lod_ = lod;
+
   fprintf(stderr, "dbname=%s, frame=%d\n", dbname.c_str(), frame);
 
+  if (frame < 0 || frame >= vt.NTimesteps()) return false;
+
   rocksdb::Status s;
   std::string buf;
 
   const int timestep = vt.Frame(frame);
   std::stringstream ss;
-  ss << "v." << timestep;
-  buf.clear();
-  s = db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
-  if (buf.empty()) return false;
-  diy::unserialize(buf, vlines);
+  bool precomputed = false;
+  if (lod > 0) { // precomputed level of detail
+    ss << "l" << lod << "." << timestep;
+    s = db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+    precomputed = s.ok() && !buf.empty();
+    ss.str("");
+  }
+  // the resampled geometry is used if the extractor cached it
+  if (!precomputed) {
+    buf.clear();
+    ss << "r." << timestep;
+    s = db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+  }
+  if (!buf.empty()) 
+    diy::unserialize(buf, vlines);
+  else {
+    ss.str("");
+    ss << "v." << timestep;
+    s = db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
+    if (buf.empty()) return false;
+    diy::unserialize(buf, vlines);
+    ResampleVortexLines(vlines, 500, 0.1, 1); // already on a worker thread
+  }
+
+  if (lod > 0 && !precomputed) {
+    VortexLineWorkspace ws;
+    for (size_t i=0; i<vlines.size(); i++)
+      vlines[i].SimplifyDP(lods[lod], &ws);
+  }
 
   for (size_t i=0; i<vlines.size(); i++) {
     vlines[i].gid = vt.lvid2gvid(frame, vlines[i].id); // sorry, this is confusing
@@ -329,7 +877,7 @@ bool VF2::LoadFrame(
   }
 
   // distance matrix
-  ss.clear();
+  ss.str("");
   ss << "d." << timestep;
   buf.clear();
   s = db->Get(rocksdb::ReadOptions(), ss.str(), &buf);
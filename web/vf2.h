@@ -1,10 +1,20 @@
 #include <node.h>
 #include <node_object_wrap.h>
+#include <uv.h>
 #include <rocksdb/db.h>
+#include <atomic>
+#include <cstring>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
 #include "common/VortexLine.h"
 #include "common/VortexTransition.h"
 #include "common/Inclusions.h"
-  
+
 using namespace v8;
 
 typedef struct {
@@ -28,36 +38,136 @@ typedef struct {
   float zaniso;
 } vfgpu_cfg_t;
 
+/*
+ * \struct  VF2DB
+ * \brief   An opened database, shared by all connections that use it.  It 
+ *          is not modified after Open(), so that the frame workers can 
+ *          share it with the main thread.
+*/
+struct VF2DB {
+  VF2DB() : db(NULL), instance(0) {memset(&cfg, 0, sizeof(vfgpu_cfg_t));}
+  ~VF2DB() {jdataInfo.Reset(); jevents.Reset(); delete db;}
+
+  bool Open(const std::string& dbname);
+  void LoadDataInfo();
+  // lod is the requested level of detail, and is set to the delivered one
+  bool LoadFrame(int frame,
+      std::vector<VortexLine>& vlines,
+      std::vector<float>& dist, 
+      int *lod=NULL) const;
+  void EncodeFrame(int frame, int lod, 
+      const std::vector<VortexLine>& vlines,
+      const std::vector<float>& dist,
+      float quantum,
+      std::string& buf) const;
+  float DefaultQuantum() const;
+
+  std::string dbname;
+  rocksdb::DB* db;
+  unsigned int instance; // distinct for each Open(), so that the frame cache does not mix up reopenings
+
+  vfgpu_cfg_t cfg;
+  std::vector<vfgpu_hdr_t> hdrs;
+  Inclusions incs;
+  VortexTransition vt;
+  std::vector<float> lods; // simplification tolerance of each level of detail
+
+  // memoized results of getDataInfo() and getEvents(); main thread only
+  Persistent<Value> jdataInfo, jevents;
+};
+
+/*
+ * \class   FrameCache
+ * \brief   Process-wide LRU cache of encoded frames, shared by all
+ *          connections and the worker threads.  A frame that is being
+ *          encoded is marked pending, so that concurrent requests for it
+ *          wait for the encoder instead of loading it again.
+*/
+class FrameCache {
+public:
+  typedef std::shared_ptr<const std::string> Entry;
+  enum {CACHED, PENDING, ACQUIRED};
+
+  struct Stats {
+    size_t hits, misses, waits; // requests
+    size_t prefetches, prefetch_hits; // prefetched entries, and those used later
+    size_t evictions;
+    size_t entries, bytes, capacity;
+  };
+
+  static FrameCache& Instance();
+
+  void SetCapacity(size_t bytes);
+  Stats GetStats() const;
+
+  // Requests return CACHED (entry is set), or ACQUIRED if the caller has to
+  // encode the frame and then Put() or Release() it; they wait if the frame
+  // is pending.  Prefetches do not wait and return PENDING instead.
+  int Acquire(const std::string& key, Entry& entry, bool prefetch);
+  void Put(const std::string& key, const Entry& entry, bool prefetched);
+  void Release(const std::string& key);
+
+private:
+  FrameCache() : _capacity(256 << 20) {memset(&_stats, 0, sizeof(Stats));}
+  void Evict();
+
+private:
+  struct Item {
+    std::string key;
+    Entry entry;
+    bool prefetched; // not requested since prefetched
+  };
+
+  mutable std::mutex _mutex;
+  std::condition_variable _cond;
+  std::list<Item> _lru; // most recently used first
+  std::unordered_map<std::string, std::list<Item>::iterator> _index;
+  std::set<std::string> _pending;
+  size_t _capacity;
+  Stats _stats;
+};
+
 class VF2 : public node::ObjectWrap {
 public:
   static void Init(Local<Object> exports);
 
 private:
-  explicit VF2() : db(NULL) {}
-  ~VF2() {CloseDB();}
+  explicit VF2() : prefetch(4), generation(0) {}
+  ~VF2() {}
 
   static void New(const FunctionCallbackInfo<Value>& args);
   static void OpenDB(const FunctionCallbackInfo<Value>& args);
   static void GetDataInfo(const FunctionCallbackInfo<Value>& args);
   static void GetEvents(const FunctionCallbackInfo<Value>& args);
   static void LoadFrame(const FunctionCallbackInfo<Value>& args);
+  static void LoadFrameBinary(const FunctionCallbackInfo<Value>& args);
+  static void LoadFrameBinaryAsync(const FunctionCallbackInfo<Value>& args);
+  static void SetPrefetch(const FunctionCallbackInfo<Value>& args);
+
+  static void CacheStats(const FunctionCallbackInfo<Value>& args);
+  static void SetCacheCapacity(const FunctionCallbackInfo<Value>& args);
+  static void Databases(const FunctionCallbackInfo<Value>& args);
+  static void ReleaseDB(const FunctionCallbackInfo<Value>& args);
 
   static Persistent<Function> constructor;
 
 private:
-  bool OpenDB(const std::string& dbname);
-  void CloseDB();
-  void LoadDataInfo();
-  bool LoadFrame(int frame,
-      std::vector<VortexLine>& vlines,
-      std::vector<float>& dist);
+  // opened databases by canonical path; a database stays open while it is
+  // registered here or used by a connection or a frame worker
+  static std::shared_ptr<VF2DB> AcquireDB(const std::string& dbname);
+  static std::string CanonicalDBName(const std::string& dbname);
+  static std::map<std::string, std::shared_ptr<VF2DB> > databases;
 
 private:
-  std::string dbname;
-  rocksdb::DB* db;
+  struct FrameWork;
+  static void ExecuteFrameWork(uv_work_t *req);
+  static void AfterFrameWork(uv_work_t *req, int status);
+  static FrameCache::Entry EncodedFrame(const VF2DB& db, int frame, float quantum, int lod,
+      bool prefetch, const std::atomic<unsigned int> *generation=NULL, unsigned int gen=0);
+  void QueueFrameWork(int frame, float quantum, int lod, Local<Function> callback);
 
-  vfgpu_cfg_t cfg;
-  std::vector<vfgpu_hdr_t> hdrs;
-  Inclusions incs;
-  VortexTransition vt;
+private:
+  std::shared_ptr<VF2DB> db;
+  int prefetch; // radius, in frames, around the most recent request
+  std::atomic<unsigned int> generation; // bumped by each request
 };